@@ -19,11 +19,14 @@ using compactsufsort_imp::type_traits;
  * @param T[0..n-1] The input string.
  * @param SA[0..n-1] The output array of suffixes.
  * @param n The length of the given string.
+ * @param threads The number of threads used to sort the type B* suffixes.
  * @return 0 if no error occurred, -1 or -2 otherwise.
  */
 template<typename CHARPTR, typename SAIDPTR, typename SAIDX = typename type_traits<SAIDPTR>::SAIDX>
 saint_t
-create(CHARPTR T, SAIDPTR SA, SAIDX n) { return compactsufsort_imp::SA<CHARPTR, SAIDPTR>::create(T, SA, n); }
+create(CHARPTR T, SAIDPTR SA, SAIDX n, unsigned int threads = 1) {
+  return compactsufsort_imp::SA<CHARPTR, SAIDPTR>::create(T, SA, n, threads);
+}
 
 /**
  * Checks the correctness of a given suffix array.
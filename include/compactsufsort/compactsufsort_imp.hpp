@@ -8,10 +8,9 @@
 #include "trsort_imp.hpp"
 #include <mummer/timer.hpp>
 
-#undef _OPENMP
-#ifdef _OPENMP
-# include <omp.h>
-#endif
+#include <thread>
+#include <mutex>
+#include <vector>
 
 
 namespace compactsufsort_imp {
@@ -32,23 +31,62 @@ struct SA {
   }
 
 
+  /* Sorts the B* buckets with sssort using multiple threads. The
+     buckets are handed out, from the last one to the first one, to
+     the threads under a lock. Each bucket is independent and each
+     thread uses its own slice of the free space [m, n-m) of SA as a
+     work buffer, hence the result is identical to the sequential
+     sort. */
+  static void
+  sort_Bstar_buckets(CHARPTR T, SAIDPTR PAb, SAIDPTR SA, SAIDX *bucket_B,
+                     SAIDX n, SAIDX m, unsigned int threads) {
+    const SAIDX bufsize = (n - (2 * m)) / threads;
+    saint_t     c0      = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1;
+    SAIDX       j       = m;
+    std::mutex  lock;
+
+    auto worker = [&](unsigned int id) {
+      const SAIDPTR curbuf = SA + m + id * bufsize;
+      SAIDX         k      = 0, l;
+      saint_t       d0, d1;
+      while(true) {
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if(0 < (l = j)) {
+            d0 = c0, d1 = c1;
+            do {
+              k = bucket_star(bucket_B, d0, d1);
+              if(--d1 <= d0) {
+                d1 = ALPHABET_SIZE - 1;
+                if(--d0 < 0) { break; }
+              }
+            } while(((l - k) <= 1) && (0 < (l = k)));
+            c0 = d0, c1 = d1, j = k;
+          }
+        }
+        if(l == 0) { break; }
+        ss<CHARPTR, SAIDPTR>::sort(T, PAb, SA + k, SA + l,
+                                   curbuf, bufsize, (SAIDX)2, n, *(SA + k) == (m - 1));
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int id = 1; id < threads; ++id)
+      workers.push_back(std::thread(worker, id));
+    worker(0);
+    for(auto& th : workers)
+      th.join();
+  }
+
   /* Sorts suffixes of type B*. */
   static SAIDX
   sort_typeBstar(CHARPTR T, SAIDPTR SA,
                  SAIDX *bucket_A, SAIDX *bucket_B,
-                 SAIDX n) {
+                 SAIDX n, unsigned int threads = 1) {
     SAIDPTR PAb, ISAb, buf;
 
-#ifdef _OPENMP
-    SAIDPTR curbuf;
-    SAIDX l;
-#endif
     SAIDX i, j, k, t, m, bufsize;
     saint_t c0, c1;
-#ifdef _OPENMP
-    saint_t d0, d1;
-    int tmp;
-#endif
 
     /* Initialize bucket arrays. */
     for(SAIDX i = 0; i < (SAIDX)ALPHABET_SIZE; ++i) { bucket_A[i] = 0; }
@@ -107,47 +145,20 @@ struct SA {
 
       /* Sort the type B* substrings using sssort. */
       { TIME_SCOPE("sssort");
-#ifdef _OPENMP
-      tmp = omp_get_max_threads();
-      buf = SA + m, bufsize = (n - (2 * m)) / tmp;
-      c0 = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1, j = m;
-#pragma omp parallel default(shared) private(curbuf, k, l, d0, d1, tmp)
-      {
-        tmp = omp_get_thread_num();
-        curbuf = buf + tmp * bufsize;
-        k = 0;
-        for(;;) {
-#pragma omp critical(sssort_lock)
-          {
-            if(0 < (l = j)) {
-              d0 = c0, d1 = c1;
-              do {
-                k = bucket_star(bucket_B, d0, d1);
-                if(--d1 <= d0) {
-                  d1 = ALPHABET_SIZE - 1;
-                  if(--d0 < 0) { break; }
-                }
-              } while(((l - k) <= 1) && (0 < (l = k)));
-              c0 = d0, c1 = d1, j = k;
+      if(threads > 1) {
+        sort_Bstar_buckets(T, PAb, SA, bucket_B, n, m, threads);
+      } else {
+        buf = SA + m, bufsize = n - (2 * m);
+        for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
+          for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
+            i = bucket_star(bucket_B, c0, c1);
+            if(1 < (j - i)) {
+              ss<CHARPTR, SAIDPTR>::sort(T, PAb, SA + i, SA + j,
+                                         buf, bufsize, (SAIDX)2, n, *(SA + i) == (m - 1));
             }
           }
-          if(l == 0) { break; }
-          ss<CHARPTR, SAIDPTR>::sort(T, PAb, SA + k, SA + l,
-                            curbuf, bufsize, (SAIDX)2, n, *(SA + k) == (m - 1));
-        }
-      }
-#else
-      buf = SA + m, bufsize = n - (2 * m);
-      for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
-        for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
-          i = bucket_star(bucket_B, c0, c1);
-          if(1 < (j - i)) {
-            ss<CHARPTR, SAIDPTR>::sort(T, PAb, SA + i, SA + j,
-                              buf, bufsize, (SAIDX)2, n, *(SA + i) == (m - 1));
-          }
         }
       }
-#endif
       } // time_scope
 
       /* Compute ranks of type B* substrings. */
@@ -268,7 +279,7 @@ struct SA {
   }
 
   static saint_t
-  create(CHARPTR T, SAIDPTR SA, SAIDX n) {
+  create(CHARPTR T, SAIDPTR SA, SAIDX n, unsigned int threads = 1) {
     std::unique_ptr<SAIDX[]> bucket_A, bucket_B;
     SAIDX m;
     saint_t err = 0;
@@ -284,7 +295,7 @@ struct SA {
 
     /* Suffix sort. */
     if(bucket_A && bucket_B) {
-      m = sort_typeBstar(T, SA, bucket_A.get(), bucket_B.get(), n);
+      m = sort_typeBstar(T, SA, bucket_A.get(), bucket_B.get(), n, threads);
       construct_SA(T, SA, bucket_A.get(), bucket_B.get(), n, m);
     } else {
       err = -2;
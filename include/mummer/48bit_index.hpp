@@ -6,6 +6,7 @@
 #endif
 
 #include <cstdint>
+#include <utility>
 #include "48bit_iterator.hpp"
 
 template<typename IDX>
@@ -13,40 +14,62 @@ struct fortyeight_index {
   size_t    m_size;
   uint32_t* m_base32;
   uint16_t* m_base16;
+  bool      m_own; // Whether m_base32 is allocated by this object
 
   fortyeight_index()
     : m_size(0)
     , m_base32(nullptr)
     , m_base16(nullptr)
+    , m_own(true)
   { }
   fortyeight_index(size_t s)
     : m_size(s)
     , m_base32(new uint32_t[(s * 3 + 1) / 2 + 3])
     , m_base16((uint16_t*)(m_base32 + s))
+    , m_own(true)
+  { }
+  // View on existing memory (e.g. a mapped file) laid out as s 32-bit
+  // words followed by s 16-bit words. The memory is not freed.
+  fortyeight_index(const uint32_t* base, size_t s)
+    : m_size(s)
+    , m_base32(const_cast<uint32_t*>(base))
+    , m_base16((uint16_t*)(m_base32 + s))
+    , m_own(false)
   { }
   fortyeight_index(fortyeight_index&& rhs)
     : m_size(rhs.m_size)
     , m_base32(rhs.m_base32)
     , m_base16(rhs.m_base16)
+    , m_own(rhs.m_own)
   {
     rhs.m_size   = 0;
     rhs.m_base32 = nullptr;
     rhs.m_base16 = nullptr;
+    rhs.m_own    = true;
   }
   fortyeight_index(const fortyeight_index& rhs) = delete;
+  fortyeight_index& operator=(fortyeight_index&& rhs) {
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_base32, rhs.m_base32);
+    std::swap(m_base16, rhs.m_base16);
+    std::swap(m_own, rhs.m_own);
+    return *this;
+  }
 
   // Discard all data
   void resize(size_t s) {
-    delete [] m_base32;
+    if(m_own) delete [] m_base32;
     m_size   = s;
     m_base32 = new uint32_t[(s * 3 + 1) / 2 + 3];
     m_base16 = (uint16_t*)(m_base32 + s);
+    m_own    = true;
   }
 
   size_t size() const { return m_size; }
+  bool is_view() const { return !m_own; }
 
   ~fortyeight_index() {
-    delete [] m_base32;
+    if(m_own) delete [] m_base32;
   }
 
   typedef fortyeight_iterator<IDX>       iterator;
@@ -4,6 +4,8 @@
 #include <vector>
 #include <atomic>
 #include <iostream>
+#include <cstdint>
+#include <type_traits>
 
 /**
  * Lock-free parallel disjoint set data structure (aka UNION-FIND)
@@ -19,20 +21,34 @@
  * of disjoint sets and a combined unite+unlock operation.
  *
  * \author Wenzel Jakob
+ *
+ * The parent and the rank of an element are packed in a 64 bit word,
+ * with the lock flag in the top bit. With 32 bit ids (DisjointSets),
+ * the rank takes the 31 bits left. With 64 bit ids, for more than 2^32
+ * elements, the id takes the lower 40 bits and the rank the 23 bits
+ * left, more than enough for a rank of at most log2 of the size.
  */
-class DisjointSets {
+template<typename Id>
+class basic_disjoint_sets {
+    static_assert(std::is_unsigned<Id>::value && (sizeof(Id) == 4 || sizeof(Id) == 8),
+                  "Id must be a 32 or 64 bit unsigned integer");
 public:
-    DisjointSets(uint32_t size) : mData(size) {
-      for (uint32_t i=0; i<mData.size(); ++i)
-            mData[i] = (uint32_t) i;
+    typedef Id id_type;
+    static constexpr int      id_bits   = sizeof(Id) == 4 ? 32 : 40;
+    static constexpr uint64_t id_mask   = (1ULL << id_bits) - 1;
+    static constexpr uint64_t rank_mask = (1ULL << (63 - id_bits)) - 1;
+
+    basic_disjoint_sets(Id size) : mData(size) {
+      for (Id i=0; i<mData.size(); ++i)
+            mData[i] = (uint64_t) i;
     }
 
-    uint32_t find(uint32_t id) const {
+    Id find(Id id) const {
         while (id != parent(id)) {
             uint64_t value = mData[id];
-            uint32_t new_parent = parent((uint32_t) value);
+            Id new_parent = parent((Id) (value & id_mask));
             uint64_t new_value =
-                (value & 0xFFFFFFFF00000000ULL) | new_parent;
+                (value & ~id_mask) | new_parent;
             /* Try to update parent (may fail, that's ok) */
             if (value != new_value)
                 mData[id].compare_exchange_weak(value, new_value);
@@ -41,7 +57,7 @@ public:
         return id;
     }
 
-    bool same(uint32_t id1, uint32_t id2) const {
+    bool same(Id id1, Id id2) const {
         for (;;) {
             id1 = find(id1);
             id2 = find(id2);
@@ -52,7 +68,7 @@ public:
         }
     }
 
-    uint32_t unite(uint32_t id1, uint32_t id2) {
+    Id unite(Id id1, Id id2) {
         for (;;) {
             id1 = find(id1);
             id2 = find(id2);
@@ -67,15 +83,15 @@ public:
                 std::swap(id1, id2);
             }
 
-            uint64_t oldEntry = ((uint64_t) r1 << 32) | id1;
-            uint64_t newEntry = ((uint64_t) r1 << 32) | id2;
+            uint64_t oldEntry = ((uint64_t) r1 << id_bits) | id1;
+            uint64_t newEntry = ((uint64_t) r1 << id_bits) | id2;
 
             if (!mData[id1].compare_exchange_strong(oldEntry, newEntry))
                 continue;
 
             if (r1 == r2) {
-                oldEntry = ((uint64_t) r2 << 32) | id2;
-                newEntry = ((uint64_t) (r2+1) << 32) | id2;
+                oldEntry = ((uint64_t) r2 << id_bits) | id2;
+                newEntry = ((uint64_t) (r2+1) << id_bits) | id2;
                 /* Try to update the rank (may fail, that's ok) */
                 mData[id2].compare_exchange_weak(oldEntry, newEntry);
             }
@@ -84,7 +100,7 @@ public:
         }
         return id2;
     }
-    inline uint32_t union_sets(uint32_t id1, uint32_t id2) {
+    inline Id union_sets(Id id1, Id id2) {
         return unite(id1, id2);
     }
 
@@ -95,11 +111,11 @@ public:
      * updated to store the current representative ID of the
      * union
      */
-    bool try_lock(uint32_t &id) {
+    bool try_lock(Id &id) {
         const uint64_t lock_flag = 1ULL << 63;
         id = find(id);
         uint64_t value = mData[id];
-        if ((value & lock_flag) || (uint32_t) value != id)
+        if ((value & lock_flag) || (Id) (value & id_mask) != id)
             return false;
         // On IA32/x64, a PAUSE instruction is recommended for CAS busy loops
         #if defined(__i386__) || defined(__amd64__)
@@ -108,7 +124,7 @@ public:
         return mData[id].compare_exchange_strong(value, value | lock_flag);
     }
 
-    void unlock(uint32_t id) {
+    void unlock(Id id) {
         const uint64_t lock_flag = 1ULL << 63;
         mData[id] &= ~lock_flag;
     }
@@ -117,7 +133,7 @@ public:
      * Return the representative index of the set that results from merging
      * locked disjoint sets 'id1' and 'id2'
      */
-    uint32_t unite_index_locked(uint32_t id1, uint32_t id2) const {
+    Id unite_index_locked(Id id1, Id id2) const {
         uint32_t r1 = rank(id1), r2 = rank(id2);
         return (r1 > r2 || (r1 == r2 && id1 < id2)) ? id1 : id2;
     }
@@ -126,7 +142,7 @@ public:
      * Atomically unite two locked disjoint sets and unlock them. Assumes
      * that here are no other concurrent unite() involving the same sets
      */
-    uint32_t unite_unlock(uint32_t id1, uint32_t id2) {
+    Id unite_unlock(Id id1, Id id2) {
         uint32_t r1 = rank(id1), r2 = rank(id2);
 
         if (r1 > r2 || (r1 == r2 && id1 < id2)) {
@@ -134,23 +150,23 @@ public:
             std::swap(id1, id2);
         }
 
-        mData[id1] = ((uint64_t) r1 << 32) | id2;
-        mData[id2] = ((uint64_t) (r2 + ((r1 == r2) ? 1 : 0)) << 32) | id2;
+        mData[id1] = ((uint64_t) r1 << id_bits) | id2;
+        mData[id2] = ((uint64_t) (r2 + ((r1 == r2) ? 1 : 0)) << id_bits) | id2;
 
         return id2;
     }
 
-    uint32_t size() const { return (uint32_t) mData.size(); }
+    Id size() const { return (Id) mData.size(); }
 
-    uint32_t rank(uint32_t id) const {
-        return ((uint32_t) (mData[id] >> 32)) & 0x7FFFFFFFu;
+    uint32_t rank(Id id) const {
+        return (uint32_t) ((mData[id] >> id_bits) & rank_mask);
     }
 
-    uint32_t parent(uint32_t id) const {
-        return (uint32_t) mData[id];
+    Id parent(Id id) const {
+        return (Id) (mData[id] & id_mask);
     }
 
-    friend std::ostream &operator<<(std::ostream &os, const DisjointSets &f) {
+    friend std::ostream &operator<<(std::ostream &os, const basic_disjoint_sets &f) {
         for (size_t i=0; i<f.mData.size(); ++i)
             os << i << ": parent=" << f.parent(i) << ", rank=" << f.rank(i) << std::endl;
         return os;
@@ -159,4 +175,6 @@ public:
     mutable std::vector<std::atomic<uint64_t>> mData;
 };
 
+typedef basic_disjoint_sets<uint32_t> DisjointSets;
+
 #endif /* __UNIONFIND_H */
@@ -0,0 +1,184 @@
+#ifndef __INDEX_FILE_H__
+#define __INDEX_FILE_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <memory>
+#include "mapped_vector.hpp"
+
+namespace mummer {
+namespace mummer {
+
+// Single file index format. The file starts with a header page,
+// followed by the sections, each aligned on a page boundary so it can
+// be memory mapped and used in place. All sizes are 64 bits.
+//
+// Besides the suffix array itself, the file holds the reference text
+// (with a checksum) and, when saved by nucmer, the headers and
+// records of the reference sequences. Such an index is self contained
+// and can be loaded without the reference fasta file.
+static const char     index_magic[8] = { 'M', 'U', 'M', 'S', 'A', 'I', 'D', 'X' };
+static const uint64_t index_version  = 4;
+static const uint64_t index_align    = 4096;
+
+enum index_section_id { SA_SECTION, ISA_SECTION, LCP_SECTION, LCP_M_SECTION, CHILD_SECTION, KMR_SECTION,
+                        TEXT_SECTION, HEADERS_SECTION, RECORDS_SECTION, LCP_RANKS_SECTION, LCP_LARGE_SECTION,
+                        KMR_DIR_SECTION, SAMPLE_SECTION, MAX_SECTIONS = 16 };
+
+struct index_section {
+  uint64_t offset; // Offset in file, in bytes. 0 if absent
+  uint64_t count;  // Number of elements
+  uint64_t bytes;  // Size in bytes
+};
+
+struct index_header {
+  char          magic[8];
+  uint64_t      version;
+  int64_t       N, K, logN, NKm1, kMerSize, kMerTableSize;
+  int32_t       sparseMult;
+  uint8_t       _4column, hasSufLink, hasChild, hasKmer, nucleotidesOnly, sa_small;
+  uint64_t      text_length;   // Length of the reference text
+  uint64_t      text_checksum; // index_checksum of the reference text
+  index_section sections[MAX_SECTIONS];
+};
+static_assert(sizeof(index_header) <= index_align, "Index header must fit in a page");
+
+// Checksum of the reference text, to detect that an index is used
+// with a different sequence than the one it was built from. FNV-1a
+// on 64 bit words.
+inline uint64_t index_checksum(const char* s, size_t len) {
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t       h     = 0xcbf29ce484222325ULL ^ len;
+  size_t         i     = 0;
+  for( ; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, s + i, sizeof(w));
+    h = (h ^ w) * prime;
+  }
+  for( ; i < len; ++i)
+    h = (h ^ (unsigned char)s[i]) * prime;
+  return h;
+}
+
+class index_writer {
+  const std::string m_path;
+  std::ofstream     m_os;
+  uint64_t          m_offset;
+
+  void pad() {
+    static const char zeros[index_align] = { 0 };
+    const uint64_t    r                  = m_offset % index_align;
+    if(r) {
+      m_os.write(zeros, index_align - r);
+      m_offset += index_align - r;
+    }
+  }
+
+public:
+  index_header header;
+
+  explicit index_writer(const std::string& path)
+    : m_path(path)
+    , m_os(path, std::ios::binary)
+    , m_offset(index_align)
+  {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.version = index_version;
+    m_os.seekp(index_align);
+  }
+  void write(index_section_id id, const void* data, uint64_t count, uint64_t bytes) {
+    header.sections[id] = index_section{ m_offset, count, bytes };
+    m_os.write((const char*)data, bytes);
+    m_offset += bytes;
+    pad();
+  }
+  template<typename T, typename C>
+  void write(index_section_id id, const mapped_vector<T, C>& v) {
+    write(id, v.data(), v.size(), v.size() * sizeof(T));
+  }
+  // Write the len characters at s, followed by a '\0'
+  void write_string(index_section_id id, const char* s, uint64_t len) {
+    header.sections[id] = index_section{ m_offset, len + 1, len + 1 };
+    m_os.write(s, len);
+    m_os.put('\0');
+    m_offset += len + 1;
+    pad();
+  }
+  const std::string& path() const { return m_path; }
+  // Reserve a section of count elements in bytes, to be filled
+  // through the writable mapping returned by map_section.
+  void reserve(index_section_id id, uint64_t count, uint64_t bytes) {
+    header.sections[id] = index_section{ m_offset, count, bytes };
+    m_offset += bytes + (index_align - bytes % index_align) % index_align;
+    m_os.seekp(m_offset);
+  }
+  // Writable mapping of a reserved section, padding included. Check
+  // good() on the result.
+  std::shared_ptr<const mapped_file> map_section(index_section_id id) {
+    m_os.flush();
+    const auto& s = header.sections[id];
+    return std::make_shared<const mapped_file>(m_path.c_str(), s.offset,
+                                               s.bytes + (index_align - s.bytes % index_align) % index_align);
+  }
+  // Write the header page and close the file. Return true if all
+  // writes succeeded.
+  bool close() {
+    m_os.seekp(0);
+    m_os.write((const char*)&header, sizeof(header));
+    m_os.close();
+    return m_os.good();
+  }
+};
+
+class index_reader {
+  std::shared_ptr<const mapped_file> m_map;
+  const index_header*                m_header;
+
+public:
+  explicit index_reader(const std::string& path)
+    : m_map(std::make_shared<const mapped_file>(path.c_str()))
+    , m_header(nullptr)
+  {
+    if(!m_map->good() || m_map->size() < index_align) return;
+    const index_header* header = (const index_header*)m_map->base();
+    if(memcmp(header->magic, index_magic, sizeof(index_magic)) || header->version != index_version)
+      return;
+    m_header = header;
+  }
+
+  bool good() const { return m_header != nullptr; }
+  const index_header& header() const { return *m_header; }
+  const std::shared_ptr<const mapped_file>& map() const { return m_map; }
+
+  bool has(index_section_id id) const { return m_header->sections[id].offset != 0; }
+  // Pointer to the section, or nullptr if absent or not in the file
+  // or if its size is not count elements of elt_size bytes.
+  const char* section(index_section_id id, uint64_t elt_size) const {
+    const auto& s = m_header->sections[id];
+    if(s.offset == 0 || s.offset + s.bytes > m_map->size() || s.bytes != s.count * elt_size)
+      return nullptr;
+    return m_map->base() + s.offset;
+  }
+  template<typename T, typename C>
+  bool section(index_section_id id, mapped_vector<T, C>& v) const {
+    const char* ptr = section(id, sizeof(T));
+    if(!ptr) return false;
+    v = mapped_vector<T, C>(m_map, (const T*)ptr, m_header->sections[id].count);
+    return true;
+  }
+
+  // The reference text is followed by a '\0' in the file.
+  const char* text() const {
+    const char* ptr = section(TEXT_SECTION, 1);
+    return ptr && m_header->sections[TEXT_SECTION].count == m_header->text_length + 1 ? ptr : nullptr;
+  }
+  size_t text_length() const { return m_header->text_length; }
+};
+
+} // namespace mummer
+} // namespace mummer
+
+#endif /* __INDEX_FILE_H__ */
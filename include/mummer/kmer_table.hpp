@@ -0,0 +1,91 @@
+#ifndef __KMER_TABLE_H__
+#define __KMER_TABLE_H__
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "mapped_vector.hpp"
+
+namespace mummer {
+namespace mummer {
+
+// Suffix array intervals of the k-mers (k <= 16) occurring in the
+// text. Only the k-mers present are stored, sorted by their 2 bit
+// code, with the bounds of their interval on 48 bits. The directory,
+// indexed by the high bits of a code, gives the range of entries with
+// these high bits. It has about as many slots as there are entries, so
+// a lookup searches a range of about one entry.
+struct kmer_table {
+  static const int max_k = 16;
+
+  struct entry {
+    uint32_t code;
+    uint16_t start_hi, end_hi;
+    uint32_t start_lo, end_lo;
+
+    entry() = default;
+    entry(uint32_t c, uint64_t s, uint64_t e)
+      : code(c), start_hi(s >> 32), end_hi(e >> 32), start_lo(s), end_lo(e)
+    { }
+    uint64_t start() const { return ((uint64_t)start_hi << 32) | start_lo; }
+    uint64_t end() const { return ((uint64_t)end_hi << 32) | end_lo; }
+    bool operator==(const entry& rhs) const {
+      return code == rhs.code && start() == rhs.start() && end() == rhs.end();
+    }
+  };
+
+  mapped_vector<entry>    entries;
+  mapped_vector<uint64_t> directory; // 2^bits + 1 offsets into entries
+  int                     k;
+
+  kmer_table() : k(0) { }
+
+  bool empty() const { return entries.empty(); }
+  size_t size() const { return entries.size(); }
+  int bits() const { return __builtin_ctzll(directory.size() - 1); }
+
+  // Set the entries, sorted by code with no duplicates, and build the
+  // directory.
+  void init(std::vector<entry>&& e, int k_) {
+    k        = k_;
+    int bits = 0;
+    while(bits < 2 * k && ((size_t)1 << bits) < e.size()) ++bits;
+    const int             shift = 2 * k - bits;
+    std::vector<uint64_t> dir(((size_t)1 << bits) + 1);
+    size_t                j     = 0;
+    for(size_t p = 0; p < dir.size(); ++p) {
+      while(j < e.size() && ((uint64_t)e[j].code >> shift) < p) ++j;
+      dir[p] = j;
+    }
+    entries   = std::move(e);
+    directory = std::move(dir);
+  }
+
+  // Hint that the directory entry of code will be read soon, then,
+  // once it is read, the entries it points to.
+  void prefetch(uint64_t code) const {
+    if(!directory.empty()) __builtin_prefetch(directory.data() + (code >> (2 * k - bits())));
+  }
+  void prefetch_entries(uint64_t code) const {
+    if(!directory.empty()) __builtin_prefetch(entries.data() + directory[code >> (2 * k - bits())]);
+  }
+
+  // Find the interval [start, end] of the k-mer with the given
+  // code. Return false if the k-mer does not occur in the text.
+  bool find(uint64_t code, long& start, long& end) const {
+    if(directory.empty()) return false;
+    const uint64_t hi = code >> (2 * k - bits());
+    const auto     b  = entries.begin() + directory[hi];
+    const auto     e  = entries.begin() + directory[hi + 1];
+    const auto     it = std::lower_bound(b, e, code, [](const entry& x, uint64_t c) { return x.code < c; });
+    if(it == e || it->code != code) return false;
+    start = it->start();
+    end   = it->end();
+    return true;
+  }
+};
+
+} // namespace mummer
+} // namespace mummer
+
+#endif /* __KMER_TABLE_H__ */
@@ -0,0 +1,185 @@
+#ifndef __MAPPED_VECTOR_H__
+#define __MAPPED_VECTOR_H__
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mummer {
+
+// A whole file mapped read-only in memory, or a writable region of a
+// file. base() is nullptr if the file could not be opened or mapped.
+class mapped_file {
+  void*  m_base;
+  size_t m_size;
+
+public:
+  explicit mapped_file(const char* path)
+    : m_base(nullptr)
+    , m_size(0)
+  {
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1) return;
+    struct stat st;
+    if(fstat(fd, &st) != -1 && st.st_size > 0) {
+      void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(ptr != MAP_FAILED) {
+        m_base = ptr;
+        m_size = st.st_size;
+      }
+    }
+    close(fd);
+  }
+  // Writable mapping of size bytes at offset, a multiple of the page
+  // size, in the file at path. The file is extended if needed. The
+  // content is written to the file through the mapping, and the
+  // memory may be modified through base().
+  mapped_file(const char* path, size_t offset, size_t size)
+    : m_base(nullptr)
+    , m_size(0)
+  {
+    const int fd = open(path, O_RDWR);
+    if(fd == -1) return;
+    struct stat st;
+    if(size > 0 && fstat(fd, &st) != -1 &&
+       ((size_t)st.st_size >= offset + size || ftruncate(fd, offset + size) != -1)) {
+      void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+      if(ptr != MAP_FAILED) {
+        m_base = ptr;
+        m_size = size;
+      }
+    }
+    close(fd);
+  }
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+  ~mapped_file() {
+    if(m_base)
+      munmap(m_base, m_size);
+  }
+
+  bool good() const { return m_base != nullptr; }
+  const char* base() const { return (const char*)m_base; }
+  size_t size() const { return m_size; }
+
+  // Drop the pages of [offset, offset + len) from the memory of the
+  // process. The content stays in the file and is read back if
+  // accessed again.
+  void evict(size_t offset = 0, size_t len = (size_t)-1) const {
+    if(!m_base || offset >= m_size) return;
+    const size_t page  = sysconf(_SC_PAGESIZE);
+    const size_t start = offset - offset % page;
+    const size_t end   = std::min(m_size - offset, len) + offset;
+    madvise((char*)m_base + start, end - start, MADV_DONTNEED);
+  }
+};
+
+// Vector of POD elements, which either owns its elements (in a
+// Container, std::vector or std::string) or is a view into a mapped
+// file. The mapping is kept alive as long as a view on it exists.
+// Modifying the size of a view first copies the elements in memory.
+// Writing elements through operator[] or data() is only valid on an
+// owned vector or a view on a writable mapping.
+template<typename T, typename Container = std::vector<T>>
+class mapped_vector {
+  Container                          m_vec;
+  T*                                 m_ptr;
+  size_t                             m_size;
+  std::shared_ptr<const mapped_file> m_map;
+
+  void sync() {
+    m_ptr  = m_vec.data();
+    m_size = m_vec.size();
+  }
+  void own() {
+    if(m_map) {
+      m_vec.assign(m_ptr, m_ptr + m_size);
+      m_map.reset();
+    }
+  }
+
+public:
+  typedef T        value_type;
+  typedef T*       iterator;
+  typedef const T* const_iterator;
+
+  mapped_vector() : m_ptr(nullptr), m_size(0) { }
+  explicit mapped_vector(size_t n, const T& v = T()) : m_vec(n, v) { sync(); }
+  mapped_vector(Container&& v) : m_vec(std::move(v)) { sync(); }
+  // View on size elements at ptr, in the memory of map.
+  mapped_vector(std::shared_ptr<const mapped_file> map, const T* ptr, size_t size)
+    : m_ptr(const_cast<T*>(ptr))
+    , m_size(size)
+    , m_map(std::move(map))
+  { }
+  mapped_vector(const mapped_vector& rhs)
+    : m_vec(rhs.m_vec)
+    , m_ptr(rhs.m_ptr)
+    , m_size(rhs.m_size)
+    , m_map(rhs.m_map)
+  {
+    if(!m_map) sync();
+  }
+  mapped_vector(mapped_vector&& rhs)
+    : m_vec(std::move(rhs.m_vec))
+    , m_ptr(rhs.m_ptr)
+    , m_size(rhs.m_size)
+    , m_map(std::move(rhs.m_map))
+  {
+    if(!m_map) sync();
+    rhs.m_vec.clear();
+    rhs.sync();
+  }
+  mapped_vector& operator=(mapped_vector rhs) {
+    swap(rhs);
+    return *this;
+  }
+  void swap(mapped_vector& rhs) {
+    std::swap(m_vec, rhs.m_vec);
+    std::swap(m_ptr, rhs.m_ptr);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_map, rhs.m_map);
+    // The elements of a short std::string are stored in the object
+    if(!m_map) sync();
+    if(!rhs.m_map) rhs.sync();
+  }
+
+  bool is_mapped() const { return (bool)m_map; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  size_t capacity() const { return m_map ? m_size : m_vec.capacity(); }
+
+  const T& operator[](size_t i) const { return m_ptr[i]; }
+  T& operator[](size_t i) { return m_ptr[i]; }
+  const T* data() const { return m_ptr; }
+  T* data() { return m_ptr; }
+  const_iterator begin() const { return m_ptr; }
+  const_iterator end() const { return m_ptr + m_size; }
+  const_iterator cbegin() const { return m_ptr; }
+  const_iterator cend() const { return m_ptr + m_size; }
+  iterator begin() { return m_ptr; }
+  iterator end() { return m_ptr + m_size; }
+  const T& back() const { return m_ptr[m_size - 1]; }
+
+  void resize(size_t n) { own(); m_vec.resize(n); sync(); }
+  void resize(size_t n, const T& v) { own(); m_vec.resize(n, v); sync(); }
+  void push_back(const T& v) { own(); m_vec.push_back(v); sync(); }
+  void shrink_to_fit() { own(); m_vec.shrink_to_fit(); sync(); }
+  void clear() {
+    m_map.reset();
+    m_vec.clear();
+    m_vec.shrink_to_fit();
+    sync();
+  }
+};
+
+} // namespace mummer
+
+#endif /* __MAPPED_VECTOR_H__ */
@@ -3,37 +3,87 @@
 
 #include <iostream>
 #include <cassert>
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <atomic>
+#include <type_traits>
 #include <mummer/dset.hpp>
-#include <mummer/openmp_qsort.hpp>
+#include <mummer/parallel_sort.hpp>
 
 namespace mummer {
 namespace mgaps {
-// Represent a match
+// Represent a match of an output cluster
 struct  Match_t {
   long int     Start1, Start2, Len; // Start1 and Start2 are 1-based.
   long int     Simple_Score;
   long int     Simple_From;
   long int     Simple_Adj;
-  unsigned int cluster_id:30;
-  unsigned int Good:1;
-  unsigned int Tentative:1;
   Match_t() = default;
-  Match_t(long int S1, long int S2, long int L) : Start1(S1), Start2(S2), Len(L), Good(true), Tentative(false) { }
+  Match_t(long int S1, long int S2, long int L) : Start1(S1), Start2(S2), Len(L) { }
+};
+
+// Match given to the clustering, as found by the matching: only the
+// coordinates, packed in 16 bytes. Start1 and Start2 are 1-based. The
+// coordinates in the query must fit in an int.
+struct Anchor_t {
+  long int Start1;
+  int      Start2, Len;
+  Anchor_t() = default;
+  Anchor_t(long int S1, long int S2, long int L) : Start1(S1), Start2(S2), Len(L) { }
 };
 
 
 // Union find data structures. Indices MUST be in the range [1, s],
 // where s is the size given to reset (no checks).
-struct UnionFind {
-  std::vector<int> m_UF;
+template<typename Index>
+struct UnionFind_t {
+  std::vector<Index> m_UF;
 
-  void reset(size_t s);         // Reset to given size
-  int  find(int a);             //  Return the id of the set containing  a  in  UF .
-  void union_sets(int a, int b); //  Union the sets whose id's are  a  and  b  in  UF .
+  void  reset(size_t s);             // Reset to given size
+  Index find(Index a);               //  Return the id of the set containing  a  in  UF .
+  void  union_sets(Index a, Index b); //  Union the sets whose id's are  a  and  b  in  UF .
 };
+typedef UnionFind_t<int> UnionFind;
 typedef std::vector<Match_t>      cluster_type;
 typedef std::vector<cluster_type> clusters_type;
 
+// Scratch space of the clustering, reused from one call to the
+// next. The working fields of the matches are kept in separate arrays,
+// indexed like the matches, so the matches themselves stay small.
+//
+// Index is the type of the indices and counts of matches: int in
+// general, for cache density, and long for more than 2^31 matches.
+template<typename Index>
+struct ClusterScratch_t {
+  typedef Index index_type;
+
+  UnionFind_t<Index>    UF;
+  std::vector<char>     Good, Tentative;
+  std::vector<Index>    cluster_id;
+  std::vector<Index>    cluster_end; // End of each cluster in clustered
+  std::vector<Anchor_t> clustered;   // Matches grouped by cluster
+  std::vector<std::pair<long int, Index>> Diagonal_Buckets; // (bucket, index) of the matches, sorted
+  std::vector<long int> Simple_Score, Simple_Adj;
+  std::vector<Index>    Simple_From;
+  std::vector<char>     Dirty;    // Score to (re)compute by Chain_Scores
+  std::vector<Index>    Renumber; // Index of a match after compaction
+
+  // Chaining. A candidate is the best predecessor found for a match:
+  // its score minus the penalty, and its index.
+  struct Candidate {
+    long int value;
+    Index    from;
+  };
+  std::vector<Candidate> Chain_Best;
+  std::vector<Index>     Dirty_Before; // Number of dirty matches before an index
+  std::vector<Index>     Chain_Order;
+  std::vector<long int>  Chain_Keys;
+  std::vector<Candidate> Chain_Below, Chain_Above; // Fenwick trees
+};
+typedef ClusterScratch_t<int> ClusterScratch;
+
 struct ClusterMatches {
   const int      Fixed_Separation;
   const long int Max_Separation;
@@ -49,16 +99,26 @@ struct ClusterMatches {
     , Use_Extents(ue)
   { }
 
-  template<typename Output>
-  int Cluster_each(Match_t * A, UnionFind& UF, int N, Output out) const;
+  template<typename Index, typename Output>
+  Index Cluster_each(Anchor_t * A, ClusterScratch_t<Index>& S, typename ClusterScratch_t<Index>::index_type N,
+                     Output out) const;
 
-  // Like Cluster_each, but adapted for long query with many matches.
+  // Like Cluster_each, but adapted for long query with many matches:
+  // the sort, the union, the find and the chaining of the clusters run
+  // on the threads of pool, if not null. The clusters are output in
+  // the order of their first match, whatever the number of threads.
+  // The matches are indexed with ints when there are fewer than 2^31
+  // of them, with longs otherwise.
   template<typename Output>
-  int Cluster_each_long(Match_t * A, int N, Output out) const;
+  long Cluster_each_long(Anchor_t * A, size_t N, Output out, thread_pool* pool = nullptr) const {
+    if(N < (size_t)INT_MAX - 2)
+      return Cluster_each_long_<int>(A, N, out, pool);
+    return Cluster_each_long_<long>(A, N, out, pool);
+  }
 
   //  Process matches  A [1 .. N]  and append them to clusters
-  int  Process_Matches(Match_t * A, UnionFind& UF, int N, clusters_type& clusters) const {
-    return Cluster_each(A, UF, N, [&](cluster_type&& cl) { clusters.push_back(std::move(cl)); });
+  int  Process_Matches(Anchor_t * A, ClusterScratch& S, int N, clusters_type& clusters) const {
+    return Cluster_each(A, S, N, [&](cluster_type&& cl) { clusters.push_back(std::move(cl)); });
   }
 
   static void Print_Cluster(const cluster_type& cluster, const char* label, std::ostream& os = std::cout);
@@ -66,169 +126,278 @@ struct ClusterMatches {
 
 
 protected:
-  template<typename Output>
-  int  Process_Cluster(Match_t * A, int N, Output out) const;
+  template<typename Index, typename Output>
+  long Cluster_each_long_(Anchor_t * A, Index N, Output out, thread_pool* pool) const;
+
+  //  Union the matches  A [1 .. N] , sorted by  Start2 , that are
+  //  close enough and on similar diagonals.
+  template<typename Index, typename UnionFindType>
+  void Union_Matches(const Anchor_t * A, typename ClusterScratch_t<Index>::index_type N, UnionFindType& UF,
+                     ClusterScratch_t<Index>& S) const;
+
+  //  The 2 steps of Union_Matches: group the matches by diagonal in
+  //  S , then union the matches  A [i]  for  i  in [begin, end)  with
+  //  the following ones.  Union_Range  may run concurrently on
+  //  disjoint ranges if  UF  supports concurrent unions.
+  template<typename Index>
+  void Bucket_Matches(const Anchor_t * A, Index N, ClusterScratch_t<Index>& S) const;
+  template<typename Index, typename UnionFindType>
+  void Union_Range(const Anchor_t * A, Index begin, Index end, UnionFindType& UF, const ClusterScratch_t<Index>& S) const;
+
+  //  Bucket of diagonal  d : two matches may be unioned only if their
+  //  diagonals are in the same or in neighbouring buckets.
+  long int Diagonal_Bucket(long int d) const {
+    const long int width = std::max((long int)Fixed_Separation, (long int)(int)(Separation_Factor * Max_Separation)) + 1;
+    return d >= 0 ? d / width : -((width - 1 - d) / width);
+  }
+
+  //  Group the matches  A [1 .. N]  by cluster, the cluster of  A [i]
+  //  being  find(i) , and process each cluster.
+  template<typename Index, typename Find, typename Output>
+  Index Process_Clusters(const Anchor_t * A, Index N, Find find, ClusterScratch_t<Index>& S, Output out) const;
+
+  //  Group the matches  A [1 .. N]  by cluster in  S.clustered , in
+  //  increasing cluster id  find(i) , in [1, N].  Cluster  c  is then
+  //  [ S.cluster_end [c - 1],  S.cluster_end [c] ).
+  template<typename Index, typename Find>
+  static void Group_Clusters(const Anchor_t * A, Index N, Find find, ClusterScratch_t<Index>& S);
+
+  template<typename Index, typename Output>
+  Index Process_Cluster(Anchor_t * A, typename ClusterScratch_t<Index>::index_type N, ClusterScratch_t<Index>& S,
+                        Output out) const;
+
+  //  Compute the  Simple_Score ,  Simple_From  and  Simple_Adj  in  S
+  //  of the matches  A [0 .. (N - 1)]  marked dirty, the other
+  //  matches having theirs already.  The score of a match is its length
+  //  plus the best score of a previous match minus the overlap and
+  //  diagonal difference penalty, if positive.  Large clusters are
+  //  chained in O(N log^2 N) with range max queries rather than by
+  //  trying all the pairs.
+  template<typename Index>
+  static void Chain_Scores(const Anchor_t * A, Index N, ClusterScratch_t<Index>& S);
 
   //  Remove from  A [0 .. (N - 1)]  any matches that are internal to a repeat,
-  static int Filter_Matches(Match_t* A, const int N);
+  template<typename Index>
+  static Index Filter_Matches(Anchor_t* A, const Index N, ClusterScratch_t<Index>& S);
 
   // Matches ordering
-  static inline bool By_Start2(const Match_t& A, const Match_t& B) {
+  static inline bool By_Start2(const Anchor_t& A, const Anchor_t& B) {
     return (A.Start2 < B.Start2) || (A.Start2 == B.Start2 && A.Start1 < B.Start1);
   }
-
-  static bool By_Cluster(const Match_t& A, const Match_t& B) {
-    return (A.cluster_id < B.cluster_id) ||
-      (A.cluster_id == B.cluster_id && By_Start2(A, B));
-  }
 };
 
 //
 // Implementation of templated methods
 //
 
-template<typename Output>
-int ClusterMatches::Cluster_each(Match_t * A, UnionFind& UF, int N, Output out) const {
+template<typename Index, typename Output>
+Index ClusterMatches::Cluster_each(Anchor_t * A, ClusterScratch_t<Index>& S, typename ClusterScratch_t<Index>::index_type N,
+                                   Output out) const {
   //  Process matches  A [1 .. N]  and output them after
   //  a line containing  label .
 
   //  Use Union-Find to create connected-components based on
   //  separation and similar diagonals between matches
-  UF.reset(N);
+  S.UF.reset(N);
 
   std::sort(A + 1, A + N + 1, By_Start2);
-  N = Filter_Matches (A + 1, N);
+  N = Filter_Matches (A + 1, N, S);
+  Union_Matches(A, N, S.UF, S);
 
-  for  (int i = 1;  i < N;  i ++) {
-    long int i_end  = A [i] . Start2 + A [i] . Len;
-    long int i_diag = A [i] . Start2 - A [i] . Start1;
-
-    for  (int j = i + 1;  j <= N;  j ++) {
-      long int sep = A [j] . Start2 - i_end;
-      if  (sep > Max_Separation)
-        break;
-
-      long int diag_diff = std::abs ((A [j] . Start2 - A [j] . Start1) - i_diag);
-      if  (diag_diff <= std::max(Fixed_Separation, (int)(Separation_Factor * sep)))
-        UF.union_sets(UF.find(i), UF.find(j));
-    }
-  }
-
-  //  Set the cluster id of each match and reset Good flag
-  for  (int i = 1;  i <= N;  i ++) {
-    A [i] . cluster_id = UF.find (i);
-    assert(A[i].cluster_id > 0);
-    A[i].Good = false;
-  }
-  std::sort(A + 1, A + N + 1, By_Cluster);
-
-  // Determine and process clusters
-  int cluster_size, print_ct = 0;
-  for (int i = 1;  i <= N;  i += cluster_size) {
-    int j;
-    for  (j = i + 1;  j <= N && A [i] . cluster_id == A [j] . cluster_id;  j ++)
-      ;
-    cluster_size = j - i;
-    print_ct += Process_Cluster (A + i, cluster_size, out);
-  }
-  return print_ct;
+  return Process_Clusters(A, N, [&](Index i) { return S.UF.find(i); }, S, out);
 }
 
-template<typename Output>
-int ClusterMatches::Cluster_each_long(Match_t * A, int N, Output out) const {
+template<typename Index, typename Output>
+long ClusterMatches::Cluster_each_long_(Anchor_t * A, Index N, Output out, thread_pool* pool) const {
   //  Process matches  A [1 .. N]  and output them after
   //  a line containing  label .
+  auto run = [pool](std::function<void(unsigned int)> f) { if(pool) pool->run(f); else f(0); };
+  auto parallel_for = [pool](long begin, long end, std::function<void(long, long, unsigned int)> f) {
+    if(pool) pool->parallel_for(begin, end, f); else if(begin < end) f(begin, end, 0);
+  };
+  const unsigned int nb_threads = pool ? pool->size() : 1;
 
   //  Use Union-Find to create connected-components based on
   //  separation and similar diagonals between matches
-  DisjointSets UF(N + 1);
-
-  openmp_qsort(A + 1, A + N + 1, By_Start2);
-  N = Filter_Matches (A + 1, N);
+  basic_disjoint_sets<typename std::make_unsigned<Index>::type> UF(N + 1);
+  ClusterScratch_t<Index>                                        S;
+
+  if  (pool)
+    sample_sort(A + 1, A + N + 1, By_Start2, *pool);
+  else
+    std::sort(A + 1, A + N + 1, By_Start2);
+  N = Filter_Matches (A + 1, N, S);
+  Bucket_Matches(A, N, S);
+  parallel_for(1, N + 1, [&](long b, long e, unsigned int id) { Union_Range(A, (Index)b, (Index)e, UF, S); });
+
+  //  The ids of the union-find depend on the order of the unions.
+  //  Number the clusters in the order of their first match instead.
+  S.cluster_id.resize(N + 1);
+  parallel_for(1, N + 1, [&](long b, long e, unsigned int id) {
+      for  (long i = b;  i < e;  i ++)
+        S.cluster_id[i] = UF.find(i);
+    });
+  S.Renumber.assign(N + 1, 0);
+  Index nb_clusters = 0;
+  for  (Index i = 1;  i <= N;  i ++) {
+    Index& c = S.Renumber[S.cluster_id[i]];
+    if  (c == 0) c = ++nb_clusters;
+    S.cluster_id[i] = c;
+  }
+  Group_Clusters(A, N, [&](Index i) { return S.cluster_id[i]; }, S);
+
+  //  Chain the clusters in parallel, by batches, and output the
+  //  clusters of a batch in order.
+  std::vector<ClusterScratch_t<Index>> scratches(nb_threads);
+  std::vector<clusters_type>           outputs;
+  const Index                          batch    = 64 * nb_threads;
+  long                                 print_ct = 0;
+  for  (Index first = 1;  first <= nb_clusters;  first += batch) {
+    const Index        last = std::min(nb_clusters + 1, first + batch);
+    std::atomic<Index> next(first);
+    std::atomic<long>  count(0);
+    outputs.assign(last - first, clusters_type());
+    run([&](unsigned int id) {
+        for  (Index c = next++;  c < last;  c = next++) {
+          const Index start = S.cluster_end[c - 1];
+          count += Process_Cluster(S.clustered.data() + start, S.cluster_end[c] - start, scratches[id],
+                                   [&](cluster_type&& cl) { outputs[c - first].push_back(std::move(cl)); });
+        }
+      });
+    for  (auto& clusters : outputs)
+      for  (auto& cl : clusters)
+        out(std::move(cl));
+    print_ct += count;
+  }
+  return print_ct;
+}
 
-//#pragma omp parallel for schedule(dynamic)
-  for  (int i = 1;  i < N;  i ++) {
-    long int i_end  = A [i] . Start2 + A [i] . Len;
-    long int i_diag = A [i] . Start2 - A [i] . Start1;
+template<typename Index, typename UnionFindType>
+void ClusterMatches::Union_Matches(const Anchor_t * A, typename ClusterScratch_t<Index>::index_type N, UnionFindType& UF,
+                                   ClusterScratch_t<Index>& S) const {
+  Bucket_Matches(A, N, S);
+  Union_Range(A, (Index)1, N, UF, S);
+}
 
-    for  (int j = i + 1;  j <= N;  j ++) {
-      long int sep = A [j] . Start2 - i_end;
-      if  (sep > Max_Separation)
+template<typename Index, typename UnionFindType>
+void ClusterMatches::Union_Range(const Anchor_t * A, Index begin, Index end, UnionFindType& UF, const ClusterScratch_t<Index>& S) const {
+  //  Two matches are unioned only if their diagonals differ by less
+  //  than the bucket width, so the matches after  A [i]  to test are in
+  //  the bucket of  i  or in one of its 2 neighbours.  These 3 buckets
+  //  are merged in increasing index, so the unions are done in the
+  //  same order as by testing all the following matches, and the
+  //  union-find ends in the same state.
+  const auto&  buckets = S.Diagonal_Buckets;
+  const size_t M       = buckets.size();
+
+  for  (Index i = begin;  i < end;  i ++) {
+    const long int i_end  = A [i] . Start2 + A [i] . Len;
+    const long int i_diag = A [i] . Start2 - A [i] . Start1;
+    const long int b      = Diagonal_Bucket(i_diag);
+
+    //  Next match to test in each of the 3 buckets
+    const long int bk [3] = { b, b - 1, b + 1 };
+    size_t         pos [3];
+    for  (int k = 0;  k < 3;  k ++)
+      pos [k] = std::lower_bound(buckets.cbegin(), buckets.cend(), std::make_pair(bk [k], (Index)(i + 1))) - buckets.cbegin();
+    while(true) {
+      Index next = -1;
+      int   from = -1;
+      for  (int k = 0;  k < 3;  k ++) {
+        if  (pos [k] >= M || buckets [pos [k]] . first != bk [k]) continue;
+        const Index j = buckets [pos [k]] . second;
+        if  (A [j] . Start2 - i_end > Max_Separation) {
+          pos [k] = M; // Sorted by  Start2 : no more match in range
+          continue;
+        }
+        if  (next < 0 || j < next) {
+          next = j;
+          from = k;
+        }
+      }
+      if  (next < 0)
         break;
+      ++pos [from];
 
-      long int diag_diff = std::abs ((A [j] . Start2 - A [j] . Start1) - i_diag);
+      const Index    j         = next;
+      const long int sep       = A [j] . Start2 - i_end;
+      const long int diag_diff = std::abs ((A [j] . Start2 - A [j] . Start1) - i_diag);
       if  (diag_diff <= std::max(Fixed_Separation, (int)(Separation_Factor * sep)))
         UF.union_sets(UF.find(i), UF.find(j));
     }
   }
+}
 
-  //  Set the cluster id of each match and reset Good flag
-//#pragma omp parallel for
-  for  (int i = 1;  i <= N;  i ++) {
-    A [i] . cluster_id = UF.find (i);
-    assert(A[i].cluster_id > 0);
-    A[i].Good = false;
-  }
-  openmp_qsort(A + 1, A + N + 1, By_Cluster);
-
-  // Determine and process clusters
-  int cluster_size, print_ct = 0;
-//#pragma omp parallel
-  {
-//#pragma omp single
-    for (int i = 1;  i <= N;  i += cluster_size) {
-      int j;
-      for  (j = i + 1;  j <= N && A [i] . cluster_id == A [j] . cluster_id;  j ++)
-        ;
-      cluster_size = j - i;
-//#pragma omp task firstprivate(i, cluster_size) shared(out)
-      print_ct += Process_Cluster (A + i, cluster_size, out);
-    }
+template<typename Index, typename Find, typename Output>
+Index ClusterMatches::Process_Clusters(const Anchor_t * A, Index N, Find find, ClusterScratch_t<Index>& S, Output out) const {
+  Group_Clusters(A, N, find, S);
+  Index print_ct = 0;
+  for  (Index c = 1, start = 0;  c <= N;  c ++) {
+    const Index end = S.cluster_end[c];
+    if  (end > start)
+      print_ct += Process_Cluster (S.clustered.data() + start, end - start, S, out);
+    start = end;
   }
-
   return print_ct;
 }
 
-template<typename Output>
-int ClusterMatches::Process_Cluster(Match_t * A, int N, Output out) const {
+template<typename Index, typename Find>
+void ClusterMatches::Group_Clusters(const Anchor_t * A, Index N, Find find, ClusterScratch_t<Index>& S) {
+  //  Counting sort by cluster id: the matches within a cluster stay
+  //  sorted by  Start2 .
+  S.cluster_id.resize(N + 1);
+  S.cluster_end.assign(N + 2, 0);
+  for  (Index i = 1;  i <= N;  i ++) {
+    S.cluster_id[i] = find(i);
+    assert(S.cluster_id[i] > 0 && S.cluster_id[i] <= N);
+    ++S.cluster_end[S.cluster_id[i] + 1];
+  }
+  for  (Index c = 1;  c <= N + 1;  c ++)
+    S.cluster_end[c] += S.cluster_end[c - 1];
+  S.clustered.resize(N);
+  for  (Index i = 1;  i <= N;  i ++)
+    S.clustered[S.cluster_end[S.cluster_id[i]]++] = A[i];
+}
+
+template<typename Index, typename Output>
+Index ClusterMatches::Process_Cluster(Anchor_t * A, typename ClusterScratch_t<Index>::index_type N, ClusterScratch_t<Index>& S,
+                                      Output out) const {
 //  Process the cluster of matches in  A [0 .. (N - 1)]  and output them
 //  after a line containing  label .  Return the number of clusters
 //  printed.
-  int  count = 0;
-
+  if  (S.Good.size() < (size_t)N)
+    S.Good.resize(N);
+  if  (S.Simple_Score.size() < (size_t)N) {
+    S.Simple_Score.resize(N);
+    S.Simple_Adj.resize(N);
+    S.Simple_From.resize(N);
+    S.Dirty.resize(N);
+    S.Renumber.resize(N);
+  }
+  Index     count        = 0;
+  char*     Good         = S.Good.data();
+  char*     Dirty        = S.Dirty.data();
+  Index*    Renumber     = S.Renumber.data();
+  long int* Simple_Score = S.Simple_Score.data();
+  long int* Simple_Adj   = S.Simple_Adj.data();
+  Index*    Simple_From  = S.Simple_From.data();
+
+  std::fill(Dirty, Dirty + N, true);
   while(N > 0) {
     std::vector<Match_t> cluster; // Potential cluster
 
-    for  (int i = 0;  i < N;  i ++) {
-      A [i] . Simple_Score = A [i] . Len;
-      A [i] . Simple_Adj = 0;
-      A [i] . Simple_From = -1;
-      for  (int j = 0;  j < i;  j ++) {
-        const long int Olap1 = A [j] . Start1 + A [j] . Len - A [i] . Start1;
-        const long int Olap2 = A [j] . Start2 + A [j] . Len - A [i] . Start2;
-        const long int Olap = std::max(std::max((long)0, Olap1), Olap2);
-
-          // penalize off diagonal matches
-        const long int Pen = Olap + std::abs ( (A [i] . Start2 - A [i] . Start1) -
-                                               (A [j] . Start2 - A [j] . Start1) );
-
-        if  (A [j] . Simple_Score + A [i] . Len - Pen > A [i] . Simple_Score) {
-          A [i] . Simple_From = j;
-          A [i] . Simple_Score = A [j] . Simple_Score + A [i] . Len - Pen;
-          A [i] . Simple_Adj = Olap;
-        }
-      }
-    }
+    Chain_Scores(A, N, S);
+    std::fill(Good, Good + N, false);
 
-    int best = 0;
-    for  (int i = 1;  i < N;  i ++)
-      if  (A [i] . Simple_Score > A [best] . Simple_Score)
+    Index best = 0;
+    for  (Index i = 1;  i < N;  i ++)
+      if  (Simple_Score [i] > Simple_Score [best])
         best = i;
     long int total = 0;
     long int hi    = LONG_MIN;
     long int lo    = LONG_MAX;
-    for  (int i = best;  i >= 0;  i = A [i] . Simple_From) {
-      A [i] . Good = true;
+    for  (Index i = best;  i >= 0;  i = Simple_From [i]) {
+      Good [i] = true;
       total += A [i] . Len;
       hi = std::max(hi, A[i].Start1 + A[i].Len);
       lo = std::min(lo, A[i].Start1);
@@ -237,15 +406,36 @@ int ClusterMatches::Process_Cluster(Match_t * A, int N, Output out) const {
 
     if  (score >= Min_Output_Score) {
       count ++;
-      for  (int i = 0;  i < N;  i ++)
-        if  (A [i] . Good)
-          cluster.push_back(A[i]);
+      for  (Index i = 0;  i < N;  i ++) {
+        if  (! Good [i]) continue;
+        cluster.push_back(Match_t(A[i].Start1, A[i].Start2, A[i].Len));
+        cluster.back().Simple_Score = Simple_Score[i];
+        cluster.back().Simple_From  = Simple_From[i];
+        cluster.back().Simple_Adj   = Simple_Adj[i];
+      }
       out(std::move(cluster));
     }
 
-    // Compact match array
-    const auto new_end = std::remove_if(A, A + N, [](const Match_t& m) { return m.Good; });
-    N = new_end - A;
+    //  Compact match array.  Removing the chain only lowers the scores
+    //  of the matches whose own chain goes through it: the other
+    //  matches keep their score and predecessor, and only the former
+    //  are rescored on the next round.
+    Index n = 0;
+    for  (Index i = 0;  i < N;  i ++) {
+      if  (Good [i]) {
+        Renumber [i] = -1;
+        continue;
+      }
+      const Index from = Simple_From [i];
+      Renumber [i]     = n;
+      A [n]            = A [i];
+      Simple_Score [n] = Simple_Score [i];
+      Simple_Adj [n]   = Simple_Adj [i];
+      Simple_From [n]  = from < 0 ? -1 : Renumber [from];
+      Dirty [n]        = from >= 0 && (Renumber [from] < 0 || Dirty [Renumber [from]]);
+      ++n;
+    }
+    N = n;
   }
 
   return count;
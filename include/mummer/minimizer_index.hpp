@@ -0,0 +1,114 @@
+#ifndef __MINIMIZER_INDEX_H__
+#define __MINIMIZER_INDEX_H__
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+namespace mummer {
+
+// Set of the (w, k)-minimizers of a reference, to screen queries
+// before matching them: a query whose minimizers are not in the set
+// has no exact match of length w + k - 1 or more with the reference.
+//
+// The minimizer of a window of w consecutive k-mers is the k-mer with
+// the smallest hash, the k-mers being canonical (smallest of the
+// k-mer and its reverse complement). An exact match of at least w + k
+// - 1 bases, on either strand, contains a window with the same
+// minimizer in the reference and in the query. The k-mers containing
+// a character other than acgt are skipped, so a window never spans
+// such a character. Only 32 bits of the hash are kept: a collision
+// lets a query through, it never drops a match.
+class minimizer_index {
+  int                   m_k, m_w;
+  std::vector<uint32_t> m_hashes; // Sorted, unique
+
+public:
+  static const int max_k = 31;
+
+  minimizer_index() : m_k(0), m_w(0) { }
+  // Index the minimizers of S[0, len). k must be at most max_k.
+  minimizer_index(const char* S, size_t len, int k, int w)
+    : m_k(k)
+    , m_w(w)
+  {
+    each(S, len, k, w, [&](uint32_t h) { m_hashes.push_back(h); });
+    std::sort(m_hashes.begin(), m_hashes.end());
+    m_hashes.erase(std::unique(m_hashes.begin(), m_hashes.end()), m_hashes.end());
+    m_hashes.shrink_to_fit();
+  }
+
+  bool empty() const { return m_k == 0; }
+  int k() const { return m_k; }
+  int w() const { return m_w; }
+  size_t size() const { return m_hashes.size(); }
+
+  // Number of minimizers of P[0, len) in the reference, up to max.
+  size_t hits(const char* P, size_t len, size_t max) const {
+    size_t res = 0;
+    each(P, len, m_k, m_w, [&](uint32_t h) {
+        if(res < max && std::binary_search(m_hashes.cbegin(), m_hashes.cend(), h))
+          ++res;
+      });
+    return res;
+  }
+
+  // Call f(h) on the hash of the minimizer of every window of w
+  // k-mers of S[0, len). Consecutive windows with the same minimizer
+  // give one call.
+  template<typename F>
+  static void each(const char* S, size_t len, int k, int w, F f) {
+    const uint64_t mask  = k < 32 ? ((uint64_t)1 << (2 * k)) - 1 : ~(uint64_t)0;
+    const int      shift = 2 * (k - 1);
+    uint64_t       fwd = 0, rev = 0;
+    int            valid = 0;                  // Number of valid bases at the end of the k-mer
+    long           nb    = 0;                  // Number of k-mers in the current run of valid bases
+    std::deque<std::pair<long, uint32_t>> win; // Increasing hashes of the candidates
+    long           last  = -1;                 // Index of the last minimizer output
+    for(size_t i = 0; i < len; ++i) {
+      const int c = code(S[i]);
+      if(c < 0) {
+        valid = 0;
+        nb    = 0;
+        win.clear();
+        last  = -1;
+        continue;
+      }
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((uint64_t)(3 - c) << shift);
+      if(valid < k && ++valid < k) continue;
+      const uint32_t h = hash(std::min(fwd, rev));
+      while(!win.empty() && win.back().second >= h)
+        win.pop_back();
+      win.push_back(std::make_pair(nb, h));
+      if(win.front().first <= nb - w)
+        win.pop_front();
+      if(++nb >= w && win.front().first != last) {
+        last = win.front().first;
+        f(win.front().second);
+      }
+    }
+  }
+
+private:
+  static int code(char c) {
+    switch(c) {
+    case 'a': case 'A': return 0;
+    case 'c': case 'C': return 1;
+    case 'g': case 'G': return 2;
+    case 't': case 'T': return 3;
+    default: return -1;
+    }
+  }
+  // Invertible mix of the bits of x, then truncated
+  static uint32_t hash(uint64_t x) {
+    x = (x ^ (x >> 31)) * 0x7fb5d329728ea185ULL;
+    x = (x ^ (x >> 27)) * 0x81dadef4bc2dd44dULL;
+    return x ^ (x >> 33);
+  }
+};
+
+} // namespace mummer
+
+#endif /* __MINIMIZER_INDEX_H__ */
@@ -7,8 +7,12 @@
 #include <limits>
 #include <memory>
 #include <mutex>
+#include <atomic>
 
 #include <mummer/sparseSA.hpp>
+#include <mummer/thread_pool.hpp>
+#include <mummer/minimizer_index.hpp>
+#include <mummer/spaced_seed_index.hpp>
 #include <mummer/mgaps.hh>
 #include <mummer/postnuc.hh>
 #include <jellyfish/stream_manager.hpp>
@@ -39,13 +43,21 @@ inline int get_num_threads() {
 namespace nucmer {
 void reverse_complement(std::string& s);
 
-enum match_type { MUM, MUMREFERENCE, MAXMATCH };
+enum match_type { MUM, MUMREFERENCE, MAXMATCH, SPACED };
 enum ori_type { FORWARD = 1, REVERSE = 2, BOTH = 3 };
 struct Options {
   Options()
     : match(MUMREFERENCE)
     , min_len(20)
     , orientation(BOTH)
+    , nb_threads(1)
+    , sparse_k(1)
+    , lcp_direct(false)
+    , shard_size(0)
+    , both_strands(false)
+    , max_occ(0)
+    , prefilter_hits(0)
+    , seed_pattern(spaced_seed_index::default_pattern())
     , fixed_separation(5)
     , max_separation(90)
     , min_output_score(65)
@@ -80,11 +92,29 @@ struct Options {
   Options& reverse() { orientation = REVERSE; return *this; }
   Options& simplify() { do_shadows = false; return *this; }
   Options& nosimplify() { do_shadows = true; return *this; }
+  Options& threads(unsigned int t) { nb_threads = t; return *this; }
+  Options& sparse(int k) { sparse_k = k; return *this; }
+  Options& direct_lcp() { lcp_direct = true; return *this; }
+  Options& shard(size_t bases) { shard_size = bases; return *this; }
+  Options& both_strand_index() { both_strands = true; return *this; }
+  Options& max_occurrences(long n) { max_occ = n; return *this; }
+  Options& prefilter(size_t hits) { prefilter_hits = hits; return *this; }
+  Options& spaced(const std::string& pattern = spaced_seed_index::default_pattern()) {
+    match = SPACED; seed_pattern = pattern; return *this;
+  }
 
   // Options for mummer
-  match_type match;
-  int        min_len;
-  ori_type   orientation;
+  match_type   match;
+  int          min_len;
+  ori_type     orientation;
+  unsigned int nb_threads; // Threads used to build the index
+  int          sparse_k; // Index every K-th suffix. Only valid with MAXMATCH
+  bool         lcp_direct; // Constant time access to large LCP values
+  size_t       shard_size; // Split the reference index in shards of at most this many bases. 0 for one index
+  bool         both_strands; // Index the reverse complement of the reference too. Only used with MAXMATCH
+  long         max_occ; // Skip the MEMs occurring more than this many times in the reference. 0 for no limit
+  size_t       prefilter_hits; // Skip the queries with fewer minimizers in the reference. 0 for no prefilter
+  std::string  seed_pattern; // Spaced seed of the index. Only used with SPACED
 
   // Options for mgaps
   long   fixed_separation;
@@ -140,7 +170,8 @@ public:
 // Align two sequences given as strings. //
 ///////////////////////////////////////////
 class SequenceAligner {
-  const mummer::sparseSA         sa;
+  const mummer::sparseSA         sa;    // Not constructed for SPACED
+  const spaced_seed_index        seeds; // Only for SPACED
   const mgaps::ClusterMatches    clusterer;
   const postnuc::merge_syntenys  merger;
   const FastaRecordSeq           Ref;
@@ -148,7 +179,11 @@ class SequenceAligner {
 
 public:
   SequenceAligner(const char* reference, size_t reference_len, const Options opts = Options())
-    : sa(mummer::sparseSA::create_auto(reference, reference_len, opts.min_len, true))
+    : sa(opts.match == SPACED
+         ? mummer::sparseSA::auto_params(reference, reference_len, opts.min_len, true, opts.sparse_k)
+         : mummer::sparseSA::create_auto(reference, reference_len, opts.min_len, true, opts.sparse_k, false,
+                                         opts.nb_threads, opts.lcp_direct))
+    , seeds(opts.match == SPACED ? spaced_seed_index(reference, reference_len, opts.seed_pattern) : spaced_seed_index())
     , clusterer(opts.fixed_separation, opts.max_separation,
                 opts.min_output_score, opts.separation_factor,
                 opts.use_extent)
@@ -190,13 +225,14 @@ inline std::vector<postnuc::Alignment> align_sequences(const std::string& refere
 }
 
 
-// Sequence concatenated and headers
+// Sequence concatenated and headers. Either loaded from a fasta file
+// or mapped from a self contained index file.
 class FastaRecordPtr;
 struct sequence_info {
   struct record { size_t seq, header; };
-  std::vector<record> records;
-  std::string         sequence;
-  std::string         headers;
+  mapped_vector<record>            records;
+  mapped_vector<char, std::string> sequence;
+  mapped_vector<char, std::string> headers;
 
   static std::unique_ptr<std::ifstream> open_path(const char* path);
 
@@ -205,11 +241,22 @@ struct sequence_info {
   explicit sequence_info(std::istream& is) : sequence_info(is, std::numeric_limits<size_t>::max()) { }
   sequence_info(std::unique_ptr<std::ifstream>&& is, size_t chunk_size) : sequence_info(*is, chunk_size) { }
   explicit sequence_info(const char* path) : sequence_info(open_path(path), std::numeric_limits<size_t>::max()) { }
+  // Map from an index saved with save. Throws if the index does not
+  // contain the sequence information or if the checksum of the
+  // sequence does not match.
+  explicit sequence_info(const mummer::index_reader& index);
   sequence_info(sequence_info&& rhs) = default;
   sequence_info(const sequence_info& rhs) = delete;
   sequence_info& operator=(const sequence_info& rhs) = delete;
   // Return the FastaRecordPtr corresponding to the sequence containing position pos
   FastaRecordPtr find(size_t pos) const;
+  // Whether the fasta file in data has the same headers, in the same
+  // order. The sequences are not parsed.
+  bool same_headers(std::istream& data) const;
+
+  // Add the headers and records to an index. The sequence itself is
+  // saved by the suffix array.
+  void save(mummer::index_writer& writer) const;
 
   size_t size() const { return records.size() - 1; }
   const char* seq(size_t i) const { return sequence.data() + records[i].seq; }
@@ -231,7 +278,7 @@ public:
   }
   const char* seq() const {
     assert(m_id < m_info.records.size());
-    return m_info.sequence.c_str() + m_info.records[m_id].seq - 1;
+    return m_info.sequence.data() + m_info.records[m_id].seq - 1;
   }
   size_t seq_offset() const {
     assert(m_id < m_info.records.size());
@@ -239,19 +286,110 @@ public:
   }
   const char* Id() const {
     assert(m_id < m_info.records.size());
-    return m_info.headers.c_str() + m_info.records[m_id].header;
+    return m_info.headers.data() + m_info.records[m_id].header;
   }
   bool operator==(const FastaRecordPtr& rhs) const { return m_id == rhs.m_id; }
   bool operator<(const FastaRecordPtr& rhs) const { return m_id < rhs.m_id; }
 };
 
 
+// Suffix arrays of the reference sequences. The index is either a
+// single suffix array on all the sequences, or is split in shards on
+// consecutive sequences, each small enough to use 32 bit offsets. The
+// shards are queried one after the other, or in parallel given a
+// thread pool, and the matches merged. For MUMs and MAMs, a match
+// unique in its shard is dropped if it occurs in another shard.
+//
+// For MEMs on both strands, the index may instead hold the reference
+// followed by its reverse complement (see both_strands). The matches
+// of both strands of a query are then found in one pass on the query.
+//
+// For SPACED anchors, the index is a spaced_seed_index on the whole
+// reference instead, without suffix array.
+class reference_index {
+public:
+  struct shard {
+    size_t           offset; // Position of the shard in the reference sequence
+    mummer::sparseSA sa;
+  };
+  // Largest shard size with 32 bit offsets in the suffix array
+  static const size_t small_shard_size = ((size_t)1 << 31) - 1024;
+
+  // Build the index, in shards if opts.shard_size is not 0. The shards
+  // are built in parallel. With opts.both_strands, MAXMATCH and both
+  // orientations, build a single index on both strands instead. With
+  // SPACED, build the spaced seed index of opts.seed_pattern. The
+  // reference in info must outlive the index.
+  reference_index(const sequence_info& info, const Options& opts);
+  explicit reference_index(mummer::sparseSA&& sa);
+
+  // Number of suffix array shards. 0 for a spaced seed index
+  size_t size() const { return m_shards.size(); }
+  const shard& operator[](size_t i) const { return *m_shards[i]; }
+  // Whether the index holds both strands of the reference
+  bool both_strands() const { return m_length != 0; }
+  // Number of query positions whose MEMs, or seeds, were skipped so
+  // far for occurring more than opts.max_occ times in the reference
+  size_t skipped_seeds() const { return m_skipped; }
+
+  // Find the matches of the query P of the type in opts.match. The
+  // reference coordinates are in the whole reference sequence. Given
+  // a pool, the shards, or windows of P for a single shard, are
+  // matched in parallel. SPACED matches are the anchors of
+  // spaced_seed_index::find_anchors, extended with an X-drop of the
+  // pattern length.
+  template<typename Output>
+  void find_matches(const char* P, size_t Plen, const Options& opts, Output out, thread_pool* pool = nullptr) const;
+  // Find the matches of the n queries P[q] of length Plen[q], calling
+  // out(q, m) for each match m of query q. With a single shard, MUMs
+  // and MAMs are found by the batched search of the suffix array
+  // (see sparseSA::findMAM_batch). The matches are the same as with
+  // find_matches. The pool is passed to find_matches for the other
+  // queries.
+  template<typename Output>
+  void find_matches_batch(const char* const* P, const size_t* Plen, size_t n, const Options& opts, Output out,
+                          thread_pool* pool = nullptr) const;
+  // Find the matches of the query P and of its reverse complement, as
+  // selected by opts.orientation, calling out(m, reverse). The
+  // coordinates of a reverse match are in the reverse complement of
+  // P. On a both strands index, this is one pass on P. Otherwise, it
+  // is find_matches on P and on its reverse complement.
+  template<typename Output>
+  void find_matches_both(const char* P, size_t Plen, const Options& opts, Output out, thread_pool* pool = nullptr) const;
+
+private:
+  std::string                         m_text;   // Reference and its reverse complement, for a both strands index
+  size_t                              m_length; // Length of the reference in m_text. 0 if not a both strands index
+  mutable std::atomic<size_t>         m_skipped;
+  spaced_seed_index                   m_seeds;
+  std::vector<std::unique_ptr<shard>> m_shards;
+
+  // Matches of P on a both strands index, calling out(m, reverse)
+  // with the coordinates of a reverse match in the reverse complement
+  // of P.
+  template<typename Output>
+  void find_matches_strands(const char* P, size_t Plen, const Options& opts, Output out, thread_pool* pool) const;
+
+  // Whether the string P[0, len) occurs in another shard than s
+  bool occurs_elsewhere(const char* P, long len, size_t s) const {
+    for(size_t t = 0; t < m_shards.size(); ++t) {
+      if(t == s) continue;
+      const auto&         sa = m_shards[t]->sa;
+      mummer::interval_t cur(0, sa.N / sa.K - 1, 0);
+      sa.traverse(P, len, 0, cur, len);
+      if(cur.depth >= len) return true;
+    }
+    return false;
+  }
+};
+
 // //////////////////////////////////////////////////////////////////////////////
 // // Align many sequences given as sequence files (in fasta or fastq format). //
 // //////////////////////////////////////////////////////////////////////////////
 class FileAligner {
   const sequence_info           m_reference_info;
-  const mummer::sparseSA        m_sa;
+  const reference_index         m_index;
+  const minimizer_index         m_prefilter;
   const mgaps::ClusterMatches   m_clusterer;
   //  const postnuc::merge_syntenys merger;
   const Options                 m_options;
@@ -259,8 +397,8 @@ class FileAligner {
 public:
   FileAligner(const char* reference_path, Options opts = Options())
     : m_reference_info(reference_path)
-    , m_sa(mummer::sparseSA::create_auto(m_reference_info.sequence.c_str(), m_reference_info.sequence.length(),
-                                         opts.min_len, true))
+    , m_index(m_reference_info, opts)
+    , m_prefilter(prefilter_index(m_reference_info, opts))
     , m_clusterer(opts.fixed_separation, opts.max_separation,
                   opts.min_output_score, opts.separation_factor,
                   opts.use_extent)
@@ -268,8 +406,8 @@ public:
   { }
   FileAligner(std::istream& is, size_t chunk_size, Options opts = Options())
     : m_reference_info(is, chunk_size)
-    , m_sa(mummer::sparseSA::create_auto(m_reference_info.sequence.c_str(), m_reference_info.sequence.length(),
-                                         opts.min_len, true))
+    , m_index(m_reference_info, opts)
+    , m_prefilter(prefilter_index(m_reference_info, opts))
     , m_clusterer(opts.fixed_separation, opts.max_separation,
                   opts.min_output_score, opts.separation_factor,
                   opts.use_extent)
@@ -280,16 +418,57 @@ public:
   { }
   FileAligner(sequence_info&& reference_info, mummer::sparseSA&& sa, Options opts = Options())
     : m_reference_info(std::move(reference_info))
-    , m_sa(std::move(sa))
+    , m_index(std::move(sa))
+    , m_prefilter(prefilter_index(m_reference_info, opts))
     , m_clusterer(opts.fixed_separation, opts.max_separation,
                   opts.min_output_score, opts.separation_factor,
                   opts.use_extent)
     , m_options(opts)
   { }
 
-  const mummer::sparseSA& sa() const { return m_sa; }
+  // Load the reference and suffix array from a self contained index
+  FileAligner(const mummer::index_reader& index, Options opts = Options())
+    : FileAligner(sequence_info(index), mummer::sparseSA(index), opts)
+  { }
+
+  // The suffix array, or the suffix array of the first shard. Not
+  // valid with a spaced seed index
+  const mummer::sparseSA& sa() const { return m_index[0].sa; }
+  const reference_index& index() const { return m_index; }
+  // Save the suffix array and the reference information to a self
+  // contained index in prefix.idx. A sharded or both strands index
+  // can't be saved.
+  bool save(const std::string& prefix) const {
+    if(m_index.size() != 1 || m_index.both_strands()) return false;
+    mummer::index_writer writer(mummer::sparseSA::index_path(prefix));
+    if(!sa().save(writer)) return false;
+    m_reference_info.save(writer);
+    return writer.close();
+  }
+  // Build the suffix array of the reference directly in a self
+  // contained index in prefix.idx, keeping about mem bytes in memory
+  // besides the reference (see sparseSA::construct_external). Load it
+  // with the index_reader constructor.
+  static bool save_external(const sequence_info& reference_info, const std::string& prefix, size_t mem,
+                            const Options& opts = Options());
+  // Minimizers of the reference for the prefilter, empty if
+  // opts.prefilter_hits is 0.
+  static minimizer_index prefilter_index(const sequence_info& reference_info, const Options& opts);
   const sequence_info& reference_info() const { return m_reference_info; }
 
+  // Screen the lowercase query P with the minimizers of the reference
+  // (see minimizer_index), built when opts.prefilter_hits is not 0.
+  // Return false if P has fewer than opts.prefilter_hits minimizers in
+  // the reference: thread_align_file then skips its matching. With
+  // one hit, only queries without any match of length min_len or
+  // more, on either strand, are skipped. The minimizers are k-mers of
+  // prefilter_k bases (min_len if smaller), in windows of min_len
+  // bases.
+  static const int prefilter_k = 15;
+  bool prefilter(const char* P, size_t len) const {
+    return m_prefilter.empty() || m_prefilter.hits(P, len, m_options.prefilter_hits) >= m_options.prefilter_hits;
+  }
+
   // TODO: remove code duplication with thread_align_file
   // Align the sequence query against the references
   // template<typename AlignmentOut>
@@ -305,11 +484,15 @@ public:
   void align_file(const char* query_path, AlignmentOut alignments, unsigned int threads = std::thread::hardware_concurrency()) const;
 
   template<typename Parser, typename AlignmentOut>
-  static void trampoline_align_file(const FileAligner* self, Parser* parser, AlignmentOut alignments) {
-    self->thread_align_file(*parser, alignments);
+  static void trampoline_align_file(const FileAligner* self, Parser* parser, AlignmentOut alignments,
+                                    unsigned int query_threads) {
+    self->thread_align_file(*parser, alignments, query_threads);
   }
+  // Align the sequences from parser, one of query_threads threads
+  // doing so. The matching of each query is run in parallel by
+  // nb_threads / query_threads threads, if more than one.
   template<typename Parser, typename AlignmentOut>
-  void thread_align_file(Parser& parser, AlignmentOut alignments) const;
+  void thread_align_file(Parser& parser, AlignmentOut alignments, unsigned int query_threads = 1) const;
 
   template<typename AlignmentOut>
   void align_long_sequences(const FastaRecordSeq& query, AlignmentOut alignments) const;
@@ -370,7 +553,7 @@ public:
 //     case MAXMATCH: m_sa.findMEM_each(query, query_len, m_options.min_len, false, append_matches); break;
 //     }
 //     cluster_dir = postnuc::FORWARD_CHAR;
-//     m_clusterer.Cluster_each(fwd_matches.data(), UF, fwd_matches.size() - 1, append_cluster);
+//     m_clusterer.Cluster_each(fwd_matches.data(), scratch, fwd_matches.size() - 1, append_cluster);
 //   }
 
 //   if(m_options.orientation & REVERSE) {
@@ -383,12 +566,158 @@ public:
 //     case MAXMATCH: m_sa.findMEM_each(rquery, m_options.min_len, false, append_matches); break;
 //     }
 //     cluster_dir = postnuc::REVERSE_CHAR;
-//     m_clusterer.Cluster_each(bwd_matches.data(), UF, bwd_matches.size() - 1, append_cluster);
+//     m_clusterer.Cluster_each(bwd_matches.data(), scratch, bwd_matches.size() - 1, append_cluster);
 //   }
 
 //   merger.processSyntenys_each(syntenys, Query, alignments);
 // }
 
+template<typename Output>
+void reference_index::find_matches(const char* P, size_t Plen, const Options& opts, Output out, thread_pool* pool) const {
+  if(both_strands()) { // Only the matches on the forward strand
+    find_matches_strands(P, Plen, opts, [&](const mummer::match_t& m, bool reverse) { if(!reverse) out(m); }, pool);
+    return;
+  }
+  if(!m_seeds.empty()) {
+    size_t skipped = 0;
+    m_seeds.find_anchors(P, Plen, opts.min_len, m_seeds.span(),
+                         [&](long ref, long query, long len) { out(mummer::match_t(ref, query, len)); },
+                         opts.max_occ, &skipped);
+    m_skipped += skipped;
+    return;
+  }
+  if(m_shards.size() == 1 && pool && pool->size() > 1) { // Windows of P in parallel
+    const auto& sa = m_shards.front()->sa;
+    switch(opts.match) {
+    case MUM: sa.findMUM_each(P, Plen, opts.min_len, false, out, *pool); break;
+    case MUMREFERENCE: sa.findMAM_each(P, Plen, opts.min_len, false, out, *pool); break;
+    case MAXMATCH: {
+      size_t skipped = 0;
+      sa.findMEM_each(P, Plen, opts.min_len, false, out, *pool, opts.max_occ, &skipped);
+      m_skipped += skipped;
+      break;
+    }
+    case SPACED: break; // Seed index above
+    }
+    return;
+  }
+  if(m_shards.size() == 1) {
+    const auto& sa = m_shards.front()->sa;
+    switch(opts.match) {
+    case MUM: sa.findMUM_each(P, Plen, opts.min_len, false, out); break;
+    case MUMREFERENCE: sa.findMAM_each(P, Plen, opts.min_len, false, out); break;
+    case MAXMATCH: {
+      size_t skipped = 0;
+      sa.findMEM_each(P, Plen, opts.min_len, false, out, opts.max_occ, &skipped);
+      m_skipped += skipped;
+      break;
+    }
+    case SPACED: break; // Seed index above
+    }
+    return;
+  }
+
+  // Matches in each shard, in whole reference coordinates. For MUMs,
+  // the shards give MAM candidates, filtered once merged.
+  std::vector<std::vector<mummer::match_t>> matches(m_shards.size());
+  auto find_shard = [&](size_t s) {
+    const auto& sh = *m_shards[s];
+    auto&       ms = matches[s];
+    if(opts.match == MAXMATCH) {
+      size_t skipped = 0;
+      sh.sa.findMEM_each(P, Plen, opts.min_len, false, [&](const mummer::match_t& m) { ms.push_back(m); },
+                         opts.max_occ, &skipped);
+      m_skipped += skipped;
+    } else
+      sh.sa.MAM(P, Plen, opts.min_len, false, ms);
+    size_t j = 0;
+    for(size_t i = 0; i < ms.size(); ++i) {
+      if(opts.match != MAXMATCH && occurs_elsewhere(P + ms[i].query, ms[i].len, s))
+        continue;
+      ms[j]      = ms[i];
+      ms[j].ref += sh.offset;
+      ++j;
+    }
+    ms.resize(j);
+  };
+  if(pool && pool->size() > 1) {
+    std::atomic<size_t> next(0);
+    pool->run([&](unsigned int id) {
+        for(size_t s = next++; s < m_shards.size(); s = next++)
+          find_shard(s);
+      });
+  } else {
+    for(size_t s = 0; s < m_shards.size(); ++s)
+      find_shard(s);
+  }
+
+  if(opts.match == MUM) {
+    std::vector<mummer::match_t> all;
+    for(const auto& ms : matches)
+      all.insert(all.end(), ms.cbegin(), ms.cend());
+    mummer::sparseSA::filterMUM_each(all, out);
+  } else {
+    for(const auto& ms : matches)
+      for(const auto& m : ms)
+        out(m);
+  }
+}
+
+template<typename Output>
+void reference_index::find_matches_batch(const char* const* P, const size_t* Plen, size_t n, const Options& opts,
+                                         Output out, thread_pool* pool) const {
+  if(m_shards.size() == 1) {
+    const auto& sa = m_shards.front()->sa;
+    switch(opts.match) {
+    case MUM: sa.findMUM_batch(P, Plen, n, opts.min_len, false, out); return;
+    case MUMREFERENCE: sa.findMAM_batch(P, Plen, n, opts.min_len, false, out); return;
+    case MAXMATCH: case SPACED: break;
+    }
+  }
+  for(size_t q = 0; q < n; ++q)
+    find_matches(P[q], Plen[q], opts, [&](const mummer::match_t& m) { out(q, m); }, pool);
+}
+
+template<typename Output>
+void reference_index::find_matches_both(const char* P, size_t Plen, const Options& opts, Output out,
+                                        thread_pool* pool) const {
+  if(!both_strands()) {
+    if(opts.orientation & FORWARD)
+      find_matches(P, Plen, opts, [&](const mummer::match_t& m) { out(m, false); }, pool);
+    if(opts.orientation & REVERSE) {
+      std::string rquery(P, Plen);
+      reverse_complement(rquery);
+      find_matches(rquery.c_str(), rquery.size(), opts, [&](const mummer::match_t& m) { out(m, true); }, pool);
+    }
+    return;
+  }
+  find_matches_strands(P, Plen, opts, [&](const mummer::match_t& m, bool reverse) {
+      if(opts.orientation & (reverse ? REVERSE : FORWARD)) out(m, reverse);
+    }, pool);
+}
+
+template<typename Output>
+void reference_index::find_matches_strands(const char* P, size_t Plen, const Options& opts, Output out,
+                                           thread_pool* pool) const {
+  // A match at position p in the reverse complement, in m_text, is a
+  // match of the reverse complement of P at position 2 * m_length - p
+  // - len in the reference.
+  const long L          = m_length;
+  auto       strand_out = [&](const mummer::match_t& m) {
+    if(m.ref < L)
+      out(m, false);
+    else
+      out(mummer::match_t(2 * L - m.ref - m.len, (long)Plen - m.query - m.len, m.len), true);
+  };
+  const auto& sa      = m_shards.front()->sa;
+  size_t      skipped = 0;
+  if(pool && pool->size() > 1)
+    sa.findMEM_each(P, Plen, opts.min_len, false, strand_out, *pool, opts.max_occ, &skipped);
+  else
+    sa.findMEM_each(P, Plen, opts.min_len, false, strand_out, opts.max_occ, &skipped);
+  m_skipped += skipped;
+}
+
 template<typename AlignmentOut>
 void FileAligner::align_file(const char* query_path, AlignmentOut alignments, unsigned int nb_threads) const {
   typedef jellyfish::stream_manager<const char**>          stream_manager;
@@ -398,25 +727,35 @@ void FileAligner::align_file(const char* query_path, AlignmentOut alignments, un
 
   std::vector<std::thread> threads;
   for(unsigned int i = 0; i < nb_threads; ++i) {
-    threads.push_back(std::thread(trampoline_align_file<AlignmentOut>, this, &parser, alignments));
+    threads.push_back(std::thread(trampoline_align_file<sequence_parser, AlignmentOut>, this, &parser, alignments, nb_threads));
   }
   for(auto& th : threads)
     th.join();
 }
 
 template<typename Parser, typename AlignmentOut>
-void FileAligner::thread_align_file(Parser& parser, AlignmentOut alignments) const {
+void FileAligner::thread_align_file(Parser& parser, AlignmentOut alignments, unsigned int query_threads) const {
   typedef postnuc::Synteny<FastaRecordPtr> synteny_type;
-  std::vector<mgaps::Match_t>       fwd_matches(1), bwd_matches(1);
+  std::vector<std::vector<mgaps::Anchor_t>> matches; // Matches of each query, after a dummy first element. Reused across jobs
+  std::vector<std::string>          rqueries;
+  std::vector<const char*>          queries;
+  std::vector<size_t>               query_lens;
+  std::vector<char>                 screened; // Whether the query is screened out by the prefilter
   std::vector<synteny_type>         syntenys;
   std::forward_list<FastaRecordPtr> records;
   FastaRecordSeq                    Query("");
-  mgaps::UnionFind                  UF;
+  mgaps::ClusterScratch             scratch;
   char                              cluster_dir;
   const postnuc::merge_syntenys     merger(m_options.do_delta, m_options.do_extend,
                                            m_options.to_seqend, m_options.do_shadows,
                                            m_options.break_len, m_options.banding,
                                            sw_align::NUCLEOTIDE);
+  // The nb_threads threads are split between the query threads to
+  // match each query, as in align_long_sequences for a single query
+  const unsigned int                pool_threads = std::max(1u, m_options.nb_threads / std::max(1u, query_threads));
+  std::unique_ptr<thread_pool>      pool;
+  if(pool_threads > 1)
+    pool.reset(new thread_pool(m_index.size() > 1 ? std::min((size_t)pool_threads, m_index.size()) : pool_threads));
 
   auto append_cluster = [&](const mgaps::cluster_type& cluster) {
     for(size_t i = 0; i < cluster.size(); ) { // i increment in inner loop
@@ -455,44 +794,69 @@ void FileAligner::thread_align_file(Parser& parser, AlignmentOut alignments) con
     typename Parser::job j(parser);
     if(j.is_empty()) break;
 
-    for(size_t i = 0; i < j->nb_filled; ++i) {
+    // Match all the sequences of the job, forward queries first and
+    // then reverse complemented, in one batch. A query screened out by
+    // the prefilter is matched as an empty query, without matches.
+    const size_t nb = j->nb_filled;
+    queries.clear();
+    query_lens.clear();
+    rqueries.resize(nb);
+    screened.resize(nb);
+    for(size_t i = 0; i < nb; ++i) {
       for(char& c : j->data[i].seq)
         c = std::tolower(c);
       size_t space = j->data[i].header.find_first_of(" \t");
       if(space != std::string::npos)
         j->data[i].header[space] = '\0';
+      screened[i] = !prefilter(j->data[i].seq.c_str(), j->data[i].seq.length());
+      if(m_options.orientation & FORWARD) {
+        queries.push_back(j->data[i].seq.c_str());
+        query_lens.push_back(screened[i] ? 0 : j->data[i].seq.length());
+      }
+    }
+    const size_t nb_fwd = queries.size();
+    if((m_options.orientation & REVERSE) && !m_index.both_strands()) {
+      for(size_t i = 0; i < nb; ++i) {
+        if(screened[i]) {
+          rqueries[i].clear();
+        } else {
+          rqueries[i] = j->data[i].seq;
+          reverse_complement(rqueries[i]);
+        }
+        queries.push_back(rqueries[i].c_str());
+        query_lens.push_back(rqueries[i].length());
+      }
+    }
+    matches.resize(std::max(matches.size(), 2 * nb));
+    for(size_t q = 0; q < 2 * nb; ++q)
+      matches[q].resize(1);
+    if(m_index.both_strands()) { // Both strands from the forward queries
+      for(size_t q = 0; q < nb; ++q)
+        m_index.find_matches_both(queries[q], query_lens[q], m_options, [&](const mummer::match_t& m, bool reverse) {
+            matches[reverse ? nb_fwd + q : q].push_back({ m.ref + 1, m.query + 1, m.len });
+          }, pool.get());
+    } else {
+      m_index.find_matches_batch(queries.data(), query_lens.data(), queries.size(), m_options,
+                                 [&](size_t q, const mummer::match_t& m) {
+                                   matches[q].push_back({ m.ref + 1, m.query + 1, m.len });
+                                 }, pool.get());
+    }
+
+    for(size_t i = 0; i < nb; ++i) {
       Query = FastaRecordSeq(j->data[i].seq.c_str(), j->data[i].seq.length(), j->data[i].header.c_str());
-      fwd_matches.resize(1);
-      bwd_matches.resize(1);
       syntenys.clear();
       records.clear();
-      assert(fwd_matches.size() == 1);
-      assert(bwd_matches.size() == 1);
       assert(syntenys.empty());
       if(m_options.orientation & FORWARD) {
-        auto append_matches = [&](const mummer::match_t& m) { fwd_matches.push_back({ m.ref + 1, m.query + 1, m.len }); };
-        switch(m_options.match) {
-        case MUM: m_sa.findMUM_each(Query.seq() + 1, Query.len(), m_options.min_len, false, append_matches); break;
-        case MUMREFERENCE: m_sa.findMAM_each(Query.seq() + 1, Query.len(), m_options.min_len, false, append_matches); break;
-        case MAXMATCH: m_sa.findMEM_each(Query.seq() + 1, Query.len(), m_options.min_len, false, append_matches); break;
-        }
+        auto& fwd_matches = matches[i];
         cluster_dir = postnuc::FORWARD_CHAR;
-        m_clusterer.Cluster_each(fwd_matches.data(), UF, fwd_matches.size() - 1, append_cluster);
+        m_clusterer.Cluster_each(fwd_matches.data(), scratch, fwd_matches.size() - 1, append_cluster);
       }
 
       if(m_options.orientation & REVERSE) {
-        std::string rquery(Query.seq() + 1, Query.len());
-        reverse_complement(rquery);
-        auto append_matches = [&](const mummer::match_t& m) {
-          bwd_matches.push_back({ m.ref + 1, m.query + 1, m.len });
-        };
-        switch(m_options.match) {
-        case MUM: m_sa.findMUM_each(rquery, m_options.min_len, false, append_matches); break;
-        case MUMREFERENCE: m_sa.findMAM_each(rquery, m_options.min_len, false, append_matches); break;
-        case MAXMATCH: m_sa.findMEM_each(rquery, m_options.min_len, false, append_matches); break;
-        }
+        auto& bwd_matches = matches[nb_fwd + i];
         cluster_dir = postnuc::REVERSE_CHAR;
-        m_clusterer.Cluster_each(bwd_matches.data(), UF, bwd_matches.size() - 1, append_cluster);
+        m_clusterer.Cluster_each(bwd_matches.data(), scratch, bwd_matches.size() - 1, append_cluster);
       }
       merger.processSyntenys_each(syntenys, Query, alignments);
     }
@@ -506,7 +870,7 @@ void FileAligner::align_long_sequences(const FastaRecordSeq& query, AlignmentOut
   typedef mt_skip_list::set<FastaRecordPtr> record_container;
   typedef mt_skip_list::set<synteny_type>   synteny_container;
 
-  std::vector<mgaps::Match_t>       fwd_matches(1), bwd_matches(1);
+  std::vector<mgaps::Anchor_t>      fwd_matches(1), bwd_matches(1);
   record_container                  records;
   synteny_container                 syntenys;
   char                              cluster_dir;
@@ -515,6 +879,12 @@ void FileAligner::align_long_sequences(const FastaRecordSeq& query, AlignmentOut
                                            m_options.break_len, m_options.banding,
                                            sw_align::NUCLEOTIDE);
   std::mutex                        clusters_mtx;
+  // Query the shards in parallel, or windows of the query with a
+  // single index
+  std::unique_ptr<thread_pool>      pool;
+  if(m_options.nb_threads > 1)
+    pool.reset(new thread_pool(m_index.size() > 1 ? std::min((size_t)m_options.nb_threads, m_index.size())
+                                                  : m_options.nb_threads));
 
   // append_cluster maybe called by multiple threads at once
   auto append_cluster = [&](const mgaps::cluster_type& cluster) {
@@ -549,30 +919,16 @@ void FileAligner::align_long_sequences(const FastaRecordSeq& query, AlignmentOut
   syntenys.clear();
   records.clear();
 
+  m_index.find_matches_both(query.seq() + 1, query.len(), m_options, [&](const mummer::match_t& m, bool reverse) {
+      (reverse ? bwd_matches : fwd_matches).push_back({ m.ref + 1, m.query + 1, m.len });
+    }, pool.get());
   if(m_options.orientation & FORWARD) {
-    auto append_matches = [&](const mummer::match_t& m) { fwd_matches.push_back({ m.ref + 1, m.query + 1, m.len }); };
-    switch(m_options.match) {
-    case MUM: m_sa.findMUM_each(query.seq() + 1, query.len(), m_options.min_len, false, append_matches); break;
-    case MUMREFERENCE: m_sa.findMAM_each(query.seq() + 1, query.len(), m_options.min_len, false, append_matches); break;
-    case MAXMATCH: m_sa.findMEM_each(query.seq() + 1, query.len(), m_options.min_len, false, append_matches); break;
-    }
     cluster_dir = postnuc::FORWARD_CHAR;
-    m_clusterer.Cluster_each_long(fwd_matches.data(), fwd_matches.size() - 1, append_cluster);
+    m_clusterer.Cluster_each_long(fwd_matches.data(), fwd_matches.size() - 1, append_cluster, pool.get());
   }
-
   if(m_options.orientation & REVERSE) {
-    std::string rquery(query.seq() + 1, query.len());
-    reverse_complement(rquery);
-    auto append_matches = [&](const mummer::match_t& m) {
-      bwd_matches.push_back({ m.ref + 1, m.query + 1, m.len });
-    };
-    switch(m_options.match) {
-    case MUM: m_sa.findMUM_each(rquery, m_options.min_len, false, append_matches); break;
-    case MUMREFERENCE: m_sa.findMAM_each(rquery, m_options.min_len, false, append_matches); break;
-    case MAXMATCH: m_sa.findMEM_each(rquery, m_options.min_len, false, append_matches); break;
-    }
     cluster_dir = postnuc::REVERSE_CHAR;
-    m_clusterer.Cluster_each_long(bwd_matches.data(), bwd_matches.size() - 1, append_cluster);
+    m_clusterer.Cluster_each_long(bwd_matches.data(), bwd_matches.size() - 1, append_cluster, pool.get());
   }
   merger.processSyntenys_long_each(syntenys, query, alignments);
 }
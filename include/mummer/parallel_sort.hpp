@@ -0,0 +1,131 @@
+#ifndef __PARALLEL_SORT_H__
+#define __PARALLEL_SORT_H__
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <iterator>
+#include <algorithm>
+
+#include "thread_pool.hpp"
+#include "radix_sort.hpp"
+
+namespace mummer {
+
+// Parallel version of radix_sort: least significant digit radix sort
+// of [begin, end) on key(x), an unsigned integer less than 2^bits,
+// on the threads of pool. The sort is stable. tmp points to scratch
+// space for end - begin elements. Each thread counts the digits of a
+// chunk of the input and scatters it at offsets ordered by (digit,
+// chunk).
+template<typename T, typename Key>
+void parallel_radix_sort(T* begin, T* end, T* tmp, int bits, Key key, thread_pool& pool) {
+  static const int    digit_bits = 11;
+  static const size_t buckets    = (size_t)1 << digit_bits;
+  const size_t        n          = end - begin;
+  const unsigned int  nb         = pool.size();
+  if(nb < 2 || n < buckets * nb)
+    return radix_sort(begin, end, tmp, bits, key);
+
+  std::vector<size_t> count(buckets * nb); // count[id * buckets + digit]
+  T*                  from = begin;
+  T*                  to   = tmp;
+
+  for(int shift = 0; shift < bits; shift += digit_bits) {
+    std::fill(count.begin(), count.end(), 0);
+    pool.parallel_for(0, n, [&](long b, long e, unsigned int id) {
+        size_t* c = count.data() + id * buckets;
+        for(long i = b; i < e; ++i)
+          ++c[(key(from[i]) >> shift) & (buckets - 1)];
+      });
+    bool   skip = false;
+    size_t sum  = 0;
+    for(size_t d = 0; d < buckets && !skip; ++d) {
+      size_t digit = 0;
+      for(unsigned int id = 0; id < nb; ++id) {
+        const size_t cur          = count[id * buckets + d];
+        count[id * buckets + d]   = sum;
+        sum                      += cur;
+        digit                    += cur;
+      }
+      skip = digit == n; // Digit shared by all the keys
+    }
+    if(skip) continue;
+    pool.parallel_for(0, n, [&](long b, long e, unsigned int id) {
+        size_t* c = count.data() + id * buckets;
+        for(long i = b; i < e; ++i)
+          to[c[(key(from[i]) >> shift) & (buckets - 1)]++] = from[i];
+      });
+    std::swap(from, to);
+  }
+  if(from != begin)
+    pool.parallel_for(0, n, [&](long b, long e, unsigned int id) { std::copy(from + b, from + e, begin + b); });
+}
+
+// Sample sort of [begin, end) with comp on the threads of pool. A
+// regular sample of the input gives the splitters of a few buckets
+// per thread. Each thread distributes a chunk of the input to the
+// buckets, then the buckets are sorted independently. The sort is not
+// stable, but the result depends only on the input and the number of
+// threads.
+template<typename Iterator, typename Compare>
+void sample_sort(Iterator begin, Iterator end, Compare comp, thread_pool& pool) {
+  typedef typename std::iterator_traits<Iterator>::value_type value_type;
+  static const size_t oversampling = 32;
+  const size_t        n            = end - begin;
+  const unsigned int  nb           = pool.size();
+  const size_t        nb_buckets   = 4 * (size_t)nb;
+  if(nb < 2 || n < 1024 * nb_buckets)
+    return std::sort(begin, end, comp);
+
+  std::vector<value_type> splitters;
+  const size_t            nb_samples = oversampling * nb_buckets;
+  for(size_t i = 0; i < nb_samples; ++i)
+    splitters.push_back(begin[i * n / nb_samples + n / (2 * nb_samples)]);
+  std::sort(splitters.begin(), splitters.end(), comp);
+  for(size_t i = 1; i < nb_buckets; ++i)
+    splitters[i - 1] = splitters[i * oversampling];
+  splitters.resize(nb_buckets - 1);
+
+  // Bucket of each element, and offsets ordered by (bucket, chunk)
+  std::vector<uint32_t> bucket(n);
+  std::vector<size_t>   count(nb_buckets * nb); // count[id * nb_buckets + b]
+  pool.parallel_for(0, n, [&](long b, long e, unsigned int id) {
+      size_t* c = count.data() + id * nb_buckets;
+      for(long i = b; i < e; ++i) {
+        bucket[i] = std::upper_bound(splitters.cbegin(), splitters.cend(), begin[i], comp) - splitters.cbegin();
+        ++c[bucket[i]];
+      }
+    });
+  std::vector<size_t> bucket_start(nb_buckets + 1);
+  size_t              sum = 0;
+  for(size_t b = 0; b < nb_buckets; ++b) {
+    bucket_start[b] = sum;
+    for(unsigned int id = 0; id < nb; ++id) {
+      const size_t cur             = count[id * nb_buckets + b];
+      count[id * nb_buckets + b]   = sum;
+      sum                         += cur;
+    }
+  }
+  bucket_start[nb_buckets] = n;
+
+  std::vector<value_type> tmp(n);
+  pool.parallel_for(0, n, [&](long b, long e, unsigned int id) {
+      size_t* c = count.data() + id * nb_buckets;
+      for(long i = b; i < e; ++i)
+        tmp[c[bucket[i]]++] = std::move(begin[i]);
+    });
+
+  // Sort the buckets and move them back
+  std::atomic<size_t> next(0);
+  pool.run([&](unsigned int id) {
+      for(size_t b = next++; b < nb_buckets; b = next++) {
+        std::sort(tmp.begin() + bucket_start[b], tmp.begin() + bucket_start[b + 1], comp);
+        std::move(tmp.begin() + bucket_start[b], tmp.begin() + bucket_start[b + 1], begin + bucket_start[b]);
+      }
+    });
+}
+
+} // namespace mummer
+
+#endif /* __PARALLEL_SORT_H__ */
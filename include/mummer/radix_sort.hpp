@@ -0,0 +1,51 @@
+#ifndef __RADIX_SORT_H__
+#define __RADIX_SORT_H__
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace mummer {
+
+// Least significant digit radix sort of [begin, end) on key(x), an
+// unsigned integer less than 2^bits. The sort is stable. tmp points to
+// scratch space for end - begin elements. A pass on a digit shared by
+// all the keys is skipped.
+template<typename T, typename Key>
+void radix_sort(T* begin, T* end, T* tmp, int bits, Key key) {
+  static const int    digit_bits = 11;
+  static const size_t buckets    = (size_t)1 << digit_bits;
+  const size_t        n          = end - begin;
+  std::vector<size_t> count(buckets);
+  T*                  from       = begin;
+  T*                  to         = tmp;
+
+  for(int shift = 0; shift < bits; shift += digit_bits) {
+    std::fill(count.begin(), count.end(), 0);
+    for(size_t i = 0; i < n; ++i)
+      ++count[(key(from[i]) >> shift) & (buckets - 1)];
+    if(*std::max_element(count.cbegin(), count.cend()) == n) continue;
+    size_t sum = 0;
+    for(auto& c : count) {
+      const size_t cur = c;
+      c                = sum;
+      sum             += cur;
+    }
+    for(size_t i = 0; i < n; ++i)
+      to[count[(key(from[i]) >> shift) & (buckets - 1)]++] = from[i];
+    std::swap(from, to);
+  }
+  if(from != begin)
+    std::copy(from, from + n, begin);
+}
+
+// Number of bits needed to represent x
+inline int radix_bits(uint64_t x) {
+  int res = 0;
+  for( ; x; x >>= 1) ++res;
+  return res;
+}
+
+} // namespace mummer
+
+#endif /* __RADIX_SORT_H__ */
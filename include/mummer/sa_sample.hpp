@@ -0,0 +1,60 @@
+#ifndef __SA_SAMPLE_H__
+#define __SA_SAMPLE_H__
+
+#include <vector>
+#include "mapped_vector.hpp"
+
+namespace mummer {
+namespace mummer {
+
+// Sample of every step-th suffix of the suffix array, with its first
+// width characters stored inline. The first probes of a binary search
+// for the character at depth i < width in an interval of the suffix
+// array read the samples, contiguous in memory, instead of the suffix
+// array and then the text. The search ends between two consecutive
+// samples, as usual.
+struct sa_sample {
+  static const long step  = 32;
+  static const long width = 16;
+  struct entry {
+    char c[width];
+  };
+
+  mapped_vector<entry> entries; // Entry j is the suffix j * step
+
+  bool empty() const { return entries.empty(); }
+  size_t size() const { return entries.size(); }
+
+  // Character at depth i of the suffix m, a multiple of step
+  char at(long m, long i) const { return entries[m / step].c[i]; }
+
+  // Narrow the range [l, r] of a binary search at depth i, where
+  // right(x) is false for the character x of the suffix l, true for
+  // r, and monotone in between. On return, the invariant still holds
+  // and at most one sample is between l and r. Return true if r was
+  // moved to a sample.
+  template<typename Right>
+  bool narrow(long i, long& l, long& r, Right right) const {
+    if(i >= width || entries.empty()) return false;
+    const long lo = l / step + 1;       // First sample after l
+    const long hi = (r - 1) / step + 1; // One past the last sample before r
+    if(hi - lo < 2) return false;
+    long a = lo, b = hi;
+    while(a < b) {
+      const long m = (a + b) / 2;
+      if(right(entries[m].c[i])) b = m;
+      else a = m + 1;
+    }
+    if(b > lo) l = (b - 1) * step;
+    if(b < hi) {
+      r = b * step;
+      return true;
+    }
+    return false;
+  }
+};
+
+} // namespace mummer
+} // namespace mummer
+
+#endif /* __SA_SAMPLE_H__ */
@@ -0,0 +1,209 @@
+#ifndef __SPACED_SEED_INDEX_H__
+#define __SPACED_SEED_INDEX_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace mummer {
+
+// Index of the spaced seeds of a reference, to anchor divergent
+// sequences. A pattern like 111010010100110111 selects the positions
+// (the 1s) of a window that must match: a seed hit tolerates
+// mismatches on the other positions, where an exact k-mer of the same
+// weight would not.
+//
+// The positions of the reference are grouped by the key of their
+// window (the 2 bit codes of the selected bases), in a direct address
+// table of 4^weight buckets. Windows containing a character other than
+// acgt are not indexed. The positions, and the bucket starts, are
+// stored on 32 bits when the text is short enough, as in the suffix
+// array (see vector_32_48). A text shorter than the number of buckets
+// is instead indexed by a sorted array of (key, position) pairs,
+// searched by bisection. The indexed text is not copied and must
+// outlive the index.
+class spaced_seed_index {
+  const char*         m_text;
+  size_t              m_len;
+  std::vector<int>    m_care;  // Offsets of the 1s in the pattern
+  int                 m_span;  // Length of the pattern
+  bool                  m_small;   // Whether the starts and positions are on 32 or 64 bits
+  bool                  m_sparse;  // Whether the positions are in m_sorted
+  std::vector<uint32_t> m_start32; // Start of the bucket of each key in the positions
+  std::vector<size_t>   m_start64;
+  std::vector<uint32_t> m_pos32;   // Positions in the text, sorted within a bucket
+  std::vector<long>     m_pos64;
+  std::vector<uint64_t> m_sorted;  // key << 32 | position, sorted. Only if sparse
+
+public:
+  static const int max_weight = 12;
+  static const char* default_pattern() { return "111010010100110111"; }
+
+  spaced_seed_index() : m_text(nullptr), m_len(0), m_span(0), m_small(true), m_sparse(false) { }
+  // Index the spaced seeds of S[0, len). pattern must be valid (see
+  // valid_pattern).
+  spaced_seed_index(const char* S, size_t len, const std::string& pattern = default_pattern())
+    : m_text(S)
+    , m_len(len)
+    , m_span(pattern.size())
+    , m_small(len <= std::numeric_limits<uint32_t>::max())
+    , m_sparse(false)
+  {
+    for(int i = 0; i < m_span; ++i)
+      if(pattern[i] == '1') m_care.push_back(i);
+    const size_t keys = (size_t)1 << (2 * weight());
+    if(len < keys) { // Fewer windows than buckets
+      m_sparse = true;
+      each(S, len, [&](long i, uint32_t key) { m_sorted.push_back((uint64_t)key << 32 | i); });
+      std::sort(m_sorted.begin(), m_sorted.end());
+    } else if(m_small) {
+      fill_buckets(keys, m_start32, m_pos32);
+    } else {
+      fill_buckets(keys, m_start64, m_pos64);
+    }
+  }
+
+  // A pattern is made of 0s and 1s, starts and ends with a 1 and has
+  // between 1 and max_weight 1s.
+  static bool valid_pattern(const std::string& pattern) {
+    if(pattern.empty() || pattern.front() != '1' || pattern.back() != '1') return false;
+    if(pattern.find_first_not_of("01") != std::string::npos) return false;
+    const auto weight = std::count(pattern.cbegin(), pattern.cend(), '1');
+    return weight <= max_weight;
+  }
+
+  bool empty() const { return m_care.empty(); }
+  int span() const { return m_span; }
+  int weight() const { return m_care.size(); }
+  size_t size() const { return m_sparse ? m_sorted.size() : (m_small ? m_pos32.size() : m_pos64.size()); }
+  // Position in the text of the j-th indexed window
+  long pos(size_t j) const { return m_sparse ? (long)(uint32_t)m_sorted[j] : (m_small ? m_pos32[j] : m_pos64[j]); }
+  // Range [first, second) of the windows with the given key, in
+  // increasing position
+  std::pair<size_t, size_t> bucket(uint32_t key) const {
+    if(m_sparse) {
+      const auto lo = std::lower_bound(m_sorted.cbegin(), m_sorted.cend(), (uint64_t)key << 32);
+      const auto hi = std::lower_bound(lo, m_sorted.cend(), ((uint64_t)key + 1) << 32);
+      return { lo - m_sorted.cbegin(), hi - m_sorted.cbegin() };
+    }
+    if(m_small) return { m_start32[key], m_start32[key + 1] };
+    return { m_start64[key], m_start64[key + 1] };
+  }
+
+  // Find the anchors of P[0, len): the exact matches of at least
+  // min_len bases on the diagonal of a seed hit, within the ungapped
+  // extension of the hit (score +1 for a match, -1 for a mismatch,
+  // stopped when the score drops x_drop below its best). Call out(ref,
+  // query, len) on each anchor, in increasing query position for a
+  // given diagonal. A seed with more than max_occ occurrences, if not
+  // 0, is skipped and counted in *skipped.
+  template<typename Output>
+  void find_anchors(const char* P, size_t len, long min_len, long x_drop, Output out, long max_occ = 0,
+                    size_t* skipped = nullptr) const {
+    std::unordered_map<long, long> covered; // End of the last extension on each diagonal
+    each(P, len, [&](long q, uint32_t key) {
+        const auto   range = bucket(key);
+        const size_t start = range.first, end = range.second;
+        if(max_occ > 0 && end - start > (size_t)max_occ) {
+          if(skipped) ++*skipped;
+          return;
+        }
+        for(size_t j = start; j < end; ++j) {
+          const long r    = pos(j);
+          auto       it   = covered.find(r - q);
+          const long from = it == covered.end() ? 0 : it->second;
+          if(q + m_span <= from) continue;
+          covered[r - q] = extend(P, len, r, q, from, min_len, x_drop, out);
+        }
+      });
+  }
+
+  // Call f(i, key) on the key of each window of S[0, len) made of
+  // acgt only, in increasing position i.
+  template<typename F>
+  void each(const char* S, size_t len, F f) const {
+    if(len < (size_t)m_span) return;
+    long bad = -1; // Last position of a character other than acgt
+    for(long i = 0; i < m_span - 1; ++i)
+      if(code(S[i]) < 0) bad = i;
+    for(long i = 0; i + m_span <= (long)len; ++i) {
+      if(code(S[i + m_span - 1]) < 0) bad = i + m_span - 1;
+      if(bad >= i) continue;
+      uint32_t key = 0;
+      for(int c : m_care)
+        key = (key << 2) | code(S[i + c]);
+      f(i, key);
+    }
+  }
+
+private:
+  // Counting sort of the windows of the text into keys buckets
+  template<typename Start, typename Pos>
+  void fill_buckets(size_t keys, std::vector<Start>& start, std::vector<Pos>& positions) {
+    start.assign(keys + 1, 0);
+    each(m_text, m_len, [&](long i, uint32_t key) { ++start[key + 1]; });
+    for(size_t k = 1; k < start.size(); ++k)
+      start[k] += start[k - 1];
+    positions.resize(start.back());
+    each(m_text, m_len, [&](long i, uint32_t key) { positions[start[key]++] = i; });
+    for(size_t k = start.size() - 1; k > 0; --k) // Shift back the starts
+      start[k] = start[k - 1];
+    start[0] = 0;
+  }
+
+  static int code(char c) {
+    switch(c) {
+    case 'a': case 'A': return 0;
+    case 'c': case 'C': return 1;
+    case 'g': case 'G': return 2;
+    case 't': case 'T': return 3;
+    default: return -1;
+    }
+  }
+
+  static bool same(char a, char b) { return a == b && code(a) >= 0; }
+
+  // Extend the hit at (r, q) on its diagonal, without going left of
+  // query position from, and output the anchors. Return the end of the
+  // extension in the query.
+  template<typename Output>
+  long extend(const char* P, long len, long r, long q, long from, long min_len, long x_drop, Output out) const {
+    const long d = r - q;
+    long       lo = std::max(q, from), hi = q + m_span; // Extension [lo, hi) in the query
+    long       score = 0, best = 0;
+    for(long i = q - 1; i >= std::max(from, -d) && score > best - x_drop; --i) {
+      score += same(P[i], m_text[i + d]) ? 1 : -1;
+      if(score > best) {
+        best = score;
+        lo   = i;
+      }
+    }
+    score = best = 0;
+    for(long i = q + m_span; i < len && i + d < (long)m_len && score > best - x_drop; ++i) {
+      score += same(P[i], m_text[i + d]) ? 1 : -1;
+      if(score > best) {
+        best = score;
+        hi   = i + 1;
+      }
+    }
+    for(long i = lo; i < hi; ) {
+      if(!same(P[i], m_text[i + d])) {
+        ++i;
+        continue;
+      }
+      long j = i + 1;
+      while(j < hi && same(P[j], m_text[j + d])) ++j;
+      if(j - i >= min_len) out(i + d, i, j - i);
+      i = j;
+    }
+    return hi;
+  }
+};
+
+} // namespace mummer
+
+#endif /* __SPACED_SEED_INDEX_H__ */
@@ -12,9 +12,19 @@
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <atomic>
+#include <functional>
 
 #include "48bit_index.hpp"
 #include "openmp_qsort.hpp"
+#include "mapped_vector.hpp"
+#include "index_file.hpp"
+#include "kmer_table.hpp"
+#include "sa_sample.hpp"
+#include "thread_pool.hpp"
+#include "parallel_sort.hpp"
 
 
 namespace mummer {
@@ -50,10 +60,12 @@ static const unsigned int BITADD[256] = {
 
 // Either a vector of 32-bits offsets, or 48-bits.
 struct vector_32_48 {
-  std::vector<int>          small; // Suffix array.
-  fortyeight_index<int64_t> large;
+  mapped_vector<int>                 small; // Suffix array.
+  fortyeight_index<int64_t>          large;
+  std::shared_ptr<const mapped_file> large_map; // Mapping viewed by large, if any
   bool is_small;
   void resize(size_t N, bool force_large = false) {
+    large_map.reset();
     is_small = !force_large && (N < ((size_t)1 << 31));
     if(is_small)
       small.resize(N);
@@ -66,6 +78,15 @@ struct vector_32_48 {
   long operator[](size_t i) const {
     return is_small ? small[i] : large[i];
   }
+  // Hint that entry i will be read soon
+  void prefetch(size_t i) const {
+    if(is_small) {
+      __builtin_prefetch(small.data() + i);
+    } else {
+      __builtin_prefetch(large.m_base32 + i);
+      __builtin_prefetch(large.m_base16 + i);
+    }
+  }
 
   vector_32_48() = default;
   vector_32_48(const std::string& path) {
@@ -82,6 +103,13 @@ struct vector_32_48 {
 // Stores the LCP array in an unsigned char (0-255).  Values larger
 // than or equal to 255 are stored in a sorted array.
 // Simulates a vector<int> LCP;
+//
+// Looking up a large value in the sorted array is a binary search and
+// an access to the suffix array. With init_direct, the large values
+// are instead stored in suffix array order, together with the rank of
+// each block of 64 entries, and the sorted array is dropped. Then a
+// large value is found in constant time, for about 1 bit per entry
+// plus 4 bytes per large value.
 struct vec_uchar {
   typedef unsigned char   small_type;
   typedef unsigned int    large_type;
@@ -100,14 +128,19 @@ struct vec_uchar {
   }
 
   typedef std::vector<item_t> item_vector;
-  std::vector<small_type> vec;  // LCP values from 0-65534
-  item_vector             M;
-  vector_32_48*           sa;
+  static const size_t block_size = 64;
+  mapped_vector<small_type> vec;  // LCP values from 0-65534
+  mapped_vector<item_t>     M;     // Empty if direct
+  mapped_vector<uint64_t>   ranks; // Number of large values before each block. Empty if not direct
+  mapped_vector<large_type> large; // Large values, in suffix array order
+  vector_32_48*             sa;
 
   vec_uchar(vector_32_48& sa_) : vec(sa_.size(), 0), sa(&sa_) { }
   vec_uchar(vec_uchar&& rhs, vector_32_48& sa_)
     : vec(std::move(rhs.vec))
     , M(std::move(rhs.M))
+    , ranks(std::move(rhs.ranks))
+    , large(std::move(rhs.large))
     , sa(&sa_)
   { }
   vec_uchar(const std::string& path, vector_32_48& sa_) : sa(&sa_) {
@@ -119,15 +152,45 @@ struct vec_uchar {
   large_type operator[] (size_t idx) const {
     const large_type res = vec[idx];
     if(res != max) return res;
+    if(!ranks.empty()) return large[rank(idx)];
+    return lookup(idx);
+  }
+  // Hint that the value at idx will be read soon
+  void prefetch(size_t idx) const { __builtin_prefetch(vec.data() + idx); }
+  // Large value at idx from the sorted array M. Not valid if direct.
+  large_type lookup(size_t idx) const {
     idx = (*sa)[idx];
-    auto it = upper_bound(M.begin(), M.end(), item_t(idx));
+    auto it = std::upper_bound(M.begin(), M.end(), item_t(idx));
     assert(it != M.begin());
     --it;
     return it->val - (idx - it->idx);
   }
+  // Number of large values before idx. Requires init_direct.
+  size_t rank(size_t idx) const {
+    const size_t      n = idx % block_size;
+    const small_type* p = vec.data() + (idx - n);
+    size_t            r = ranks[idx / block_size];
+    size_t            i = 0;
+    for( ; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+      uint64_t w;
+      memcpy(&w, p + i, sizeof(w));
+      r += count_max(w);
+    }
+    for( ; i < n; ++i)
+      r += p[i] == max;
+    return r;
+  }
+  // Number of bytes equal to max in w
+  static int count_max(uint64_t w) {
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    const uint64_t y    = ~w; // Bytes equal to max are now 0
+    const uint64_t z    = ((y & low7) + low7) | y;
+    return sizeof(uint64_t) - __builtin_popcountll(z & ~low7);
+  }
   // Actually set LCP values, distingushes large and small LCP
   // values.
-  void set(size_t idx, large_type v, item_vector& M_) {
+  template<typename ItemVector>
+  void set(size_t idx, large_type v, ItemVector& M_) {
     if(v < max) {
       vec[idx] = v;
     } else {
@@ -144,6 +207,9 @@ struct vec_uchar {
   void init();
   // Same as init, but for multi-threaded version. Merge M vectors.
   void init_merge(const std::vector<item_vector>& Ms);
+  // After init, build the constant time access to large values,
+  // replacing M.
+  void init_direct(thread_pool& pool);
 
   bool save(std::ostream&& os) const;
   inline bool save(const std::string& path) const { return save(std::ofstream(path)); }
@@ -154,6 +220,8 @@ struct vec_uchar {
       long indexSize = 0L;
       indexSize += sizeof(vec) + vec.capacity()*sizeof(small_type);
       indexSize += sizeof(M) + M.capacity()*(sizeof(size_t)+sizeof(large_type));
+      indexSize += sizeof(ranks) + ranks.capacity()*sizeof(uint64_t);
+      indexSize += sizeof(large) + large.capacity()*sizeof(large_type);
       return indexSize;
   }
 };
@@ -193,6 +261,27 @@ struct interval_t {
   long size() const { return end - start + 1; }
 };
 
+// Length of the common prefix of a and b, at most len. Compares 8
+// characters at a time: the first mismatch in a word is found with a
+// XOR and a count of trailing (or leading) zeros.
+inline long common_prefix(const char* a, const char* b, long len) {
+  long h = 0;
+  for( ; h + (long)sizeof(uint64_t) <= len; h += sizeof(uint64_t)) {
+    uint64_t x, y;
+    memcpy(&x, a + h, sizeof(x));
+    memcpy(&y, b + h, sizeof(y));
+    if(x != y) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return h + (__builtin_clzll(x ^ y) >> 3);
+#else
+      return h + (__builtin_ctzll(x ^ y) >> 3);
+#endif
+    }
+  }
+  while(h < len && a[h] == b[h]) ++h;
+  return h;
+}
+
 struct bounded_string {
   const char* const s_;
   const size_t      al_; // actual length
@@ -227,6 +316,38 @@ struct bounded_string {
   }
 
   const char* operator+(size_t offset) const { return s_ + offset; }
+  // Hint that character i will be read soon
+  void prefetch(size_t i) const {
+    if(i < al_) __builtin_prefetch(s_ + i);
+  }
+
+  // Number of characters, at most len, for which the suffix at i
+  // matches P. Same result as comparing (*this)[i + h] and P[h] one
+  // at a time.
+  long match(size_t i, const char* P, long len) const {
+    long h = 0;
+    if(i < al_) {
+      const long fast = std::min(len, (long)(al_ - i));
+      h = common_prefix(s_ + i, P, fast);
+      if(h < fast) return h;
+    }
+    while(h < len && (*this)[i + h] == P[h]) ++h;
+    return h;
+  }
+
+  // Extend the common prefix of length h of the suffixes at i and j,
+  // considering only the positions before end.
+  long lcp(size_t i, size_t j, long h, size_t end) const {
+    const size_t m    = std::max(i, j);
+    const size_t fend = std::min(end, al_);
+    if(m + h < fend) {
+      const long fast = fend - m;
+      h += common_prefix(s_ + i + h, s_ + j + h, fast - h);
+      if(h < fast) return h;
+    }
+    while(i + h < end && j + h < end && (*this)[i + h] == (*this)[j + h]) ++h;
+    return h;
+  }
 };
 
 // Auxilliary information about sparseSA
@@ -274,12 +395,16 @@ struct sparseSA : sparseSA_aux {
   vector_32_48              SA; // Suffix array.
   vector_32_48              ISA; // Inverse suffix array
   vec_uchar                 LCP; // Simulates a vector<int> LCP.
-  std::vector<int>          CHILD; //child table
-  std::vector<saTuple_t>    KMR;
+  mapped_vector<int>        CHILD; //child table
+  kmer_table                KMR; // SA intervals of the k-mers
+  sa_sample                 SAMPLE; // Accelerates the binary searches when there is no child table
 
   //fields for lookup table of sa intervals to a certain small depth
   long kMerTableSize;
 
+  // Keeps alive the mapped index when S points into it
+  std::shared_ptr<const mapped_file> text_map;
+
   long index_size_in_bytes() const ;
 
   // Constructor builds sparse suffix array.
@@ -294,12 +419,25 @@ struct sparseSA : sparseSA_aux {
            int sparseMult_, int kMerSize_, bool nucleotidesOnly_)
     : sparseSA(S_.c_str(), S_.length(), __4column, K_, suflink_, child_, kmer_, sparseMult_, kMerSize_, nucleotidesOnly_)
   { }
-  // Constructor load sparse suffix array from file
+  // Constructor load sparse suffix array from file. Throws if the
+  // index does not exist or was built from another sequence than S_.
   sparseSA(const char* S_, size_t Slen, const std::string& prefix)
     : S(S_, Slen, 1)
     , LCP(SA)
   {
-    load(prefix);
+    if(!load(prefix))
+      throw std::runtime_error("Failed to load suffix array '" + prefix + "'");
+    S.set_k(K);
+  }
+  // Constructor from a self contained index, using the text it
+  // contains.
+  explicit sparseSA(const index_reader& index)
+    : S(index.good() ? index.text() : nullptr, index.good() ? index.text_length() : 0, 1)
+    , LCP(SA)
+    , text_map(index.map())
+  {
+    if(!S.s_ || !load_mapped(index))
+      throw std::runtime_error("Invalid self contained index");
     S.set_k(K);
   }
   sparseSA(const std::string& S_, const std::string& prefix)
@@ -313,24 +451,41 @@ struct sparseSA : sparseSA_aux {
     , LCP(std::move(rhs.LCP), SA)
     , CHILD(std::move(rhs.CHILD))
     , KMR(std::move(rhs.KMR))
+    , SAMPLE(std::move(rhs.SAMPLE))
     , kMerTableSize(rhs.kMerTableSize)
+    , text_map(std::move(rhs.text_map))
   { }
 
-  static sparseSA create_auto(const char* S, size_t Slen, int min_len, bool nucleotidesOnly_, int K = 1, bool off48 = false);
+  static sparseSA create_auto(const char* S, size_t Slen, int min_len, bool nucleotidesOnly_, int K = 1, bool off48 = false,
+                              unsigned int threads = 1, bool lcp_direct = false);
+  // Same as create_auto, but the index is built directly in the
+  // sections of writer (see construct_external), which must then be
+  // closed. Throws on failure.
+  static sparseSA create_auto_external(index_writer& writer, size_t mem, const char* S, size_t Slen, int min_len,
+                                       bool nucleotidesOnly_, int K = 1, bool off48 = false,
+                                       unsigned int threads = 1, bool lcp_direct = false);
+  // Index with the parameters chosen by create_auto, not constructed.
+  static sparseSA auto_params(const char* S, size_t Slen, int min_len, bool nucleotidesOnly_, int K);
   // static sparseSA create_auto(const std::string& S, int min_len, bool nucleotidesOnly_, int K = 1) {
   //   return create_auto(S.c_str(), S.length(), min_len, nucleotidesOnly_, K);
   // }
 
   // Modified Kasai et all for LCP computation.
   void computeLCP();
+  // Same, multi-threaded
+  void computeLCP(thread_pool& pool);
   //Modified Abouelhoda et all for CHILD Computation.
-  void computeChild();
+  //For the following passes, if window is not 0, release() is called
+  //after every window entries of the arrays, for construct_external
+  //to drop the pages read so far.
+  void computeChild(size_t window = 0, const std::function<void()>& release = std::function<void()>());
   //build look-up table for sa intervals of kmers up to some depth
-  void computeKmer();
-
-  // Not used at this point
-  // Radix sort required to construct transformed text for sparse SA construction.
-  // void radixStep(int *t_new, int *SA, long &bucketNr, long *BucketBegin, long l, long r, long h);
+  void computeKmer(thread_pool& pool, size_t window = 0, const std::function<void()>& release = std::function<void()>());
+  //build the sample of the suffix array for the binary searches
+  void computeSample(thread_pool& pool, size_t window = 0, const std::function<void()>& release = std::function<void()>());
+  // Choose the k-mer table depth for a text of length N sampled
+  // every K suffixes, at most 16 and no more than min_len allows.
+  static int auto_kmer_size(size_t N, long K, int min_len, int sparseMult);
 
   // Binary search for left boundry of interval.
   inline long bsearch_left(char c, long i, long s, long e) const;
@@ -349,6 +504,14 @@ struct sparseSA : sparseSA_aux {
   // Traverse pattern P starting from a given prefix and interval
   // until mismatch or min_len characters reached.
   void traverse(const char* P, size_t Plen, long prefix, interval_t &cur, int min_len) const;
+  // Jump to the interval of the first kMerSize characters of P +
+  // prefix using the k-mer table. Return false if there is no match.
+  bool kmer_jump(const char* P, long prefix, interval_t &cur) const;
+  // The 2 steps of kmer_jump: the code of the k-mer at P + prefix,
+  // -1 if it contains a character other than ACGT, -2 if it is not
+  // lower case, and the look-up of a code in the table.
+  int64_t kmer_code(const char* P, long prefix) const;
+  bool kmer_find(int64_t code, interval_t &cur) const;
   void traverse(const std::string &P, long prefix, interval_t &cur, int min_len) const {
     traverse(P.c_str(), P.length(), prefix, cur, min_len);
   }
@@ -357,6 +520,27 @@ struct sparseSA : sparseSA_aux {
     traverse_faster(P.c_str(), P.length(), prefix, cur, min_len);
   }
 
+  // Resumable traverse, for findMAM_batch. Each call to descend makes
+  // at most one random access to S, the bounds of the interval in SA or
+  // the k-mer table, prefetches the next one and returns false, or
+  // returns true when the traversal is done. d.step must be START on the first call. With a child
+  // table, the whole traversal is done by traverse_faster on the first
+  // call.
+  struct descent_state {
+    enum step_type { START, KMER_DIR, KMER, LOOP, BOUNDS_SA, LEAF, BOUNDS, LEFT_NEXT, LEFT, RIGHT_INIT, RIGHT_NEXT,
+                     RIGHT, FINISH };
+    step_type step;
+    char      c;                     // Character searched at depth i
+    long      i;
+    long      l, r, l2, r2, m;       // Binary searches, as in top_down_faster
+    long      cmp_first, cmp_last;
+    long      lo, hi, sa_lo, sa_hi;  // Last bounds read from SA, and their values
+    long      pos;                   // Position in S of the middle of a binary search
+    bool      found;
+    int64_t   code;                  // Code of the k-mer
+  };
+  bool descend(const char* P, long Plen, long prefix, interval_t &cur, long min_len, descent_state &d) const;
+
   // Simulate a suffix link.
   bool suffixlink(interval_t &m) const;
 
@@ -391,7 +575,14 @@ struct sparseSA : sparseSA_aux {
 
   // NOTE: min_len must be > 1
   template<typename Output>
-  void findMAM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out) const;
+  void findMAM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out) const {
+    findMAM_window(P, Plen, 0, Plen, min_len, flip_forward, out);
+  }
+  // The MAMs of P starting at a position in [from, to). P is read
+  // past to as needed to extend the matches. The MAMs of P are the
+  // union of the MAMs of the windows of any partition of [0, Plen).
+  template<typename Output>
+  void findMAM_window(const char* P, size_t Plen, long from, long to, int min_len, bool flip_forward, Output out) const;
   template<typename Output>
   void findMAM_each(const std::string& P, int min_len, bool flip_forward, Output out) const {
     findMAM_each(P.c_str(), P.length(), min_len, flip_forward, out);
@@ -400,6 +591,18 @@ struct sparseSA : sparseSA_aux {
   void findMAM(const char* P, size_t Plen, int min_len, bool flip_forward, std::vector<match_t>& matches) const {
     findMAM_each(P, Plen, min_len, flip_forward, [&](const match_t& m) { matches.push_back(m); });
   }
+
+  // Find the MAMs of the n queries P[q] of length Plen[q], calling
+  // out(q, m) for each match m of query q. The matches of each query
+  // are the same, in the same order, as with findMAM_each. Up to
+  // batch_width queries are matched in turn: the top down traversal
+  // (see descend), the check of left maximality and the suffix link of
+  // a query are done one random access at a time, prefetching the next
+  // probe (SA, S, ISA or LCP) before switching to the next query, so
+  // the latencies of the accesses overlap.
+  static const size_t batch_width = 16;
+  template<typename Output>
+  void findMAM_batch(const char* const* P, const size_t* Plen, size_t n, int min_len, bool flip_forward, Output out) const;
   void findMAM(const std::string &P, int min_len, bool flip_forward, std::vector<match_t>& matches) const {
     findMAM(P.c_str(), P.length(), min_len, flip_forward, matches);
   }
@@ -427,25 +630,45 @@ struct sparseSA : sparseSA_aux {
 
 
   // Given an interval where the given prefix is matched up to a
-  // mismatch, find all MEMs up to a minimum match depth.
+  // mismatch, find all MEMs up to a minimum match depth. If max_occ
+  // is not 0, the MEMs whose sequence occurs more than max_occ times
+  // in the suffix array are skipped: the enumeration stops as soon as
+  // the interval of the matches grows larger than max_occ, before
+  // visiting its suffixes. *skipped, if not null, is then
+  // incremented. Return false if the enumeration was stopped.
   template<typename Output>
-  void collectMEMs_each(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len, bool flip_forward,
-                        Output out) const;
+  bool collectMEMs_each(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len, bool flip_forward,
+                        Output out, long max_occ = 0, size_t* skipped = nullptr) const;
   template<typename Output>
   void collectMEMs_each(const std::string &P, long prefix, interval_t mli, interval_t xmi, int min_len, bool flip_forward,
                         Output out) const {
     collectMEMs_each(P.c_str(), P.length(), prefix, mli, xmi, min_len, flip_forward, out);
   }
+  template<typename Output>
+  bool collectMEMs_capped(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len,
+                          bool flip_forward, Output out, long max_occ, size_t* skipped) const;
 
   // Find all MEMs given a prefix pattern offset k.
   template<typename Output>
-  void findMEM_k_each(const char* P, size_t Plen, long k, int min_len, bool flip_forward, Output out) const;
+  void findMEM_k_each(const char* P, size_t Plen, long k, int min_len, bool flip_forward, Output out) const {
+    findMEM_k_window(P, Plen, k, 0, Plen, min_len, flip_forward, out);
+  }
+  // The MEMs of findMEM_k_each found from the positions of P in [from,
+  // to). A MEM is found from the position of its first sampled suffix,
+  // hence it may start before from. As for findMAM_window, the MEMs
+  // of P are the union of the MEMs of the windows of a partition.
+  template<typename Output>
+  void findMEM_k_window(const char* P, size_t Plen, long k, long from, long to, int min_len, bool flip_forward,
+                        Output out, long max_occ = 0, size_t* skipped = nullptr) const;
 
-  // Find Maximal Exact Matches (MEMs)
+  // Find Maximal Exact Matches (MEMs). max_occ and skipped as in
+  // collectMEMs_each: *skipped is the number of query positions whose
+  // matches were skipped for occurring more than max_occ times.
   template<typename Output>
-  void findMEM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out) const {
+  void findMEM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out,
+                    long max_occ = 0, size_t* skipped = nullptr) const {
     for(int k = 0; k < K; k++)
-      findMEM_k_each(P, Plen, k, min_len, flip_forward, out);
+      findMEM_k_window(P, Plen, k, 0, Plen, min_len, flip_forward, out, max_occ, skipped);
   }
   template<typename Output>
   void findMEM_each(const std::string &P, int min_len, bool flip_forward, Output out) const {
@@ -466,19 +689,97 @@ struct sparseSA : sparseSA_aux {
   void findMUM_each(const std::string &P, int min_len, bool flip_forward, Output out) const {
     findMUM_each(P.c_str(), P.length(), min_len, flip_forward, out);
   }
+  // MUMs of n queries, with findMAM_batch. out(q, m) as in findMAM_batch.
+  template<typename Output>
+  void findMUM_batch(const char* const* P, const size_t* Plen, size_t n, int min_len, bool flip_forward, Output out) const;
 
   void MUM(const std::string &P, int min_len, bool flip_forward, std::vector<match_t>& matches) const {
     findMUM_each(P, min_len, flip_forward, [&](const match_t& m) { matches.push_back(m); });
   }
-
-  //save index to files
+  // Output the MUMs from the MAMs in matches: drop the matches
+  // contained in another one on the reference. matches is sorted, on
+  // the threads of pool if not null.
+  template<typename Output>
+  static void filterMUM_each(std::vector<match_t>& matches, Output out, thread_pool* pool = nullptr);
+
+  // MEMs, MAMs and MUMs of a long query with the threads of pool. The
+  // query is split in windows, matched in parallel with
+  // findMEM_k_window and findMAM_window, and the matches of the windows
+  // are output by the calling thread, in order. For MEMs, each of the
+  // K offset passes of a window is a separate task: with a sparse
+  // suffix array, even a short query is matched in parallel. The
+  // matches are the same, and in the same order, as with
+  // findMEM_each, findMAM_each and findMUM_each. A query shorter than
+  // two min_window is a single window.
+  static const long min_window = 1 << 16;
+  template<typename Output>
+  void findMEM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out, thread_pool& pool,
+                    long max_occ = 0, size_t* skipped = nullptr) const {
+    std::atomic<size_t> total(0);
+    find_windows(Plen, K, pool, out, [&](long from, long to, int k, std::vector<match_t>& ms) {
+        size_t window_skipped = 0;
+        findMEM_k_window(P, Plen, k, from, to, min_len, flip_forward, [&](const match_t& m) { ms.push_back(m); },
+                         max_occ, &window_skipped);
+        total += window_skipped;
+      });
+    if(skipped) *skipped += total;
+  }
+  void MEM(const char* P, size_t Plen, int min_len, bool flip_forward, std::vector<match_t>& matches,
+           thread_pool& pool) const {
+    findMEM_each(P, Plen, min_len, flip_forward, [&](const match_t& m) { matches.push_back(m); }, pool);
+  }
+  template<typename Output>
+  void findMAM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out, thread_pool& pool) const {
+    find_windows(Plen, 1, pool, out, [&](long from, long to, int part, std::vector<match_t>& ms) {
+        findMAM_window(P, Plen, from, to, min_len, flip_forward, [&](const match_t& m) { ms.push_back(m); });
+      });
+  }
+  template<typename Output>
+  void findMUM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out, thread_pool& pool) const {
+    if(K != 1) return;  // Only valid for full suffix array.
+    std::vector<match_t> matches;
+    findMAM_each(P, Plen, min_len, flip_forward, [&](const match_t& m) { matches.push_back(m); }, pool);
+    filterMUM_each(matches, out, &pool);
+  }
+  // Call find(from, to, part, matches) on the windows of [0, Plen),
+  // for each part in [0, parts), in the threads of pool. Then call out
+  // on the matches, part after part and, within a part, window after
+  // window.
+  template<typename Output, typename Find>
+  static void find_windows(size_t Plen, int parts, thread_pool& pool, Output out, Find find);
+
+  //save index to the single file prefix.idx (see index_path). The
+  //second form adds the sections to writer, which must then be closed.
   bool save(const std::string &prefix) const;
-
-  //load index from file
+  bool save(index_writer& writer) const;
+  void save_header(index_header& header) const;
+  //save index to the multiple files prefix.aux, prefix.sa, etc.
+  bool save_legacy(const std::string &prefix) const;
+
+  //load index from file. If prefix.idx exists, it is memory mapped
+  //and the index is used in place. Otherwise, load the multiple
+  //files of the legacy format.
   bool load(const std::string &prefix);
-
-  //construct
-  void construct(bool off48 = false);
+  bool load_legacy(const std::string &prefix);
+  bool load_mapped(const std::string &path);
+  bool load_mapped(const index_reader& index);
+
+  static std::string index_path(const std::string& prefix) { return prefix + ".idx"; }
+
+  //construct. threads is the number of threads used by the suffix
+  //sort of a full suffix array (K == 1), the ISA and the LCP. If
+  //lcp_direct, large LCP values are accessed in constant time (see
+  //vec_uchar).
+  void construct(bool off48 = false, unsigned int threads = 1, bool lcp_direct = false);
+  //construct into the sections of writer, which must then be
+  //closed. The arrays are written through memory mappings of the file
+  //and the ISA and LCP are computed in blocks, each scanning the
+  //suffix array, so that besides the text only about mem bytes are
+  //kept in memory. The suffixes are sorted by partitions of their
+  //first characters, each fitting in mem. The resulting index uses
+  //the mappings and stays valid after the writer is closed.
+  bool construct_external(index_writer& writer, size_t mem, bool off48 = false, unsigned int threads = 1,
+                          bool lcp_direct = false);
 };
 
 // Like the sparseSA, but also know the position of the sub-sequences
@@ -526,6 +827,9 @@ public:
   void MEM(const std::string &P, int min_len, bool flip_forward, std::vector<match_t>& matches) const {
     sparseSA::MEM(P, min_len, flip_forward, matches);
   }
+  void MEM(const std::string &P, int min_len, bool flip_forward, std::vector<match_t>& matches, thread_pool& pool) const {
+    sparseSA::MEM(P.c_str(), P.length(), min_len, flip_forward, matches, pool);
+  }
 
 
   // Print MUMs
@@ -546,11 +850,12 @@ public:
 // Finds maximal almost-unique matches (MAMs) These can repeat in the
 // given query pattern P, but occur uniquely in the indexed reference S.
 template<typename Output>
-void sparseSA::findMAM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out) const {
+void sparseSA::findMAM_window(const char* P, size_t Plen, long from, long to, int min_len, bool flip_forward,
+                              Output out) const {
   interval_t cur(0, N-1, 0);
-  long       prefix  = 0;
+  long       prefix  = from;
 
-  while(prefix < (long)Plen) {
+  while(prefix < to) {
     // Traverse SA top down until mismatch or full string is matched.
     if(hasChild)
       traverse_faster(P, Plen, prefix, cur, Plen);
@@ -578,6 +883,106 @@ void sparseSA::findMAM_each(const char* P, size_t Plen, int min_len, bool flip_f
   //  currentCount = memCount;
 }
 
+template<typename Output>
+void sparseSA::findMAM_batch(const char* const* P, const size_t* Plen, size_t n, int min_len, bool flip_forward,
+                             Output out) const {
+  // Each step of a query is one random access. The steps of the
+  // suffix link loop in findMAM_each are: read SA at the bounds of
+  // the interval, read ISA at the following positions, and expand
+  // the interval with the LCP.
+  enum step_type { TRAVERSE, DESCEND, REPORT_SA, REPORT, LINK_SA, LINK_ISA, EXPAND };
+  struct state_type {
+    size_t        q;
+    interval_t    cur;
+    long          prefix;
+    long          s, e; // Positions in S of the suffix links of the bounds
+    step_type     step;
+    descent_state desc;
+  };
+  auto reset = [&](state_type& st) {
+    st.cur.depth = 0; st.cur.start = 0; st.cur.end = N-1;
+    st.step      = TRAVERSE;
+  };
+  auto link = [&](state_type& st) {
+    SA.prefetch(st.cur.start);
+    SA.prefetch(st.cur.end);
+    st.step = LINK_SA;
+  };
+
+  std::vector<state_type> active;
+  size_t                  next = 0;
+  while(next < n || !active.empty()) {
+    for( ; active.size() < batch_width && next < n; ++next)
+      active.push_back(state_type{ next, interval_t(0, N-1, 0), 0, 0, 0, TRAVERSE, descent_state() });
+
+    for(size_t a = 0; a < active.size(); ) {
+      state_type& st  = active[a];
+      interval_t& cur = st.cur;
+      const char* p   = P[st.q];
+      const long  pl  = Plen[st.q];
+      switch(st.step) {
+      case TRAVERSE:
+        if(st.prefix >= pl) { // Done with this query
+          active[a] = active.back();
+          active.pop_back();
+          continue;
+        }
+        st.desc.step = descent_state::START;
+        st.step      = DESCEND;
+        // fall through
+      case DESCEND:
+        if(!descend(p, pl, st.prefix, cur, pl, st.desc)) break;
+        if(cur.depth <= 1) { reset(st); st.prefix++; break; }
+        if(cur.size() == 1 && cur.depth >= min_len) {
+          SA.prefetch(cur.start);
+          st.step = REPORT_SA;
+        } else {
+          link(st);
+        }
+        break;
+
+      case REPORT_SA:
+        st.s = SA[cur.start];
+        if(st.prefix > 0 && st.s > 0) S.prefetch(st.s - 1);
+        st.step = REPORT;
+        break;
+
+      case REPORT:
+        if(is_leftmaximal(p, st.prefix, st.s))
+          out(st.q, make_match(st.s, !flip_forward ? st.prefix : pl-1-st.prefix, cur.depth, pl));
+        link(st);
+        break;
+
+      case LINK_SA:
+        st.s = SA[cur.start] + 1;
+        st.e = SA[cur.end] + 1;
+        ISA.prefetch(st.s);
+        ISA.prefetch(st.e);
+        st.step = LINK_ISA;
+        break;
+
+      case LINK_ISA:
+        cur.depth = cur.depth-1;
+        cur.start = ISA[st.s];
+        cur.end   = ISA[st.e];
+        st.prefix++;
+        if(cur.depth == 0) { reset(st); break; }
+        LCP.prefetch(cur.start);
+        if(cur.end < NKm1) LCP.prefetch(cur.end + 1);
+        st.step = EXPAND;
+        break;
+
+      case EXPAND:
+        if(!expand_link(cur)) reset(st);
+        else if(cur.size() == 1) link(st);
+        else st.step = TRAVERSE;
+        break;
+      }
+      ++a;
+    }
+  }
+}
+
 // Maximal Unique Match (MUM)
 template<typename Output>
 void sparseSA::findMUM_each(const char* P, size_t Plen, int min_len, bool flip_forward, Output out) const {
@@ -585,17 +990,53 @@ void sparseSA::findMUM_each(const char* P, size_t Plen, int min_len, bool flip_f
   std::vector<match_t> matches;
   MAM(P, Plen, min_len, flip_forward, matches);
   //  memCount=0;
+  filterMUM_each(matches, out);
+}
 
+template<typename Output>
+void sparseSA::findMUM_batch(const char* const* P, const size_t* Plen, size_t n, int min_len, bool flip_forward,
+                             Output out) const {
+  if(K != 1) return;  // Only valid for full suffix array.
+  std::vector<std::vector<match_t>> matches(n);
+  findMAM_batch(P, Plen, n, min_len, flip_forward, [&](size_t q, const match_t& m) { matches[q].push_back(m); });
+  for(size_t q = 0; q < n; ++q)
+    filterMUM_each(matches[q], [&](const match_t& m) { out(q, m); });
+}
+
+template<typename Output>
+void sparseSA::filterMUM_each(std::vector<match_t>& matches, Output out, thread_pool* pool) {
   struct by_ref {
     bool operator() (const match_t &a, const match_t &b) const {
       return (a.ref == b.ref) ? a.len > b.len : a.ref < b.ref;
     }
   };
 
+  // Sort by reference position, longest first. Matches with the same
+  // position and length are all dropped below, so their relative
+  // order does not matter and a stable radix sort on the length then
+  // on the position gives the same output as sorting with by_ref.
+  if(matches.size() < 256) {
+    sort(matches.begin(), matches.end(), by_ref());
+  } else {
+    long max_ref = 0, max_len = 0;
+    for(const auto& m : matches) {
+      max_ref = std::max(max_ref, m.ref);
+      max_len = std::max(max_len, m.len);
+    }
+    std::vector<match_t> tmp(matches.size());
+    auto sort_on = [&](int bits, auto key) {
+      if(pool)
+        parallel_radix_sort(matches.data(), matches.data() + matches.size(), tmp.data(), bits, key, *pool);
+      else
+        radix_sort(matches.data(), matches.data() + matches.size(), tmp.data(), bits, key);
+    };
+    sort_on(radix_bits(max_len), [=](const match_t& m) { return (uint64_t)(max_len - m.len); });
+    sort_on(radix_bits(max_ref), [](const match_t& m) { return (uint64_t)m.ref; });
+  }
+
   // Adapted from Stephan Kurtz's code in cleanMUMcand.c in MUMMer v3.20.
   long currentright, dbright         = 0;
   bool ignorecurrent, ignoreprevious = false;
-  sort(matches.begin(), matches.end(), by_ref());
   for(long i = 0; i < (long)matches.size(); i++) {
     ignorecurrent = false;
     currentright = matches[i].ref + matches[i].len - 1;
@@ -619,19 +1060,51 @@ void sparseSA::findMUM_each(const char* P, size_t Plen, int min_len, bool flip_f
     out(matches.back());
 }
 
+template<typename Output, typename Find>
+void sparseSA::find_windows(size_t Plen, int parts, thread_pool& pool, Output out, Find find) {
+  // A few windows per thread to even out the load
+  const long nb    = std::max((long)1, std::min(4 * (long)pool.size(), (long)Plen / min_window));
+  const long tasks = nb * parts;
+  if(pool.size() < 2 || tasks < 2) {
+    std::vector<match_t> matches;
+    for(int p = 0; p < parts; ++p) {
+      find(0, Plen, p, matches);
+      for(const auto& m : matches)
+        out(m);
+      matches.clear();
+    }
+    return;
+  }
+  // Task t is window t % nb of part t / nb
+  std::vector<std::vector<match_t>> matches(tasks);
+  std::atomic<long>                 next(0);
+  pool.run([&](unsigned int id) {
+      for(long t = next++; t < tasks; t = next++) {
+        const long w = t % nb;
+        find(Plen * w / nb, Plen * (w + 1) / nb, t / nb, matches[t]);
+      }
+    });
+  for(const auto& ms : matches)
+    for(const auto& m : ms)
+      out(m);
+}
+
 // For a given offset in the prefix k, find all MEMs.
 template<typename Output>
-void sparseSA::findMEM_k_each(const char* P, size_t Plen, long k, int min_len, bool flip_forward, Output out) const {
+void sparseSA::findMEM_k_window(const char* P, size_t Plen, long k, long from, long to, int min_len, bool flip_forward,
+                                Output out, long max_occ, size_t* skipped) const {
   if(k < 0 || k >= K) { std::cerr << "Invalid k " << k << " [0, " << K << "]" << std::endl; return; }
-  // Offset all intervals at different start points.
-  long prefix = k;
+  // Offset all intervals at different start points. The first
+  // position in the window with the same offset.
+  const long step   = sparseMult * K;
+  long       prefix = from <= k ? k : k + (from - k + step - 1) / step * step;
   interval_t mli(0,N/K-1,0); // min length interval
   interval_t xmi(0,N/K-1,0); // max match interval
 
   // Right-most match used to terminate search.
   const int min_lenK = min_len - (sparseMult*K-1);
 
-  while( prefix <= (long)Plen - min_lenK) {//BUGFIX: used to be "prefix <= (long)P.length() - (K-k0)"
+  while( prefix < to && prefix <= (long)Plen - min_lenK) {//BUGFIX: used to be "prefix <= (long)P.length() - (K-k0)"
     if(hasChild)
       traverse_faster(P, Plen, prefix, mli, min_lenK);    // Traverse until minimum length matched.
     else
@@ -645,7 +1118,7 @@ void sparseSA::findMEM_k_each(const char* P, size_t Plen, long k, int min_len, b
         traverse_faster(P, Plen, prefix, xmi, Plen); // Traverse until mismatch.
       else
         traverse(P, Plen, prefix, xmi, Plen); // Traverse until mismatch.
-      collectMEMs_each(P, Plen, prefix, mli, xmi, min_len, flip_forward, out); // Using LCP info to find MEM length.
+      collectMEMs_each(P, Plen, prefix, mli, xmi, min_len, flip_forward, out, max_occ, skipped); // Using LCP info to find MEM length.
       // When using ISA/LCP trick, depth = depth - K. prefix += K.
       prefix+=sparseMult*K;
       if( !hasSufLink ){ mli.reset(N/K-1); xmi.reset(N/K-1); continue; }
@@ -683,12 +1156,17 @@ void sparseSA::findMEM_k_each(const char* P, size_t Plen, long k, int min_len, b
 // Use LCP information to locate right maximal matches. Test each for
 // left maximality.
 template<typename Output>
-void sparseSA::collectMEMs_each(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len, bool flip_forward,
-                           Output out) const {
+bool sparseSA::collectMEMs_each(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len, bool flip_forward,
+                                Output out, long max_occ, size_t* skipped) const {
+  // mli contains all the intervals visited below. Cap only if it is
+  // too large.
+  if(max_occ > 0 && mli.size() > max_occ)
+    return collectMEMs_capped(P, Plen, prefix, mli, xmi, min_len, flip_forward, out, max_occ, skipped);
+
   // All of the suffixes in xmi's interval are right maximal.
   for(long i = xmi.start; i <= xmi.end; i++) find_Lmaximal(P, Plen, prefix, SA[i], xmi.depth, min_len, flip_forward, out);
 
-  if(mli.start == xmi.start && mli.end == xmi.end) return;
+  if(mli.start == xmi.start && mli.end == xmi.end) return true;
 
 
   while(xmi.depth >= mli.depth) {
@@ -710,6 +1188,40 @@ void sparseSA::collectMEMs_each(const char* P, size_t Plen, long prefix, interva
       }
     }
   }
+  return true;
+}
+
+// Same as collectMEMs_each, but the bounds of each interval are found
+// before visiting its new suffixes, to stop once larger than max_occ.
+template<typename Output>
+bool sparseSA::collectMEMs_capped(const char* P, size_t Plen, long prefix, interval_t mli, interval_t xmi, int min_len,
+                                  bool flip_forward, Output out, long max_occ, size_t* skipped) const {
+  auto stop = [&]() {
+    if(skipped) ++*skipped;
+    return false;
+  };
+  if(xmi.size() > max_occ) return stop();
+  for(long i = xmi.start; i <= xmi.end; i++) find_Lmaximal(P, Plen, prefix, SA[i], xmi.depth, min_len, flip_forward, out);
+
+  if(mli.start == xmi.start && mli.end == xmi.end) return true;
+
+  while(xmi.depth >= mli.depth) {
+    if(xmi.end+1 < N/K) xmi.depth = std::max(LCP[xmi.start], LCP[xmi.end+1]);
+    else xmi.depth = LCP[xmi.start];
+    if(xmi.depth < mli.depth) break;
+
+    long start = xmi.start, end = xmi.end;
+    while(LCP[start] >= xmi.depth) --start;
+    while(end+1 < N/K && LCP[end+1] >= xmi.depth) ++end;
+    if(end - start + 1 > max_occ) return stop();
+    for(long i = xmi.start - 1; i >= start; --i)
+      find_Lmaximal(P, Plen, prefix, SA[i], xmi.depth, min_len, flip_forward, out);
+    for(long i = xmi.end + 1; i <= end; ++i)
+      find_Lmaximal(P, Plen, prefix, SA[i], xmi.depth, min_len, flip_forward, out);
+    xmi.start = start;
+    xmi.end   = end;
+  }
+  return true;
 }
 
 // Finds left maximal matches given a right maximal match at position i.
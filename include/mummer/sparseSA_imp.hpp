@@ -1,69 +1,65 @@
 #ifndef __SPARSESA_IMP_H__
 #define __SPARSESA_IMP_H__
 
-#undef _OPENMP
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include <mummer/thread_pool.hpp>
 
 // Implementation of some sparseSA functions
 namespace mummer {
 namespace sparseSA_imp {
 
-#ifndef _OPENMP
-template<typename Map, typename Seq, typename Vec>
-void computeLCP(Map& LCP, const Seq& S, const Vec& SA, const Vec& ISA, const long N, const long K) {
+// Kasai et al. on the suffixes [begin, end) (in text order). The LCP
+// value of a suffix is at least the LCP value of the previous suffix
+// minus K, hence the scan starts from h = 0 on each chunk.
+template<typename Map, typename Seq, typename Vec, typename ItemVector>
+void computeLCP_range(Map& LCP, const Seq& S, const Vec& SA, const Vec& ISA, const long N, const long K,
+                      long begin, long end, ItemVector& M) {
   long h = 0;
-  for(long i = 0; i < N / K; ++i) {
+  for(long i = begin; i < end; ++i) {
     const long m = ISA[i];
     if(m > 0) {
       const long bj  = SA[m-1];
       const long bi = i * K;
-      while(bi + h < N && bj + h < N && S[bi + h] == S[bj + h])  ++h;
-      LCP.set(m, h); //LCP[m] = h;
+      h = S.lcp(bi, bj, h, N);
+      LCP.set(m, h, M); //LCP[m] = h;
     } else {
-      LCP.set(m, 0); // LCP[m]=0;
+      LCP.set(m, 0, M); // LCP[m]=0;
     }
     h = std::max(0L, h - K);
   }
-  LCP.init();
 }
 
-#else // _OPENMP
-
 template<typename Map, typename Seq, typename Vec>
 void computeLCP(Map& LCP, const Seq& S, const Vec& SA, const Vec& ISA, const long N, const long K) {
-  //  const long chunk = std::min((long)10000000, (long)(N / omp_get_num_threads()));
-  std::vector<typename Map::item_vector> Ms;
-
-#pragma omp parallel
-  {
-    long                      h = 0;
-    typename Map::item_vector tM; // M array for this thread
-
-#pragma omp for schedule(static)
-    for(long i = 0; i < N / K; ++i) {
-      const long m = ISA[i];
-      if(m > 0) {
-        const long bj  = SA[m-1];
-        const long bi = i * K;
-        while(bi + h < N && bj + h < N && S[bi + h] == S[bj + h])  ++h;
-        LCP.set(m, h, tM); //LCP[m] = h;
-      } else {
-        LCP.set(m, 0); // LCP[m]=0;
-      }
-      h = std::max(0L, h - K);
-    }
+  computeLCP_range(LCP, S, SA, ISA, N, K, 0, N / K, LCP.M);
+  LCP.init();
+}
 
-    std::sort(tM.begin(), tM.end(), Map::first_comp);
-#pragma omp critical
-    Ms.push_back(std::move(tM));
+// Each thread of the pool handles a contiguous range of suffixes and
+// collects its large LCP values in its own vector. These are merged
+// in init_merge, giving the same result as the sequential version.
+template<typename Map, typename Seq, typename Vec>
+void computeLCP(Map& LCP, const Seq& S, const Vec& SA, const Vec& ISA, const long N, const long K,
+                thread_pool& pool) {
+  if(pool.size() == 1) {
+    computeLCP(LCP, S, SA, ISA, N, K);
+    return;
   }
 
+  std::vector<typename Map::item_vector> Ms(pool.size());
+  pool.parallel_for(0, N / K, [&](long begin, long end, unsigned int id) {
+      computeLCP_range(LCP, S, SA, ISA, N, K, begin, end, Ms[id]);
+      std::sort(Ms[id].begin(), Ms[id].end(), Map::first_comp);
+    });
   LCP.init_merge(Ms);
 }
 
-#endif // _OPENMP
+// Compute the inverse of the full suffix array SA.
+template<typename Vec>
+void computeISA(Vec& ISA, const Vec& SA, const long N, thread_pool& pool) {
+  pool.parallel_for(0, N, [&](long begin, long end, unsigned int id) {
+      for(long i = begin; i < end; ++i) ISA[(long)SA[i]] = i;
+    });
+}
 
 } // namespace sparseSA_imp
 } // namespace mummer
@@ -0,0 +1,109 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+namespace mummer {
+
+// A fixed set of threads running parallel loops. The thread calling
+// run() or parallel_for() participates as thread 0 and the call
+// returns once every thread is done. A pool of size 1 has no extra
+// thread and runs everything in the calling thread.
+class thread_pool {
+  std::vector<std::thread>           m_threads;
+  std::mutex                         m_mutex;
+  std::condition_variable            m_start_cond, m_done_cond;
+  std::function<void(unsigned int)>  m_job;
+  unsigned long                      m_generation;
+  unsigned int                       m_running;
+  bool                               m_stop;
+
+public:
+  explicit thread_pool(unsigned int threads = std::thread::hardware_concurrency())
+    : m_generation(0)
+    , m_running(0)
+    , m_stop(false)
+  {
+    for(unsigned int i = 1; i < std::max(1u, threads); ++i)
+      m_threads.push_back(std::thread(&thread_pool::worker, this, i));
+  }
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_start_cond.notify_all();
+    for(auto& th : m_threads)
+      th.join();
+  }
+
+  unsigned int size() const { return m_threads.size() + 1; }
+
+  // Run f(id) on every thread of the pool, id in [0, size()).
+  template<typename F>
+  void run(F f) {
+    if(m_threads.empty()) {
+      f(0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_job     = f;
+      m_running = m_threads.size();
+      ++m_generation;
+    }
+    m_start_cond.notify_all();
+    f(0);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cond.wait(lock, [&]() { return m_running == 0; });
+    m_job = nullptr;
+  }
+
+  // Split [begin, end) in size() contiguous chunks of nearly equal
+  // size and call f(chunk_begin, chunk_end, id) on each. The chunks
+  // are in the order of the thread ids.
+  template<typename F>
+  void parallel_for(long begin, long end, F f) {
+    const long n = end - begin;
+    if(n <= 0) return;
+    const unsigned int nb = size();
+    run([&](unsigned int id) {
+        const long b = begin + n * id / nb;
+        const long e = begin + n * (id + 1) / nb;
+        if(b < e) f(b, e, id);
+      });
+  }
+
+private:
+  void worker(unsigned int id) {
+    unsigned long generation = 0;
+    while(true) {
+      std::function<void(unsigned int)> job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_start_cond.wait(lock, [&]() { return m_stop || m_generation != generation; });
+        if(m_stop) return;
+        generation = m_generation;
+        job        = m_job;
+      }
+      job(id);
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_running == 0)
+          m_done_cond.notify_one();
+      }
+    }
+  }
+};
+
+} // namespace mummer
+
+#endif /* __THREAD_POOL_H__ */
@@ -4,6 +4,8 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <algorithm>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -87,6 +89,13 @@ void query_thread(const mummer::mummer::sparseSAMatch* sa, sequence_parser* pars
                   thread_pipe::ostream_buffered* printer) {
   auto       output_it = printer->begin();
   match_info match;
+  // With a sparse suffix array, the K passes of MEM are run in
+  // parallel. The num_threads threads are split between the query
+  // threads rather than started by each of them.
+  std::unique_ptr<mummer::thread_pool> pool;
+  const int pool_threads = std::max(1, num_threads / query_threads);
+  if(type == MEM && sa->K > 1 && pool_threads > 1)
+    pool.reset(new mummer::thread_pool(pool_threads));
 
   while(true) {
     // Get a job (a batch of sequences)
@@ -131,7 +140,10 @@ void query_thread(const mummer::mummer::sparseSAMatch* sa, sequence_parser* pars
         switch(type) {
         case MAM: sa->MAM(P, min_len, false, match.fwd_matches); break;
         case MUM: sa->MUM(P, min_len, false, match.fwd_matches); break;
-        case MEM: sa->MEM(P, min_len, false, match.fwd_matches); break;
+        case MEM:
+          if(pool) sa->MEM(P, min_len, false, match.fwd_matches, *pool);
+          else sa->MEM(P, min_len, false, match.fwd_matches);
+          break;
         }
       }
       if(rev_comp) {
@@ -140,7 +152,10 @@ void query_thread(const mummer::mummer::sparseSAMatch* sa, sequence_parser* pars
         switch(type) {
         case MAM: sa->MAM(P, min_len, printRevCompForw, match.bwd_matches); break;
         case MUM: sa->MUM(P, min_len, printRevCompForw, match.bwd_matches); break;
-        case MEM: sa->MEM(P, min_len, printRevCompForw, match.bwd_matches); break;
+        case MEM:
+          if(pool) sa->MEM(P, min_len, printRevCompForw, match.bwd_matches, *pool);
+          else sa->MEM(P, min_len, printRevCompForw, match.bwd_matches);
+          break;
         }
       }
       print_match_info(*output_it, match, sa);
@@ -273,13 +288,15 @@ int main(int argc, char* argv[]) {
       }
   }
   if(automaticKmer){
-      kmer = std::max(0,std::min(10,min_len - sparseMult*K + 1));
+      kmer = mummer::mummer::sparseSA::auto_kmer_size(ref.size(), K, min_len, sparseMult);
   }
   else{
-      if(kmer > 12)
-          std::cerr << "warning: very large value for kmer-size: index will be very large" << std::endl;
+      if(kmer > mummer::mummer::kmer_table::max_k){
+          kmer = mummer::mummer::kmer_table::max_k;
+          std::cerr << "kmer size was reduced to " << kmer << ", the largest supported value" << std::endl;
+      }
       if(kmer > min_len - sparseMult*K + 1){
-          kmer = std::max(0,std::min(10,min_len - sparseMult*K + 1));
+          kmer = mummer::mummer::sparseSA::auto_kmer_size(ref.size(), K, min_len, sparseMult);
         std::cerr << "kmer size was reduced to " << kmer << " because the user set value is too large and cannotbe used in the algorithm" << std::endl;
       }
   }
@@ -328,11 +345,11 @@ int main(int argc, char* argv[]) {
       else{
           std::cerr << "unable to load index " << load << '\n'
                     << "construct new index..." << std::endl;
-          sa->construct();
+          sa->construct(false, num_threads);
       }
   }
   else{
-      sa->construct();
+      sa->construct(false, num_threads);
   }
   if(!save.empty()){
       sa->save(save);
@@ -376,19 +393,19 @@ void usage(std::string prog) {
             << '\n'
             << "Additional options:" << '\n'
             << "-k             sampled suffix positions (one by default)" << '\n'
-            << "-threads       number of threads to use for -maxmatch, only valid k > 1 " << '\n'
+            << "-threads       number of threads to use for index construction and, split between the query threads, for -maxmatch (k > 1)" << '\n'
             << "-qthreads      number of threads to use for queries " << '\n'
             << "-suflink       use suffix links (1=yes or 0=no) in the index and during search [auto]" << '\n'
             << "-child         use child table (1=yes or 0=no) in the index and during search [auto]" << '\n'
             << "-skip          sparsify the MEM-finding algorithm even more, performing jumps of skip*k [auto (l-10)/k]" << '\n'
             << "               this is a performance parameter that trade-offs SA traversal with checking of right-maximal MEMs" << '\n'
-            << "-kmer          use kmer table containing sa-intervals (speeds up searching first k characters) in the index and during search [int value, auto]" << '\n'
+            << "-kmer          use kmer table containing sa-intervals (speeds up searching first k characters, k <= 16) in the index and during search [int value, auto]" << '\n'
             << "-save (string) save index to file to use again later (string)" << '\n'
             << "-load (string) load index from file" << '\n'
             << '\n'
             << "Example usage:" << '\n'
             << '\n'
-            << "./mummer -maxmatch -l 20 -b -n -k 3 -threads 3 ref.fa query.fa" << '\n'
+            << "./mummer -maxmatch -l 20 -b -n -k 3 -threads 3 -qthreads 1 ref.fa query.fa" << '\n'
             << "Find all maximal matches on forward and reverse strands" << '\n'
             << "of length 20 or greater, matching only a, c, t, or g." << '\n'
             << "Index every 3rd position in the ref.fa and use 3 threads to find MEMs." << '\n'
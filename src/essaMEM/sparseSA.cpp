@@ -7,7 +7,9 @@
 #include <string.h>
 #include <fstream>
 #include <iomanip>
+#include <numeric>
 #include <stdexcept>
+#include <unistd.h>
 
 #include <mummer/sparseSA.hpp>
 #include <mummer/sparseSA_imp.hpp>
@@ -17,9 +19,6 @@
 namespace mummer {
 namespace mummer {
 
-// LS suffix sorter (integer alphabet).
-extern "C" { void suffixsort(int *x, int *p, int n, int k, int l); };
-
 // Get maximum query sequence description length.
 static size_t max_len(const std::vector<std::string>& descr) {
   size_t res = 0;
@@ -49,7 +48,21 @@ sparseSA::sparseSA(bounded_string&& S_,
 { }
 
 sparseSA sparseSA::create_auto(const char* S, size_t Slen, int min_len, bool nucleotidesOnly_, int K,
-                               bool off48) {
+                               bool off48, unsigned int threads, bool lcp_direct) {
+  sparseSA res = auto_params(S, Slen, min_len, nucleotidesOnly_, K);
+  res.construct(off48, threads, lcp_direct);
+  return res;
+}
+
+sparseSA sparseSA::create_auto_external(index_writer& writer, size_t mem, const char* S, size_t Slen, int min_len,
+                                        bool nucleotidesOnly_, int K, bool off48, unsigned int threads, bool lcp_direct) {
+  sparseSA res = auto_params(S, Slen, min_len, nucleotidesOnly_, K);
+  if(!res.construct_external(writer, mem, off48, threads, lcp_direct))
+    throw std::runtime_error("Failed to build the index on disk");
+  return res;
+}
+
+sparseSA sparseSA::auto_params(const char* S, size_t Slen, int min_len, bool nucleotidesOnly_, int K) {
   const bool suflink    = K < 4;
   const bool child      = K >= 4;
   int        sparseMult = 1;
@@ -58,11 +71,19 @@ sparseSA sparseSA::create_auto(const char* S, size_t Slen, int min_len, bool nuc
       ? (int) std::max((min_len-10)/K,1)
       : (int) std::max((min_len-12)/K,1);
   }
-  const int kmer = std::max(0,std::min(10,min_len - sparseMult*K + 1));
-  sparseSA res(S, Slen, true /* 4column */, K, suflink, child, kmer>0, sparseMult,
-               kmer, nucleotidesOnly_);
-  res.construct(off48);
-  return res;
+  const int kmer = auto_kmer_size(Slen, K, min_len, sparseMult);
+  return sparseSA(S, Slen, true /* 4column */, K, suflink, child, kmer>0, sparseMult,
+                  kmer, nucleotidesOnly_);
+}
+
+int sparseSA::auto_kmer_size(size_t N, long K, int min_len, int sparseMult) {
+  // Only the k-mers present are stored, about 24 bytes each. Go
+  // deeper than 10 as long as the table has at most one entry every
+  // 16 suffixes.
+  int kmax = 10;
+  while(kmax < kmer_table::max_k && ((size_t)16 << (2 * (kmax + 1))) <= N / K)
+    ++kmax;
+  return std::max(0, std::min(kmax, (int)(min_len - sparseMult * K + 1)));
 }
 
 long sparseSA::index_size_in_bytes() const {
@@ -94,14 +115,27 @@ long sparseSA::index_size_in_bytes() const {
 // suffix arrays and inverse sparse suffix arrays.
 void sparseSA::computeLCP() {
   TIME_FUNCTION;
-  sparseSA_imp::computeLCP(LCP, S, SA, ISA, N, K);
+  if(SA.is_small)
+    sparseSA_imp::computeLCP(LCP, S, SA.small, ISA.small, N, K);
+  else
+    sparseSA_imp::computeLCP(LCP, S, SA.large, ISA.large, N, K);
+}
+
+void sparseSA::computeLCP(thread_pool& pool) {
+  TIME_FUNCTION;
+  if(SA.is_small)
+    sparseSA_imp::computeLCP(LCP, S, SA.small, ISA.small, N, K, pool);
+  else
+    sparseSA_imp::computeLCP(LCP, S, SA.large, ISA.large, N, K, pool);
 }
 
 // Child array construction algorithm
-void sparseSA::computeChild() {
+void sparseSA::computeChild(size_t window, const std::function<void()>& release) {
   //  TIME_FUNCTION;
+  auto progress = [&](int i) { if(window && release && i % window == 0) release(); };
 
   for(int i = 0; i < N/K; i++){
+    progress(i);
     CHILD[i] = -1;
   }
         //Compute up and down values
@@ -109,6 +143,7 @@ void sparseSA::computeChild() {
         std::stack<int,std::vector<int> > stapelUD;
         stapelUD.push(0);
         for(int i = 1; i < N/K; i++){
+            progress(i);
             while(LCP[i] < LCP[stapelUD.top()]){
                 lastIndex = stapelUD.top();
                 stapelUD.pop();
@@ -134,6 +169,7 @@ void sparseSA::computeChild() {
         std::stack<int,std::vector<int> > stapelNL;
         stapelNL.push(0);
         for(int i = 1; i < N/K; i++){
+            progress(i);
             while(LCP[i] < LCP[stapelNL.top()])
                 stapelNL.pop();
             lastIndex = stapelNL.top();
@@ -145,102 +181,71 @@ void sparseSA::computeChild() {
         }
 }
 
-// Look-up table construction algorithm
-void sparseSA::computeKmer() {
+// Look-up table construction algorithm. The interval of a k-mer is a
+// maximal run of suffixes with LCP >= kMerSize. The SA is split in
+// chunks, each thread encoding the runs starting in its chunk. The
+// k-mers are in SA order, hence sorted by code, as only the lower
+// case nucleotides (as loaded by mummer and nucmer) are put in the
+// table.
+void sparseSA::computeKmer(thread_pool& pool, size_t window, const std::function<void()>& release) {
   TIME_FUNCTION;
+  typedef kmer_table::entry entry;
+  const long                      n = N / K;
+  const long                      w = window ? window : std::max(n, 1L);
+  std::vector<std::vector<entry>> parts(pool.size());
+  std::vector<entry>              entries;
+
+  for(long wb = 0; wb < n; wb += w) {
+  pool.parallel_for(wb, std::min(n, wb + w), [&](long b, long e, unsigned int id) {
+      auto& part = parts[id];
+      long  i    = b;
+      while(i > 0 && i < e && LCP[i] >= kMerSize) ++i; // Run started in previous chunk
+      while(i < e) {
+        long j = i + 1;
+        while(j < n && LCP[j] >= kMerSize) ++j;
+        const long pos  = SA[i];
+        uint32_t   code = 0;
+        long       l    = 0;
+        for( ; l < kMerSize; ++l) {
+          const unsigned char c = S[pos + l];
+          if(c != 'a' && c != 'c' && c != 'g' && c != 't') break;
+          code = (code << 2) | BITADD[c];
+        }
+        if(l == kMerSize)
+          part.push_back(entry(code, i, j - 1));
+        i = j;
+      }
+    });
 
-    std::stack<interval_t> intervalStack;
-    std::stack<unsigned int> indexStack;
-
-    interval_t curInterval(0,N/K-1,0);
-    unsigned int curIndex = 0;
-    unsigned int newIndex = 0;
-
-    intervalStack.push(interval_t(0,N/K-1,0));
-    indexStack.push(curIndex);
+  // The chunks of the threads are in SA order
+  size_t total = entries.size();
+  for(const auto& part : parts) total += part.size();
+  entries.reserve(total);
+  for(auto& part : parts) {
+    entries.insert(entries.end(), part.begin(), part.end());
+    std::vector<entry>().swap(part);
+  }
+  if(release) release();
+  }
+  KMR.init(std::move(entries), kMerSize);
+}
 
-    while(!intervalStack.empty()){
-        curInterval = intervalStack.top(); intervalStack.pop();
-        curIndex = indexStack.top(); indexStack.pop();
-        if(curInterval.depth == kMerSize){
-            if(curIndex < kMerTableSize){
-                KMR[curIndex].left = curInterval.start;
-                KMR[curIndex].right = curInterval.end;
-            }
-        }
-        else{
-            if(hasChild){//similar to function traverse_faster
-                //walk up to depth KMERSIZE or new child
-                long curLCP; //max LCP of this interval
-                if (curInterval.start == curInterval.end)
-                    curLCP = N - SA[curInterval.start];
-                else if (curInterval.start < CHILD[curInterval.end] && CHILD[curInterval.end] <= curInterval.end)
-                    curLCP = LCP[CHILD[curInterval.end]];
-                else
-                    curLCP = LCP[CHILD[curInterval.start]];
-                long minimum = std::min(curLCP,kMerSize);
-                newIndex = curIndex;
-                while(curInterval.depth < (long) minimum){
-                    unsigned int character = S[SA[curInterval.start]+curInterval.depth];
-                    newIndex = (newIndex << 2) | BITADD[character];
-                    curInterval.depth ++;
-                }
-                if(curInterval.depth == kMerSize){//reached KMERSIZE in the middle of an edge
-                    if(newIndex < kMerTableSize){
-                        KMR[newIndex].left = curInterval.start;
-                        KMR[newIndex].right = curInterval.end;
-                    }
-                }
-                else{//find child intervals
-                    long left = curInterval.start;
-                    long right = CHILD[curInterval.end];
-                    curIndex = newIndex;
-                    if(curInterval.start >= right || right > curInterval.end)
-                        right = CHILD[curInterval.start];
-                    //now left and right point to first child
-                    newIndex = (curIndex << 2) | BITADD[(int)S[SA[left]+curInterval.depth]];
-                    if(newIndex < kMerTableSize){
-                        intervalStack.push(interval_t(left,right-1,curInterval.depth+1));
-                        indexStack.push(newIndex);
-                    }
-                    left = right;
-                    //while has next L-index
-                    while(CHILD[right] > right && LCP[right] == LCP[CHILD[right]]){
-                        right = CHILD[right];
-                        newIndex = (curIndex << 2) | BITADD[(int)S[SA[left]+curInterval.depth]];
-                        if(newIndex < kMerTableSize){
-                            intervalStack.push(interval_t(left,right-1,curInterval.depth+1));
-                            indexStack.push(newIndex);
-                        }
-                        left = right;
-                    }
-                    //last interval
-                    newIndex = (curIndex << 2) | BITADD[(int)S[SA[left]+curInterval.depth]];
-                    if(newIndex < kMerTableSize){
-                        intervalStack.push(interval_t(left,curInterval.end,curInterval.depth+1));
-                        indexStack.push(newIndex);
-                    }
-                }
-            }
-            else{//similar to function traverse
-                long start = curInterval.start; long end = curInterval.end;
-
-                while(start <= curInterval.end){
-                    unsigned int character = S[SA[start]+curInterval.depth];
-                    newIndex = (curIndex << 2) | BITADD[character];
-                    start = curInterval.start;
-                    end = curInterval.end;
-                    top_down_faster(character, curInterval.depth, start, end);
-                    if(newIndex < kMerTableSize){
-                        intervalStack.push(interval_t(start,end,curInterval.depth+1));
-                        indexStack.push(newIndex);
-                    }
-                    // Advance to next interval.
-                    start = end+1; end = curInterval.end;
-                }
-            }
+void sparseSA::computeSample(thread_pool& pool, size_t window, const std::function<void()>& release) {
+  typedef sa_sample::entry entry;
+  const long         n = (N / K + sa_sample::step - 1) / sa_sample::step;
+  const long         w = window ? std::max(1L, (long)window / sa_sample::step) : std::max(n, 1L);
+  std::vector<entry> entries(n);
+  for(long wb = 0; wb < n; wb += w) {
+    pool.parallel_for(wb, std::min(n, wb + w), [&](long b, long e, unsigned int id) {
+        for(long j = b; j < e; ++j) {
+          const long pos = SA[j * sa_sample::step];
+          for(long i = 0; i < sa_sample::width; ++i)
+            entries[j].c[i] = S[pos + i];
         }
-    }
+      });
+    if(release) release();
+  }
+  SAMPLE.entries = std::move(entries);
 }
 
 bool vector_32_48::save(std::ostream&& os) const {
@@ -303,12 +308,7 @@ bool sparseSA_aux::load(std::istream&& is) {
 }
 
 void vec_uchar::init() {
-#ifdef _OPENMP
-  openmp_qsort(M.begin(), M.end(), first_comp);
-  assert(std::is_sorted(M.begin(), M.end(), first_comp));
-#else
-  sort(M.begin(), M.end(), first_comp);
-#endif
+  std::sort(M.begin(), M.end(), first_comp);
 
   // Second, remove elements that are consecutive in a range
   size_t pidx = 0;
@@ -322,12 +322,7 @@ void vec_uchar::init() {
   M.resize(nend - M.begin());
   M.shrink_to_fit();
   // Third, sort by beginning of compacted ranges
-#ifdef _OPENMP
-  openmp_qsort(M.begin(), M.end());
-  assert(std::is_sorted(M.begin(), M.end()));
-#else
-  sort(M.begin(), M.end());
-#endif
+  std::sort(M.begin(), M.end());
 }
 
 void vec_uchar::init_merge(const std::vector<item_vector>& Ms) {
@@ -366,7 +361,31 @@ void vec_uchar::init_merge(const std::vector<item_vector>& Ms) {
   openmp_qsort(M.begin(), M.end());
 }
 
+void vec_uchar::init_direct(thread_pool& pool) {
+  const size_t          nb_blocks = vec.size() / block_size + 1;
+  std::vector<uint64_t> r(nb_blocks + 1, 0);
+  auto                  block_end = [&](size_t b) { return std::min(vec.size(), (b + 1) * block_size); };
+
+  // Count the large values in each block, then prefix sum
+  pool.parallel_for(0, nb_blocks, [&](long b, long e, unsigned int id) {
+      for(long i = b; i < e; ++i)
+        r[i + 1] = std::count(vec.begin() + i * block_size, vec.begin() + block_end(i), (small_type)max);
+    });
+  std::partial_sum(r.begin(), r.end(), r.begin());
+
+  std::vector<large_type> l(r.back());
+  pool.parallel_for(0, nb_blocks, [&](long b, long e, unsigned int id) {
+      size_t pos = r[b];
+      for(size_t i = b * block_size; i < block_end(e - 1); ++i)
+        if(vec[i] == max) l[pos++] = lookup(i);
+    });
+  ranks = std::move(r);
+  large = std::move(l);
+  M.clear();
+}
+
 bool vec_uchar::save(std::ostream&& os) const {
+  if(!ranks.empty()) return false; // The legacy format only has M
   const size_t sizeLCP = vec.size();
   const size_t sizeM   = M.size();
   os.write((const char*)&sizeLCP, sizeof(sizeLCP));
@@ -389,7 +408,130 @@ bool vec_uchar::load(std::istream&& is) {
 }
 
 
+// Sections of the single file index (see index_file.hpp). The 48 bit
+// large arrays are written as their 32 bit part followed by their 16
+// bit part.
+namespace {
+void write_section(index_writer& writer, index_section_id id, const vector_32_48& v) {
+  if(v.is_small)
+    writer.write(id, v.small);
+  else
+    writer.write(id, v.large.m_base32, v.size(), v.size() * (sizeof(uint32_t) + sizeof(uint16_t)));
+}
+
+bool map_section(const index_reader& index, index_section_id id, vector_32_48& v) {
+  v.is_small = index.header().sa_small;
+  if(v.is_small)
+    return index.section(id, v.small);
+  const char* ptr = index.section(id, sizeof(uint32_t) + sizeof(uint16_t));
+  if(!ptr) return false;
+  v.large     = fortyeight_index<int64_t>((const uint32_t*)ptr, index.header().sections[id].count);
+  v.large_map = index.map();
+  return true;
+}
+} // namespace
+
+void sparseSA::save_header(index_header& header) const {
+  header.N               = N;
+  header.K               = K;
+  header.logN            = logN;
+  header.NKm1            = NKm1;
+  header.kMerSize        = kMerSize;
+  header.kMerTableSize   = hasKmer ? kMerTableSize : 0;
+  header.sparseMult      = sparseMult;
+  header._4column        = _4column;
+  header.hasSufLink      = hasSufLink;
+  header.hasChild        = hasChild;
+  header.hasKmer         = hasKmer;
+  header.nucleotidesOnly = nucleotidesOnly;
+  header.sa_small        = SA.is_small;
+  header.text_length     = S.al_;
+  header.text_checksum   = index_checksum(S.s_, S.al_);
+}
+
+bool sparseSA::save(index_writer& writer) const {
+  save_header(writer.header);
+  write_section(writer, SA_SECTION, SA);
+  writer.write(LCP_SECTION, LCP.vec);
+  if(LCP.ranks.empty()) {
+    writer.write(LCP_M_SECTION, LCP.M);
+  } else {
+    writer.write(LCP_RANKS_SECTION, LCP.ranks);
+    writer.write(LCP_LARGE_SECTION, LCP.large);
+  }
+  if(hasSufLink) write_section(writer, ISA_SECTION, ISA);
+  if(hasChild) writer.write(CHILD_SECTION, CHILD);
+  if(hasKmer) {
+    writer.write(KMR_SECTION, KMR.entries);
+    writer.write(KMR_DIR_SECTION, KMR.directory);
+  }
+  if(!SAMPLE.empty()) writer.write(SAMPLE_SECTION, SAMPLE.entries);
+  writer.write_string(TEXT_SECTION, S.s_, S.al_);
+  return true;
+}
+
 bool sparseSA::save(const std::string &prefix) const {
+  index_writer writer(index_path(prefix));
+  return save(writer) && writer.close();
+}
+
+bool sparseSA::load_mapped(const index_reader& index) {
+  if(!index.good()) return false;
+  const index_header& header = index.header();
+
+  N               = header.N;
+  K               = header.K;
+  logN            = header.logN;
+  NKm1            = header.NKm1;
+  kMerSize        = header.kMerSize;
+  kMerTableSize   = header.kMerTableSize;
+  sparseMult      = header.sparseMult;
+  _4column        = header._4column;
+  hasSufLink      = header.hasSufLink;
+  hasChild        = header.hasChild;
+  hasKmer         = header.hasKmer;
+  nucleotidesOnly = header.nucleotidesOnly;
+
+  if(!map_section(index, SA_SECTION, SA)) return false;
+  LCP.sa = &SA;
+  if(!index.section(LCP_SECTION, LCP.vec)) return false;
+  if(index.has(LCP_RANKS_SECTION)) {
+    if(!index.section(LCP_RANKS_SECTION, LCP.ranks) || !index.section(LCP_LARGE_SECTION, LCP.large))
+      return false;
+  } else if(!index.section(LCP_M_SECTION, LCP.M)) {
+    return false;
+  }
+  if(hasSufLink && !map_section(index, ISA_SECTION, ISA)) return false;
+  if(hasChild && !index.section(CHILD_SECTION, CHILD)) return false;
+  if(hasKmer) {
+    if(!index.section(KMR_SECTION, KMR.entries) || !index.section(KMR_DIR_SECTION, KMR.directory))
+      return false;
+    KMR.k = kMerSize;
+  }
+  if(index.has(SAMPLE_SECTION) && !index.section(SAMPLE_SECTION, SAMPLE.entries)) return false;
+  return true;
+}
+
+bool sparseSA::load_mapped(const std::string &path) {
+  const index_reader index(path);
+  if(!index.good()) return false;
+  // Check that the index was built from the text S
+  if(S.al_ != index.text_length() || index_checksum(S.s_, S.al_) != index.header().text_checksum)
+    return false;
+  return load_mapped(index);
+}
+
+bool sparseSA::load(const std::string &prefix) {
+  const std::string path = index_path(prefix);
+  if(access(path.c_str(), F_OK) == 0)
+    return load_mapped(path);
+  return load_legacy(prefix);
+}
+
+bool sparseSA::save_legacy(const std::string &prefix) const {
+  // The legacy k-mer table is dense, with 32 bits bounds
+  if(hasKmer && (kMerSize > 12 || N / K > std::numeric_limits<unsigned int>::max()))
+    return false;
   //print auxiliary information
   if(!sparseSA_aux::save(prefix + ".aux"))
     return false;
@@ -409,17 +551,20 @@ bool sparseSA::save(const std::string &prefix) const {
     if(!child_s.good()) return false;
   }
   if(hasKmer){ //print kmer if nec
+    std::vector<saTuple_t> dense(kMerTableSize);
+    for(const auto& e : KMR.entries)
+      dense[e.code] = saTuple_t(e.start(), e.end());
     const std::string kmer = prefix + ".kmer";
     std::ofstream kmer_s (kmer.c_str(), std::ios::binary);
-    unsigned int sizeKMR = KMR.size();
+    unsigned int sizeKMR = dense.size();
     kmer_s.write((const char*)&sizeKMR,sizeof(sizeKMR));
-    kmer_s.write((const char*)&KMR[0],sizeKMR*sizeof(saTuple_t));
+    kmer_s.write((const char*)dense.data(),sizeKMR*sizeof(saTuple_t));
     if(!kmer_s.good()) return false;
   }
   return true;
 }
 
-bool sparseSA::load(const std::string &prefix) {
+bool sparseSA::load_legacy(const std::string &prefix) {
   // Load auxiliary infomation
   if(!sparseSA_aux::load(prefix + ".aux"))
     return false;
@@ -446,62 +591,159 @@ bool sparseSA::load(const std::string &prefix) {
     std::ifstream     kmer_s (kmer.c_str(), std::ios::binary);
     unsigned int      sizeKMR;
     kmer_s.read((char*)&sizeKMR,sizeof(sizeKMR));
-    KMR.resize(sizeKMR);
+    std::vector<saTuple_t> dense(sizeKMR);
     kMerTableSize = sizeKMR;
-    kmer_s.read((char*)&KMR[0],sizeKMR*sizeof(saTuple_t));
+    kmer_s.read((char*)dense.data(),sizeKMR*sizeof(saTuple_t));
     if(!kmer_s.good()) return false;
+    std::vector<kmer_table::entry> entries;
+    for(size_t i = 0; i < dense.size(); ++i)
+      if(dense[i].right > 0)
+        entries.push_back(kmer_table::entry(i, dense[i].left, dense[i].right));
+    KMR.init(std::move(entries), kMerSize);
+  }
+  if(!hasChild) { // The sample is not saved in the legacy format
+    thread_pool pool(1);
+    computeSample(pool);
   }
 
   return true;
 }
 
-void sparseSA::construct(bool off48){
+// Implements a variant of American flag sort (McIlroy radix sort).
+// Recurse until big-K size prefixes are sorted. Adapted from the C++
+// source code for the wordSA implementation from the following paper:
+// Ferragina and Fischer. Suffix Arrays on Words. CPM 2007.
+//
+// SA contains indices of sampled suffixes (i.e. position / K). On
+// return, SA[l..r] is sorted by the first K characters and the
+// transformed text is stored in ISA: the name of each K-gram is the
+// last index of its bucket in SA. The buckets of size more than one
+// are appended to groups.
+template<typename Vec>
+static void radixStep(const bounded_string& S, const long K, Vec& SA, Vec& ISA,
+                      std::vector<std::pair<long, long>>& groups, long l, long r, long h) {
+  // first pass: count
+  std::vector<long> Sigma(256, 0); // Sigma counts occurring characters in bucket
+  std::vector<long> BucketBegin(256);
+  for(long i = l; i <= r; i++) Sigma[(unsigned char)S[(long)SA[i]*K + h]]++; // count characters
+  BucketBegin[0] = l; for(long i = 1; i < 256; i++) { BucketBegin[i] = Sigma[i-1] + BucketBegin[i-1]; } // accumulate
+
+  // second pass: move (this variant does *not* need an additional array!)
+  unsigned int currentKey = 0;  // character of current bucket
+  long end = l-1+Sigma[currentKey]; // end of current bucket
+  long pos = l;                     // 'pos' is current position in bucket
+  while(true) {
+    if(pos > end) { // Reached the end of the bucket.
+      if(currentKey == 255) break; // Last character?
+      currentKey++; // Advance to next characer.
+      pos = BucketBegin[currentKey]; // Next bucket start.
+      end += Sigma[currentKey]; // Next bucket end.
+    } else {
+      // American flag sort of McIlroy et al. 1993. BucketBegin keeps
+      // track of current position where to add to bucket set.
+      const long          val = SA[pos];
+      const unsigned char c   = S[val*K + h];
+      SA[pos]                 = (long)SA[BucketBegin[c]]; // Save value at bucket beginning.
+      SA[BucketBegin[c]++]    = val; // Move bucket beginning to the right, and replace
+      if((unsigned char)S[(long)SA[pos]*K + h] == currentKey) pos++; // Advance to next position if the right character.
+    }
+  }
+  // recursively refine buckets and calculate new text:
+  long beg = l; end = l-1;
+  for(long i = 0; i < 256; i++) { // step through Sigma to find bucket borders
+    end += Sigma[i];
+    if(beg <= end) {
+      if(h == K-1) {
+        for(long j = beg; j <= end; j++)
+          ISA[(long)SA[j]] = end; // set new text
+        if(beg < end) groups.push_back(std::make_pair(beg, end));
+      } else {
+        radixStep(S, K, SA, ISA, groups, beg, end, h+1); // recursive refinement
+      }
+      beg = end + 1; // advance to next bucket
+    }
+  }
+}
+
+// Suffix sort of the transformed text by prefix doubling, in the
+// manner of Larsson and Sadakane: only the groups not yet sorted are
+// sorted again, using the names of the suffixes h positions
+// further. The names are the last index of the group in SA. On
+// return, SA is the suffix array of the transformed text and ISA its
+// inverse.
+template<typename Vec>
+static void doublingSort(Vec& SA, Vec& ISA, const long n, std::vector<std::pair<long, long>>& groups) {
+  std::vector<std::pair<long, long>> next;
+  std::vector<std::pair<long, long>> keys; // (name h positions further, suffix)
+  auto key_comp = [](const std::pair<long, long>& a, const std::pair<long, long>& b) { return a.first < b.first; };
+
+  for(long h = 1; !groups.empty(); h *= 2) {
+    next.clear();
+    for(const auto& g : groups) {
+      keys.clear();
+      for(long j = g.first; j <= g.second; ++j) {
+        const long s = SA[j];
+        keys.push_back(std::make_pair(s + h < n ? (long)ISA[s + h] : -1, s));
+      }
+      std::sort(keys.begin(), keys.end(), key_comp);
+      for(long j = g.first; j <= g.second; ++j)
+        SA[j] = keys[j - g.first].second;
+      // Name sub-groups
+      for(long j = g.first; j <= g.second; ) {
+        long e = j;
+        while(e < g.second && keys[e + 1 - g.first].first == keys[j - g.first].first) ++e;
+        for(long i = j; i <= e; ++i)
+          ISA[(long)SA[i]] = e;
+        if(j < e) next.push_back(std::make_pair(j, e));
+        j = e + 1;
+      }
+    }
+    groups.swap(next);
+  }
+}
+
+// Construct the sparse suffix array (suffixes at positions multiple
+// of K) and its inverse. The inverse is indexed by position / K.
+template<typename Vec>
+static void sparseSuffixSort(const bounded_string& S, const long K, const long n, Vec& SA, Vec& ISA) {
+  std::vector<std::pair<long, long>> groups;
+  for(long i = 0; i < n; ++i) SA[i] = i; // Init SA.
+  radixStep(S, K, SA, ISA, groups, 0, n - 1, 0); // start radix sort
+  doublingSort(SA, ISA, n, groups);
+  for(long i = 0; i < n; ++i) SA[i] = (long)SA[i] * K; // Translate suffix array.
+}
+
+void sparseSA::construct(bool off48, unsigned int threads, bool lcp_direct){
   //  TIME_FUNCTION;
+    thread_pool pool(threads);
 
     if(K > 1) {
-        // long bucketNr = 1;
-        // int *intSA = new int[N/K+1];
-        // for(int i = 0; i < N/K; i++) intSA[i] = i; // Init SA.
-        // int* t_new = new int[N/K+1];
-        // long* BucketBegin = new long[256]; // array to save current bucket beginnings
-        // radixStep(t_new, intSA, bucketNr, BucketBegin, 0, N/K-1, 0); // start radix sort
-        // t_new[N/K] = 0; // Terminate new integer string.
-        // delete[] BucketBegin;
-
-        throw "Not supported yet";
-        // Suffix sort integer text.
-        // std::cerr << "# suffixsort()" << std::endl;
-        // suffixsort(t_new, intSA, N/K, bucketNr, 0);
-        // std::cerr << "# DONE suffixsort()" << std::endl;
-
-        // delete[] t_new;
-
-        // // Translate suffix array.
-        // SA.resize(N/K);
-        // for (long i=0; i<N/K; i++) SA[i] = (unsigned int)intSA[i+1] * K;
-        // delete[] intSA;
-
-        // // Build ISA using sparse SA.
-        // ISA.resize(N/K);
-        // for(long i = 0; i < N/K; i++) { ISA[SA[i]/K] = i; }
+      // Sparse suffix array. The last sampled suffix is made only of
+      // '$' and is the smallest.
+      SA.resize(N/K, off48);
+      ISA.resize(N/K, off48);
+      if(SA.is_small)
+        sparseSuffixSort(S, K, N/K, SA.small, ISA.small);
+      else
+        sparseSuffixSort(S, K, N/K, SA.large, ISA.large);
     }
     else {
       SA.resize(N, off48);
       ISA.resize(N, off48);
       if(SA.is_small) {
-        compactsufsort::create((const unsigned char*)(S + 0), (int*)SA.small.data(), N);
-//#pragma omp parallel for
-        for(long i = 0; i < N; ++i) { ISA.small[SA.small[i]] = i; }
+        compactsufsort::create((const unsigned char*)(S + 0), (int*)SA.small.data(), N, threads);
+        sparseSA_imp::computeISA(ISA.small, SA.small, N, pool);
       } else {
-        compactsufsort::create((const unsigned char*)(S + 0), SA.large.begin(), N);
-//#pragma omp parallel for
-        for(long i = 0; i < N; ++i) { ISA.large[SA.large[i]] = i; }
+        compactsufsort::create((const unsigned char*)(S + 0), SA.large.begin(), N, threads);
+        sparseSA_imp::computeISA(ISA.large, SA.large, N, pool);
       }
     }
 
     LCP.resize(N/K);
     // Use algorithm by Kasai et al to construct LCP array.
-    computeLCP();  // SA + ISA -> LCP
+    computeLCP(pool);  // SA + ISA -> LCP
+    if(lcp_direct)
+      LCP.init_direct(pool);
     if(!hasSufLink){
       //ISA.clear(); // TODO: clear in vector32_48
     }
@@ -511,71 +753,413 @@ void sparseSA::construct(bool off48){
         computeChild();
     }
     if(hasKmer){
-        kMerTableSize = 1 << (2*kMerSize);
-        // std::cerr << "kmer table size: " << kMerTableSize << std::endl;
-        KMR.resize(kMerTableSize, saTuple_t());
-        //Use algorithm by Abouelhoda et al to construct CHILD array
-        computeKmer();
+        if(kMerSize > kmer_table::max_k)
+          throw std::runtime_error("K-mer table size is limited to " + std::to_string(kmer_table::max_k));
+        kMerTableSize = 1L << (2*kMerSize);
+        computeKmer(pool);
     }
+    if(!hasChild)
+      computeSample(pool);
 
     //    NKm1 = N/K-1;
 
 }
 
-// Implements a variant of American flag sort (McIlroy radix sort).
-// Recurse until big-K size prefixes are sorted. Adapted from the C++
-// source code for the wordSA implementation from the following paper:
-// Ferragina and Fischer. Suffix Arrays on Words. CPM 2007.
-// void sparseSA::radixStep(int *t_new, int *SA, long &bucketNr, long *BucketBegin, long l, long r, long h) {
-//   if(h >= K) return;
-//   // first pass: count
-//   std::vector<long> Sigma(256, 0); // Sigma counts occurring characters in bucket
-//   for (long i = l; i <= r; i++) Sigma[ S[ SA[i]*K + h ] ]++; // count characters
-//   BucketBegin[0] = l; for (long i = 1; i < 256; i++) { BucketBegin[i] = Sigma[i-1] + BucketBegin[i-1]; } // accumulate
-
-//   // second pass: move (this variant does *not* need an additional array!)
-//   unsigned char currentKey = 0;    // character of current bucket
-//   long end = l-1+Sigma[currentKey]; // end of current bucket
-//   long pos = l;                     // 'pos' is current position in bucket
-//   while (1) {
-//     if (pos > end) { // Reached the end of the bucket.
-//       if (currentKey == 255) break; // Last character?
-//       currentKey++; // Advance to next characer.
-//       pos = BucketBegin[currentKey]; // Next bucket start.
-//       end += Sigma[currentKey]; // Next bucket end.
-//     }
-//     else {
-//       // American flag sort of McIlroy et al. 1993. BucketBegin keeps
-//       // track of current position where to add to bucket set.
-//       int tmp = SA[ BucketBegin[(int) S[ SA[pos]*K + h ] ] ];
-//       SA[ BucketBegin[(int) S[ SA[pos]*K + h] ]++ ] = SA[pos];  // Move bucket beginning to the right, and replace
-//       SA[ pos ] = tmp; // Save value at bucket beginning.
-//       if (S[ SA[pos]*K + h ] == currentKey) pos++; // Advance to next position if the right character.
-//     }
-//   }
-//   // recursively refine buckets and calculate new text:
-//   long beg = l; end = l-1;
-//   for (long i = 1; i < 256; i++) { // step through Sigma to find bucket borders
-//     end += Sigma[i];
-//     if (beg <= end) {
-//       if(h == K-1) {
-// 	for (long j = beg; j <= end; j++) {
-// 	  t_new[ SA[j] ] = bucketNr; // set new text
-// 	}
-// 	bucketNr++;
-//       }
-//       else {
-// 	radixStep(t_new, SA, bucketNr, BucketBegin, beg, end, h+1); // recursive refinement
-//       }
-//       beg = end + 1; // advance to next bucket
-//     }
-//   }
-// }
+namespace {
+// Reserve the section id of writer for a suffix array like vector v
+// of n entries, and make v a view on its mapping. Return the mapping,
+// or nullptr on failure.
+std::shared_ptr<const mapped_file> map_reserved(index_writer& writer, index_section_id id, size_t n, bool small,
+                                                vector_32_48& v) {
+  writer.reserve(id, n, n * (small ? sizeof(uint32_t) : sizeof(uint32_t) + sizeof(uint16_t)));
+  auto map = writer.map_section(id);
+  if(!map->good()) return nullptr;
+  v.is_small = small;
+  if(small) {
+    v.small = mapped_vector<int>(map, (const int*)map->base(), n);
+  } else {
+    v.large     = fortyeight_index<int64_t>((const uint32_t*)map->base(), n);
+    v.large_map = map;
+  }
+  return map;
+}
+
+// Drop from memory the entries [b, e) of SA, a view on map.
+void evict_sa(const vector_32_48& SA, const mapped_file& map, size_t b, size_t e) {
+  map.evict(b * sizeof(uint32_t), (e - b) * sizeof(uint32_t));
+  if(!SA.is_small)
+    map.evict(SA.size() * sizeof(uint32_t) + b * sizeof(uint16_t), (e - b) * sizeof(uint16_t));
+}
+
+// Call f(i, SA[i]) for all i, the suffix array being read in windows
+// of w entries, dropped from memory once used, then done(b, e) after
+// the window [b, e).
+template<typename F, typename Done>
+void scan_sa(const vector_32_48& SA, const mapped_file& map, size_t w, thread_pool& pool, F f, Done done) {
+  const size_t n = SA.size();
+  for(size_t b = 0; b < n; b += w) {
+    const size_t e = std::min(n, b + w);
+    pool.parallel_for(b, e, [&](size_t begin, size_t end, unsigned int id) {
+        for(size_t i = begin; i < end; ++i) f(i, SA[i]);
+      });
+    evict_sa(SA, map, b, e);
+    done(b, e);
+  }
+}
+template<typename F>
+void scan_sa(const vector_32_48& SA, const mapped_file& map, size_t w, thread_pool& pool, F f) {
+  scan_sa(SA, map, w, pool, f, [](size_t b, size_t e) { });
+}
+
+// Order of the suffixes of S[0, N), compared as unsigned characters,
+// a suffix being smaller than its extensions. The characters are
+// ranked from 1, 0 marking the end of the text, and the first
+// characters of a suffix are packed in integer codes ordered as the
+// suffixes.
+class suffix_order {
+  const bounded_string& m_S;
+  const size_t          m_N;
+  uint16_t              m_rank[256];
+  uint64_t              m_base; // Number of ranks, end included
+  int                   m_len;  // Length of a prefix code
+  uint64_t              m_top;  // m_base^(m_len - 1)
+
+public:
+  static const int key_len = 7; // Characters in a key, 9 bits each
+
+  // The prefix codes are as long as possible with at most max_codes
+  // codes.
+  suffix_order(const bounded_string& S, size_t N, uint64_t max_codes)
+    : m_S(S)
+    , m_N(N)
+  {
+    bool present[256] = { false };
+    for(size_t i = 0; i < N; ++i)
+      present[(unsigned char)S[i]] = true;
+    m_base = 1;
+    for(int c = 0; c < 256; ++c)
+      m_rank[c] = present[c] ? m_base++ : 0;
+    m_len = 1;
+    m_top = 1;
+    while(m_top * m_base * m_base <= max_codes) {
+      m_top *= m_base;
+      ++m_len;
+    }
+  }
+
+  uint64_t codes() const { return m_top * m_base; }
+  unsigned int rank(size_t i) const { return i < m_N ? m_rank[(unsigned char)m_S[i]] : 0; }
+
+  // Code of the first m_len characters of suffix i
+  uint64_t code(size_t i) const {
+    uint64_t c = 0;
+    for(int k = 0; k < m_len; ++k)
+      c = c * m_base + rank(i + k);
+    return c;
+  }
+
+  // Call f(i, code(i)) for the positions i in [b, e) multiple of K
+  template<typename F>
+  void each(size_t b, size_t e, long K, F f) const {
+    if(b >= e) return;
+    uint64_t c = code(b);
+    for(size_t i = b; ; ) {
+      if(i % K == 0) f(i, c);
+      if(++i >= e) break;
+      c = (c - rank(i - 1) * m_top) * m_base + rank(i - 1 + m_len);
+    }
+  }
+
+  // Key of the first key_len characters of suffix i
+  uint64_t key(size_t i) const {
+    uint64_t k = 0;
+    for(int j = 0; j < key_len; ++j)
+      k = (k << 9) | rank(i + j);
+    return k;
+  }
+
+  // Compare suffixes a and b, of equal keys ka and kb
+  typedef std::pair<uint64_t, long> entry; // (key, suffix)
+  bool operator()(const entry& a, const entry& b) const {
+    if(a.first != b.first) return a.first < b.first;
+    if(a.second == b.second) return false;
+    // Equal keys of different suffixes: no end among the first
+    // key_len characters.
+    const long h = m_S.lcp(a.second, b.second, key_len, m_N);
+    if(a.second + h >= (long)m_N) return true;
+    if(b.second + h >= (long)m_N) return false;
+    return (unsigned char)m_S[a.second + h] < (unsigned char)m_S[b.second + h];
+  }
+};
+
+inline void set_sa(vector_32_48& SA, size_t i, long x) {
+  if(SA.is_small) SA.small[i] = x;
+  else SA.large[i] = x;
+}
+
+// Sort the suffixes at the positions of S[0, N) multiple of K into SA,
+// a view on the writable mapping sa_map, with at most cap suffixes in
+// memory. The suffixes are split by their first characters in
+// partitions of at most cap suffixes. One scan of the text writes the
+// positions of each partition, unsorted, to its range of SA, through
+// buffers of cap positions in total. Each range is then sorted in
+// memory and written back. A prefix shared by more than cap suffixes
+// makes a partition by itself, sorted in runs of cap suffixes in the
+// file tmp_path, which are then merged.
+bool external_suffix_sort(const bounded_string& S, size_t N, long K, vector_32_48& SA, const mapped_file& sa_map,
+                          size_t cap, const std::string& tmp_path, thread_pool& pool) {
+  typedef suffix_order::entry entry;
+  const suffix_order order(S, N, std::min((uint64_t)cap, (uint64_t)1 << 22));
+  const uint64_t     codes = order.codes();
+  std::vector<size_t> count(codes, 0);
+  order.each(0, N, K, [&](size_t i, uint64_t c) { ++count[c]; });
+
+  // Partition p is made of the codes [bounds[p], bounds[p+1]) and
+  // goes to SA[starts[p], starts[p+1]). count[c] becomes the
+  // partition of code c.
+  std::vector<uint64_t> bounds(1, 0);
+  std::vector<size_t>   starts(1, 0);
+  for(uint64_t first = 0; first < codes; ) {
+    uint64_t last = first;
+    size_t   size = 0;
+    while(last < codes && (last == first || size + count[last] <= cap))
+      size += count[last++];
+    for(uint64_t c = first; c < last; ++c)
+      count[c] = bounds.size() - 1;
+    bounds.push_back(last);
+    starts.push_back(starts.back() + size);
+    first = last;
+  }
+  if(starts.back() != SA.size()) return false;
+
+  {
+    const size_t        parts = starts.size() - 1;
+    const size_t        width = std::max((size_t)1, cap / parts); // Buffer of each partition
+    std::vector<long>   buffer(parts * width);
+    std::vector<size_t> fill(parts, 0), next(starts.begin(), starts.end() - 1);
+    size_t              written = 0;
+    auto flush = [&](size_t p) {
+      for(size_t j = 0; j < fill[p]; ++j)
+        set_sa(SA, next[p]++, buffer[p * width + j]);
+      written += fill[p];
+      fill[p]  = 0;
+      if(written >= cap) {
+        evict_sa(SA, sa_map, 0, SA.size());
+        written = 0;
+      }
+    };
+    order.each(0, N, K, [&](size_t i, uint64_t c) {
+        const size_t p = count[c];
+        buffer[p * width + fill[p]++] = i;
+        if(fill[p] == width) flush(p);
+      });
+    for(size_t p = 0; p < parts; ++p)
+      flush(p);
+    evict_sa(SA, sa_map, 0, SA.size());
+  }
+  std::vector<size_t>().swap(count);
+
+  std::vector<entry> part;
+  for(size_t p = 0; p + 1 < starts.size(); ++p) {
+    const size_t out  = starts[p];
+    const size_t size = starts[p + 1] - out;
+    if(size == 0) continue;
+
+    if(size <= cap) {
+      part.resize(size);
+      pool.parallel_for(0, size, [&](size_t b, size_t e, unsigned int id) {
+          for(size_t i = b; i < e; ++i) part[i] = entry(order.key(SA[out + i]), SA[out + i]);
+        });
+      sample_sort(part.begin(), part.end(), order, pool);
+      pool.parallel_for(0, size, [&](size_t b, size_t e, unsigned int id) {
+          for(size_t i = b; i < e; ++i) set_sa(SA, out + i, part[i].second);
+        });
+    } else {
+      // Sorted runs of cap suffixes in the temporary file, merged
+      // into SA
+      std::ofstream(tmp_path, std::ios::binary);
+      const mapped_file tmp(tmp_path.c_str(), 0, size * sizeof(long));
+      unlink(tmp_path.c_str());
+      if(!tmp.good()) return false;
+      long* runs = (long*)tmp.base();
+      for(size_t b = 0; b < size; b += cap) {
+        const size_t e = std::min(size, b + cap);
+        part.resize(e - b);
+        for(size_t i = b; i < e; ++i)
+          part[i - b] = entry(order.key(SA[out + i]), SA[out + i]);
+        sample_sort(part.begin(), part.end(), order, pool);
+        for(size_t i = b; i < e; ++i)
+          runs[i] = part[i - b].second;
+        tmp.evict();
+        evict_sa(SA, sa_map, out + b, out + e);
+      }
+      std::vector<entry>().swap(part);
+
+      const size_t        nb_runs = (size + cap - 1) / cap;
+      std::vector<size_t> next(nb_runs);
+      typedef std::pair<entry, size_t> head_type; // (suffix, run)
+      auto greater = [&](const head_type& a, const head_type& b) { return order(b.first, a.first); };
+      std::vector<head_type> heap;
+      for(size_t r = 0; r < nb_runs; ++r) {
+        next[r] = r * cap;
+        heap.push_back(head_type(entry(order.key(runs[next[r]]), runs[next[r]]), r));
+      }
+      std::make_heap(heap.begin(), heap.end(), greater);
+      for(size_t i = 0; i < size; ++i) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        const size_t r = heap.back().second;
+        set_sa(SA, out + i, heap.back().first.second);
+        if(++next[r] < std::min(size, (r + 1) * cap)) {
+          heap.back() = head_type(entry(order.key(runs[next[r]]), runs[next[r]]), r);
+          std::push_heap(heap.begin(), heap.end(), greater);
+        } else {
+          heap.pop_back();
+        }
+        if((i + 1) % cap == 0) {
+          tmp.evict();
+          evict_sa(SA, sa_map, out, out + i + 1);
+        }
+      }
+    }
+    evict_sa(SA, sa_map, out, out + size);
+  }
+  return true;
+}
+} // namespace
+
+bool sparseSA::construct_external(index_writer& writer, size_t mem, bool off48, unsigned int threads, bool lcp_direct) {
+  if(hasKmer && kMerSize > kmer_table::max_k)
+    throw std::runtime_error("K-mer table size is limited to " + std::to_string(kmer_table::max_k));
+  thread_pool  pool(threads);
+  const size_t n     = N / K;
+  const bool   small = !off48 && n < ((size_t)1 << 31);
+  // The text stays in memory. A block of the LCP construction uses 9
+  // bytes per suffix: its Φ entry and the byte of its LCP value. The
+  // windows of the arrays scanned, of the size of a block, use up to 7
+  // more. A suffix being sorted uses 46 bytes: its key and position,
+  // twice, its bucket in the sample sort and its entry in the suffix
+  // array.
+  const size_t avail = mem > (size_t)N ? mem - N : 0;
+  const size_t block = std::max((size_t)4096, avail / 16);
+  const size_t cap   = std::max((size_t)4096, avail / 46);
+
+  // Suffix array, sorted by partitions written in order in the file
+  const auto sa_map = map_reserved(writer, SA_SECTION, n, small, SA);
+  if(!sa_map) return false;
+  if(!external_suffix_sort(S, N, K, SA, *sa_map, cap, writer.path() + ".sort", pool))
+    return false;
+
+  // Inverse suffix array, one block of entries at a time
+  if(hasSufLink) {
+    const auto isa_map = map_reserved(writer, ISA_SECTION, n, small, ISA);
+    if(!isa_map) return false;
+    for(size_t b = 0; b < n; b += block) {
+      const size_t e = std::min(n, b + block);
+      scan_sa(SA, *sa_map, block, pool, [&](size_t i, long p) {
+          const size_t j = p / K;
+          if(j < b || j >= e) return;
+          if(ISA.is_small) ISA.small[j] = i;
+          else ISA.large[j] = i;
+        });
+      isa_map->evict();
+    }
+  }
+
+  // LCP array by the Φ algorithm: for each block of suffixes in text
+  // order, Φ gives the preceding suffix in SA order, from which the
+  // permuted LCP is computed as in Kasai et al. Each thread restarts
+  // with h = 0 at the beginning of its range.
+  writer.reserve(LCP_SECTION, n, n);
+  auto lcp_map = writer.map_section(LCP_SECTION);
+  if(!lcp_map->good()) return false;
+  LCP.sa  = &SA;
+  LCP.vec = mapped_vector<vec_uchar::small_type>(lcp_map, (const vec_uchar::small_type*)lcp_map->base(), n);
+  {
+    std::vector<vec_uchar::item_vector> Ms(pool.size());
+    std::vector<long>                   phi(std::min(n, block));
+    std::vector<vec_uchar::small_type>  plcp(phi.size());
+    for(size_t b = 0; b < n; b += block) {
+      const size_t e = std::min(n, b + block);
+      scan_sa(SA, *sa_map, block, pool, [&](size_t i, long p) {
+          const size_t j = p / K;
+          if(j >= b && j < e) phi[j - b] = i > 0 ? SA[i - 1] : -1;
+        });
+      pool.parallel_for(b, e, [&](size_t begin, size_t end, unsigned int id) {
+          long h = 0;
+          for(size_t j = begin; j < end; ++j) {
+            const long pj = phi[j - b];
+            if(pj < 0) {
+              h = 0;
+            } else {
+              h = S.lcp(j * K, pj, h, N);
+            }
+            if(h < vec_uchar::max) {
+              plcp[j - b] = h;
+            } else {
+              plcp[j - b] = vec_uchar::max;
+              Ms[id].push_back(vec_uchar::item_t(j * K, h));
+            }
+            h = std::max(0L, h - K);
+          }
+        });
+      scan_sa(SA, *sa_map, block, pool, [&](size_t i, long p) {
+          const size_t j = p / K;
+          if(j >= b && j < e) LCP.vec[i] = plcp[j - b];
+        }, [&](size_t wb, size_t we) { lcp_map->evict(wb, we - wb); });
+    }
+    pool.parallel_for(0, Ms.size(), [&](size_t begin, size_t end, unsigned int id) {
+        for(size_t i = begin; i < end; ++i)
+          std::sort(Ms[i].begin(), Ms[i].end(), vec_uchar::first_comp);
+      });
+    LCP.init_merge(Ms);
+  }
+  if(lcp_direct)
+    LCP.init_direct(pool);
+
+  // The remaining passes read the arrays mostly in order: their pages
+  // are dropped after each block.
+  std::shared_ptr<const mapped_file> child_map;
+  auto release = [&]() {
+    sa_map->evict();
+    lcp_map->evict();
+    if(child_map) child_map->evict();
+  };
+  if(hasChild) {
+    writer.reserve(CHILD_SECTION, n, n * sizeof(int));
+    child_map = writer.map_section(CHILD_SECTION);
+    if(!child_map->good()) return false;
+    CHILD = mapped_vector<int>(child_map, (const int*)child_map->base(), n);
+    computeChild(block, release);
+  }
+  if(hasKmer) {
+    kMerTableSize = 1L << (2*kMerSize);
+    computeKmer(pool, block, release);
+  }
+  if(!hasChild)
+    computeSample(pool, block, release);
+  release();
+
+  save_header(writer.header);
+  if(LCP.ranks.empty()) {
+    writer.write(LCP_M_SECTION, LCP.M);
+  } else {
+    writer.write(LCP_RANKS_SECTION, LCP.ranks);
+    writer.write(LCP_LARGE_SECTION, LCP.large);
+  }
+  if(hasKmer) {
+    writer.write(KMR_SECTION, KMR.entries);
+    writer.write(KMR_DIR_SECTION, KMR.directory);
+  }
+  if(!SAMPLE.empty()) writer.write(SAMPLE_SECTION, SAMPLE.entries);
+  writer.write_string(TEXT_SECTION, S.s_, S.al_);
+  return true;
+}
 
 // Binary search for left boundry of interval.
 long sparseSA::bsearch_left(char c, long i, long s, long e) const {
   if(c == S[SA[s]+i]) return s;
   long l = s, r = e;
+  SAMPLE.narrow(i, l, r, [c](char x) { return c <= x; });
   while (r - l > 1) {
     long m = (l+r) / 2;
     if (c <= S[SA[m] + i]) r = m;
@@ -588,6 +1172,7 @@ long sparseSA::bsearch_left(char c, long i, long s, long e) const {
 long sparseSA::bsearch_right(char c, long i, long s, long e) const {
   if(c == S[SA[e]+i]) return e;
   long l = s, r = e;
+  SAMPLE.narrow(i, l, r, [c](char x) { return c < x; });
   while (r - l > 1) {
     long m = (l+r) / 2
 ;
@@ -623,26 +1208,49 @@ bool sparseSA::search(const char* P, size_t Plen, long &start, long &end) const
 }
 
 
+int64_t sparseSA::kmer_code(const char* P, long prefix) const {
+  int64_t code  = 0;
+  bool    lower = true;
+  for(long i = 0; i < kMerSize; i++) {
+    const unsigned char c = P[prefix + i];
+    if(BITADD[c] > 3) return -1;
+    lower = lower && c >= 'a';
+    code  = (code << 2) | BITADD[c];
+  }
+  return lower ? code : -2;
+}
+
+bool sparseSA::kmer_find(int64_t code, interval_t &cur) const {
+  long start, end;
+  if(!KMR.find(code, start, end)) return false;
+  cur.depth = kMerSize;
+  cur.start = start;
+  cur.end   = end;
+  return true;
+}
+
+bool sparseSA::kmer_jump(const char* P, long prefix, interval_t &cur) const {
+  const int64_t code = kmer_code(P, prefix);
+  if(code == -1)
+    return !nucleotidesOnly; //this results in no found seeds where the first KMERSIZE bases contain a non-ACGT character
+  if(code == -2) return true; // Only lower case k-mers are in the table, search normally
+  return kmer_find(code, cur);
+}
+
 // Traverse pattern P starting from a given prefix and interval
 // until mismatch or min_len characters reached.
 void sparseSA::traverse(const char* P, size_t Plen, long prefix, interval_t &cur, int min_len) const {
   if(hasKmer && cur.depth == 0 && min_len >= kMerSize){//free match first bases
     if((size_t)(prefix + kMerSize) > Plen) return;
-    unsigned int index = 0;
-    for(long i = 0; i < kMerSize; i++) {
-      index = (index << 2 ) | BITADD[(int)P[prefix + i]];
-    }
-    if(index < kMerTableSize && KMR[index].right>0){
-      cur.depth = kMerSize;
-      cur.start = KMR[index].left;
-      cur.end = KMR[index].right;
-    }
-    else if(index < kMerTableSize || nucleotidesOnly){
-      return;//this results in no found seeds where the first KMERSIZE bases contain a non-ACGT character
-    }
+    if(!kmer_jump(P, prefix, cur)) return;
   }
   if(cur.depth >= min_len) return;
   while(prefix+cur.depth < (long)Plen) {
+    if(cur.start == cur.end) { // Single suffix left: extend the match directly
+      const long len = std::min((long)Plen - prefix - cur.depth, (long)min_len - cur.depth);
+      cur.depth += S.match(SA[cur.start] + cur.depth, P + prefix + cur.depth, len);
+      return;
+    }
     long start = cur.start; long end = cur.end;
     // If we reach a mismatch, stop.
     if(top_down_faster(P[prefix+cur.depth], cur.depth, start, end) == false) return;
@@ -655,22 +1263,171 @@ void sparseSA::traverse(const char* P, size_t Plen, long prefix, interval_t &cur
   }
 }
 
+// Same as traverse, with top_down_faster unrolled into the steps of
+// its binary searches. A step that reads S or the bounds of the
+// interval in SA uses the entry prefetched by the previous step. The
+// middle entries of the binary searches are read from SA without
+// yielding: after narrowing with the sample, they are close to each
+// other and mostly in cache.
+bool sparseSA::descend(const char* P, long Plen, long prefix, interval_t &cur, long min_len, descent_state &d) const {
+  typedef descent_state ds;
+  while(true) {
+    switch(d.step) {
+    case ds::START:
+      if(hasChild) {
+        traverse_faster(P, Plen, prefix, cur, min_len);
+        return true;
+      }
+      d.lo = d.hi = -1;
+      if(hasKmer && cur.depth == 0 && min_len >= kMerSize) { //free match first bases
+        if(prefix + kMerSize > Plen) return true;
+        d.code = kmer_code(P, prefix);
+        if(d.code == -1 && nucleotidesOnly) return true;
+        if(d.code >= 0) {
+          KMR.prefetch(d.code);
+          d.step = ds::KMER_DIR;
+          return false;
+        }
+      }
+      if(cur.depth >= min_len) return true;
+      d.step = ds::LOOP;
+      continue;
+
+    case ds::KMER_DIR:
+      KMR.prefetch_entries(d.code);
+      d.step = ds::KMER;
+      return false;
+
+    case ds::KMER:
+      if(!kmer_find(d.code, cur) || cur.depth >= min_len) return true;
+      d.step = ds::LOOP;
+      continue;
+
+    case ds::LOOP:
+      if(prefix + cur.depth >= Plen) return true;
+      d.c = P[prefix + cur.depth];
+      d.i = cur.depth;
+      if(cur.start == d.lo && cur.end == d.hi) {
+        // Same bounds as the previous character: the next characters
+        // of their suffixes are most likely in cache.
+        d.step = cur.start == cur.end ? ds::LEAF : ds::BOUNDS;
+        continue;
+      }
+      SA.prefetch(cur.start);
+      SA.prefetch(cur.end);
+      d.step = ds::BOUNDS_SA;
+      return false;
+
+    case ds::BOUNDS_SA:
+      d.lo    = cur.start;
+      d.hi    = cur.end;
+      d.sa_lo = SA[d.lo];
+      d.sa_hi = SA[d.hi];
+      S.prefetch(d.sa_lo + d.i);
+      S.prefetch(d.sa_hi + d.i);
+      d.step = cur.start == cur.end ? ds::LEAF : ds::BOUNDS;
+      return false;
+
+    case ds::LEAF: { // Single suffix left: extend the match directly
+      const long len = std::min(Plen - prefix - cur.depth, min_len - cur.depth);
+      cur.depth += S.match(d.sa_lo + cur.depth, P + prefix + cur.depth, len);
+      return true;
+    }
+
+    case ds::BOUNDS: {
+      d.cmp_first = (long)d.c - (long)S[d.sa_lo + d.i];
+      d.cmp_last  = (long)d.c - (long)S[d.sa_hi + d.i];
+      if(d.cmp_first < 0 || d.cmp_last > 0) return true; // Mismatch
+      d.l     = cur.start; d.r  = cur.end;
+      d.l2    = cur.start; d.r2 = cur.end;
+      d.found = d.cmp_first == 0;
+      if(d.found) {
+        d.step = ds::RIGHT_INIT;
+        continue;
+      }
+      const char c = d.c;
+      if(SAMPLE.narrow(d.i, d.l, d.r, [c](char x) { return c <= x; }) && c == SAMPLE.at(d.r, d.i)) {
+        d.found = true;
+        d.l2    = d.r;
+      }
+      d.step = ds::LEFT_NEXT;
+      continue;
+    }
+
+    case ds::LEFT_NEXT: // Search for left border
+      if(d.r - d.l > 1) {
+        d.m    = (d.l + d.r) / 2;
+        d.pos  = SA[d.m] + d.i;
+        S.prefetch(d.pos);
+        d.step = ds::LEFT;
+        return false;
+      }
+      d.l    = d.r;
+      d.step = ds::RIGHT_INIT;
+      continue;
+
+    case ds::LEFT: {
+      const long vgl = (long)d.c - (long)S[d.pos];
+      if(vgl <= 0) {
+        if(!d.found && vgl == 0) {
+          d.found = true;
+          d.l2 = d.m; d.r2 = d.r;
+        }
+        d.r = d.m;
+      } else {
+        d.l = d.m;
+      }
+      d.step = ds::LEFT_NEXT;
+      continue;
+    }
+
+    case ds::RIGHT_INIT: { // Search for right border in [l2, r2]
+      if(!d.found) d.l2 = d.l - 1;
+      if(d.cmp_last == 0) {
+        d.l2   = cur.end;
+        d.step = ds::FINISH;
+        continue;
+      }
+      const char c = d.c;
+      SAMPLE.narrow(d.i, d.l2, d.r2, [c](char x) { return c < x; });
+      d.step = ds::RIGHT_NEXT;
+      continue;
+    }
+
+    case ds::RIGHT_NEXT:
+      if(d.r2 - d.l2 > 1) {
+        d.m    = (d.l2 + d.r2) / 2;
+        d.pos  = SA[d.m] + d.i;
+        S.prefetch(d.pos);
+        d.step = ds::RIGHT;
+        return false;
+      }
+      d.step = ds::FINISH;
+      continue;
+
+    case ds::RIGHT:
+      if((long)d.c - (long)S[d.pos] < 0) d.r2 = d.m;
+      else d.l2 = d.m;
+      d.step = ds::RIGHT_NEXT;
+      continue;
+
+    case ds::FINISH:
+      if(d.l > d.l2) return true; // Mismatch
+      // Advance to next interval, unless min_len is reached.
+      cur.depth += 1; cur.start = d.l; cur.end = d.l2;
+      if(cur.depth == min_len) return true;
+      d.step = ds::LOOP;
+      continue;
+    }
+  }
+}
+
 // Traverse pattern P starting from a given prefix and interval
 // until mismatch or min_len characters reached.
 // Uses the child table for faster traversal
 void sparseSA::traverse_faster(const char* P, size_t Plen, const long prefix, interval_t &cur, int min_len) const {
   if(hasKmer && cur.depth == 0 && min_len >= kMerSize){//free match first bases
-    unsigned int index = 0;
-    for(long i = 0; i < kMerSize; i++)
-      index = (index << 2 ) | BITADD[(int)P[prefix + i]];
-    if(index < kMerTableSize && KMR[index].right>0){
-      cur.depth = kMerSize;
-      cur.start = KMR[index].left;
-      cur.end = KMR[index].right;
-    }
-    else if(index < kMerTableSize || nucleotidesOnly){
-      return;//this results in no found seeds where the first KMERSIZE bases contain a non-ACGT character
-    }
+    if(!kmer_jump(P, prefix, cur)) return;
   }
   if(cur.depth >= min_len) return;
   long c = prefix + cur.depth;
@@ -699,21 +1456,21 @@ void sparseSA::traverse_faster(const char* P, size_t Plen, const long prefix, in
         childLCP = LCP[CHILD[cur.start]];
       int minimum = std::min(childLCP,min_len);
       //match along branch
-      while(!mismatchFound && (size_t)c < Plen && cur.depth < minimum){
-        mismatchFound = S[SA[cur.start]+cur.depth] != P[c];
-        c++;
-        cur.depth += !mismatchFound;
-      }
+      const long len = std::min((long)Plen - c, (long)minimum - cur.depth);
+      const long m   = S.match(SA[cur.start] + cur.depth, P + c, len);
+      c += m; cur.depth += m;
+      if(m < len) { mismatchFound = true; c++; }
       intervalFound = (size_t)c < Plen && !mismatchFound &&
                                   cur.depth < min_len && top_down_child(P[c], cur);
     }
     else{
-      while(!mismatchFound && (size_t)c < Plen && cur.depth < min_len){
-        mismatchFound = (size_t)(SA[cur.start]+cur.depth) >= S.length() ||
-                                          S[SA[cur.start]+cur.depth] != P[c];
-        c++;
-        cur.depth += !mismatchFound;
-      }
+      //match along leaf, up to the end of the text
+      const long pos  = SA[cur.start] + cur.depth;
+      const long len  = std::min((long)Plen - c, (long)min_len - cur.depth);
+      const long slen = std::max(0L, std::min(len, (long)S.length() - pos));
+      const long m    = S.match(pos, P + c, slen);
+      c += m; cur.depth += m;
+      if(m < len) { mismatchFound = true; c++; }
     }
   }
 }
@@ -771,6 +1528,10 @@ bool sparseSA::top_down_faster(char c, long i, long &start, long &end) const {
       found = true; r2 = r;
     }
     else {
+      if(SAMPLE.narrow(i, l, r, [c](char x) { return c <= x; }) && c == SAMPLE.at(r, i)) {
+        found = true;
+        l2 = r; // search interval for right border
+      }
       while (r - l > 1) {
 	m = (l+r) / 2;
 	vgl = (long)c - (long)S[SA[m] + i];
@@ -793,6 +1554,7 @@ bool sparseSA::top_down_faster(char c, long i, long &start, long &end) const {
       l2 = end; // right border is the end of the array
     }
     else {
+      SAMPLE.narrow(i, l2, r2, [c](char x) { return c < x; });
       while (r2 - l2 > 1) {
 	m = (l2 + r2) / 2;
 	vgl = (long)c - (long)S[SA[m] + i];
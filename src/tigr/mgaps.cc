@@ -8,6 +8,8 @@
 */
 
 #include <cassert>
+#include <climits>
+#include <limits>
 #include <algorithm>
 #include <vector>
 #include <iostream>
@@ -25,24 +27,27 @@ namespace mgaps {
   // sum of component lengths
 
 // UnionFind
-void UnionFind::reset(size_t s) {
+template<typename Index>
+void UnionFind_t<Index>::reset(size_t s) {
   m_UF.resize(0);
   m_UF.resize(s + 1, -1);
   assert(m_UF[0] == -1 && m_UF[s] == -1);
 }
 
-int UnionFind::find(int a) { //  Return the id of the set containing  a  in  UF .
+template<typename Index>
+Index UnionFind_t<Index>::find(Index a) { //  Return the id of the set containing  a  in  UF .
   if(m_UF [a] < 0) return  a;
-  int i;
+  Index i;
   for(i = a;  m_UF [i] > 0;  i = m_UF [i]) ;
-  for(int k, j = a;  m_UF [j] != i;  j = k) {
+  for(Index k, j = a;  m_UF [j] != i;  j = k) {
     k = m_UF [j];
     m_UF [j] = i;
   }
   return  i;
 }
 
-void UnionFind::union_sets(int a, int b) { //  Union the sets whose id's are  a  and  b  in  UF .
+template<typename Index>
+void UnionFind_t<Index>::union_sets(Index a, Index b) { //  Union the sets whose id's are  a  and  b  in  UF .
   if(a == b) return;
   assert (m_UF [a] < 0 && m_UF [b] < 0);
 
@@ -55,24 +60,33 @@ void UnionFind::union_sets(int a, int b) { //  Union the sets whose id's are  a
   }
 }
 
-int ClusterMatches::Filter_Matches(Match_t * A, const int N) {
+template struct UnionFind_t<int>;
+template struct UnionFind_t<long>;
+
+template<typename Index>
+Index ClusterMatches::Filter_Matches(Anchor_t * A, const Index N, ClusterScratch_t<Index>& S) {
 //  Remove from  A [0 .. (N - 1)]  any matches that are internal to a repeat,
 //  e.g., if seq1 has 27 As and seq2 has 20 then the first and
 //  last matches will be kept, but the 6 matches in the middle will
 //  be eliminated.  Also combine overlapping matches on the same
 //  diagonal.  Pack all remaining matches into the front of  A  and
 //  reduce the value of  N  if any matches are removed.
-//  Matches in  A  *MUST* be sorted by  Start2  value.
+//  Matches in  A  *MUST* be sorted by  Start2  value.  The Good and
+//  Tentative flags are kept in  S .
+  S.Good.assign(N, true);
+  S.Tentative.assign(N, false);
+  char* Good      = S.Good.data();
+  char* Tentative = S.Tentative.data();
 //#pragma omp parallel for schedule(dynamic)
-  for  (int i = 0;  i < N - 1;  i ++) {
-    if  (! A[i].Good) continue;
+  for  (Index i = 0;  i < N - 1;  i ++) {
+    if  (! Good[i]) continue;
 
     const int i_diag = A[i].Start2 - A[i].Start1;
     int       i_end  = A[i].Start2 + A[i].Len;
 
-    for  (int j = i + 1;  j < N && A[j].Start2 <= i_end;  j ++) {
+    for  (Index j = i + 1;  j < N && A[j].Start2 <= i_end;  j ++) {
       assert (A[i].Start2 <= A[j].Start2);
-      if  (! A[j].Good) continue;
+      if  (! Good[j]) continue;
       int j_diag = A[j].Start2 - A[j].Start1;
       if  (i_diag == j_diag) {
         int  j_extent = A[j].Len + A[j].Start2 - A[i].Start2;
@@ -80,22 +94,22 @@ int ClusterMatches::Filter_Matches(Match_t * A, const int N) {
           A[i].Len = j_extent;
           i_end = A[i].Start2 + j_extent;
         }
-        A[j].Good = false;
+        Good[j] = false;
       } else if  (A[i].Start1 == A[j].Start1) {
         int olap = A[i].Start2 + A[i].Len - A[j].Start2;
         if  (A[i].Len < A[j].Len) {
           if  (olap >=  A[i].Len / 2) {
-            A[i].Good = false;
+            Good[i] = false;
             break;
           }
         } else if  (A[j].Len < A[i].Len) {
           if  (olap >= A[j].Len / 2)
-            A[j].Good = false;
+            Good[j] = false;
         } else {
           if  (olap >= A[i].Len / 2) {
-            A[j].Tentative = true;
-            if  (A[i].Tentative) {
-              A[i].Good = false;
+            Tentative[j] = true;
+            if  (Tentative[i]) {
+              Good[i] = false;
               break;
             }
           }
@@ -104,18 +118,18 @@ int ClusterMatches::Filter_Matches(Match_t * A, const int N) {
         int olap = A[i].Start1 + A[i].Len - A[j].Start1;
         if  (A[i].Len < A[j].Len) {
           if  (olap >=  A[i].Len / 2) {
-            A[i].Good = false;
+            Good[i] = false;
             break;
           }
         } else if  (A[j].Len < A[i].Len) {
           if  (olap >= A[j].Len / 2)
-            A[j].Good = false;
+            Good[j] = false;
 
         } else {
           if  (olap >= A[i].Len / 2) {
-            A[j].Tentative = true;
-            if  (A[i].Tentative) {
-              A[i].Good = false;
+            Tentative[j] = true;
+            if  (Tentative[i]) {
+              Good[i] = false;
               break;
             }
           }
@@ -124,10 +138,215 @@ int ClusterMatches::Filter_Matches(Match_t * A, const int N) {
     }
   }
 
-  const auto new_end = std::remove_if(A, A + N, [](const Match_t& m) { return !m.Good; });
-  return new_end - A;
+  Index n = 0;
+  for  (Index i = 0;  i < N;  i ++)
+    if  (Good[i])
+      A[n++] = A[i];
+  return n;
+}
+
+template int  ClusterMatches::Filter_Matches(Anchor_t*, const int, ClusterScratch_t<int>&);
+template long ClusterMatches::Filter_Matches(Anchor_t*, const long, ClusterScratch_t<long>&);
+
+template<typename Index>
+void ClusterMatches::Bucket_Matches(const Anchor_t * A, Index N, ClusterScratch_t<Index>& S) const {
+  auto& buckets = S.Diagonal_Buckets;
+  buckets.resize(N);
+  for  (Index i = 1;  i <= N;  i ++)
+    buckets [i - 1] = std::make_pair(Diagonal_Bucket(A [i] . Start2 - A [i] . Start1), i);
+  std::sort(buckets.begin(), buckets.end());
+}
+
+template void ClusterMatches::Bucket_Matches(const Anchor_t*, int, ClusterScratch_t<int>&) const;
+template void ClusterMatches::Bucket_Matches(const Anchor_t*, long, ClusterScratch_t<long>&) const;
+
+
+namespace {
+// No candidate: lowest value, and an index after all the others
+template<typename Index>
+inline typename ClusterScratch_t<Index>::Candidate no_candidate() {
+  return { LONG_MIN, std::numeric_limits<Index>::max() };
+}
+
+// Clusters up to this size are chained by trying all the pairs
+const int quadratic_chain_max = 128;
+
+// Keep the best of a and (value, from): the highest value, then the
+// lowest index, as a scan of the previous matches in order would.
+template<typename Candidate, typename Index>
+inline void update_best(Candidate& a, long int value, Index from) {
+  if(value > a.value || (value == a.value && from < a.from)) {
+    a.value = value;
+    a.from  = from;
+  }
 }
 
+inline long int diagonal(const Anchor_t& a) { return (long int)a.Start2 - a.Start1; }
+
+inline long int overlap(const Anchor_t& j, const Anchor_t& i) {
+  const long int Olap1 = j . Start1 + j . Len - i . Start1;
+  const long int Olap2 = (long int)j . Start2 + j . Len - i . Start2;
+  return std::max(std::max((long)0, Olap1), Olap2);
+}
+
+// Fenwick tree of the best candidate of a prefix of [0, m)
+template<typename Index>
+class fenwick_max {
+  typedef typename ClusterScratch_t<Index>::Candidate Candidate;
+  Candidate*  m_tree;
+  const Index m_size;
+public:
+  fenwick_max(std::vector<Candidate>& tree, Index m) : m_size(m) {
+    tree.assign(m + 1, no_candidate<Index>());
+    m_tree = tree.data();
+  }
+  void insert(Index pos, long int value, Index from) {
+    for(Index p = pos + 1; p <= m_size; p += p & -p)
+      update_best(m_tree[p], value, from);
+  }
+  // Best candidate in [0, k)
+  Candidate prefix(Index k) const {
+    Candidate res = no_candidate<Index>();
+    for(Index p = k; p > 0; p -= p & -p)
+      update_best(res, m_tree[p].value, m_tree[p].from);
+    return res;
+  }
+};
+
+// Chaining by divide and conquer on the index (CDQ). With d the
+// diagonal (Start2 - Start1) of a match and e its end, the penalty of
+// chaining i after j is
+//
+//   max(0, e1_j - s1_i) + d_i - d_j  if d_j <= d_i
+//   max(0, e2_j - s2_i) + d_j - d_i  if d_j >  d_i
+//
+// For each of the 2 cases, sweeping the matches by diagonal leaves a
+// range max query on the end of j for each side of the max.
+template<typename Index>
+class chainer {
+  typedef typename ClusterScratch_t<Index>::Candidate Candidate;
+  static constexpr Index none = std::numeric_limits<Index>::max();
+
+  const Anchor_t*          A;
+  ClusterScratch_t<Index>& S;
+
+public:
+  chainer(const Anchor_t* A_, ClusterScratch_t<Index>& S_) : A(A_), S(S_) { }
+
+  // Score the dirty matches in [lo, hi), given the candidates from the
+  // matches before lo
+  void solve(Index lo, Index hi) {
+    if(S.Dirty_Before[hi] == S.Dirty_Before[lo]) return;
+    if(hi - lo == 1) {
+      finalize(lo);
+      return;
+    }
+    const Index mid = lo + (hi - lo) / 2;
+    solve(lo, mid);
+    if(S.Dirty_Before[hi] > S.Dirty_Before[mid]) {
+      sweep(lo, mid, hi, true);
+      sweep(lo, mid, hi, false);
+    }
+    solve(mid, hi);
+  }
+
+  void finalize(Index i) {
+    const Candidate& c = S.Chain_Best[i];
+    if(c.value > 0) {
+      S.Simple_Score[i] = A[i].Len + c.value;
+      S.Simple_From[i]  = c.from;
+      S.Simple_Adj[i]   = overlap(A[c.from], A[i]);
+    } else {
+      S.Simple_Score[i] = A[i].Len;
+      S.Simple_From[i]  = -1;
+      S.Simple_Adj[i]   = 0;
+    }
+    S.Dirty[i] = false;
+  }
+
+  // Candidates from the matches j in [lo, mid) to the dirty matches i
+  // in [mid, hi) with d_j <= d_i if below, d_j > d_i otherwise.
+  void sweep(Index lo, Index mid, Index hi, bool below) {
+    auto end = [&](Index j) -> long int {
+      return below ? A[j].Start1 + A[j].Len : (long int)A[j].Start2 + A[j].Len;
+    };
+    auto& keys = S.Chain_Keys;
+    keys.clear();
+    for(Index j = lo; j < mid; ++j)
+      keys.push_back(end(j));
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    const Index        m = keys.size();
+    fenwick_max<Index> before(S.Chain_Below, m); // e_j <= s_i, by e_j
+    fenwick_max<Index> after(S.Chain_Above, m);  // e_j >  s_i, by decreasing e_j
+
+    // By increasing diagonal, j before i, if below. By decreasing
+    // diagonal, i before j, otherwise.
+    auto& order = S.Chain_Order;
+    order.clear();
+    for(Index j = lo; j < mid; ++j)
+      order.push_back(j);
+    for(Index i = mid; i < hi; ++i)
+      if(S.Dirty[i]) order.push_back(i);
+    std::sort(order.begin(), order.end(), [&](Index a, Index b) {
+        const long int da = diagonal(A[a]), db = diagonal(A[b]);
+        if(da != db) return below ? da < db : da > db;
+        return below ? a < b : a > b;
+      });
+
+    for(const Index x : order) {
+      const long int d = diagonal(A[x]);
+      if(x < mid) {
+        const long int score = S.Simple_Score[x];
+        const long int e     = end(x);
+        const Index    pos   = std::lower_bound(keys.cbegin(), keys.cend(), e) - keys.cbegin();
+        before.insert(pos, below ? score + d : score - d, x);
+        after.insert(m - 1 - pos, below ? score - e + d : score - e - d, x);
+      } else {
+        const long int s = below ? A[x].Start1 : A[x].Start2;
+        const Index    k = std::upper_bound(keys.cbegin(), keys.cend(), s) - keys.cbegin();
+        const long int dd = below ? -d : d;
+        Candidate      c  = before.prefix(k);
+        if(c.from != none) update_best(S.Chain_Best[x], c.value + dd, c.from);
+        c = after.prefix(m - k);
+        if(c.from != none) update_best(S.Chain_Best[x], c.value + s + dd, c.from);
+      }
+    }
+  }
+};
+} // namespace
+
+template<typename Index>
+void ClusterMatches::Chain_Scores(const Anchor_t * A, Index N, ClusterScratch_t<Index>& S) {
+  S.Chain_Best.resize(N);
+  chainer<Index> chain(A, S);
+
+  if  (N <= quadratic_chain_max) {
+    for  (Index i = 0;  i < N;  i ++) {
+      if  (! S.Dirty [i]) continue;
+      S.Chain_Best [i] = no_candidate<Index>();
+      for  (Index j = 0;  j < i;  j ++) {
+        const long int Pen = overlap(A [j], A [i]) + std::abs (diagonal(A [i]) - diagonal(A [j]));
+        update_best(S.Chain_Best [i], S.Simple_Score [j] - Pen, j);
+      }
+      chain.finalize(i);
+    }
+    return;
+  }
+
+  S.Dirty_Before.resize(N + 1);
+  S.Dirty_Before [0] = 0;
+  for  (Index i = 0;  i < N;  i ++) {
+    S.Dirty_Before [i + 1] = S.Dirty_Before [i] + (S.Dirty [i] != 0);
+    if  (S.Dirty [i])
+      S.Chain_Best [i] = no_candidate<Index>();
+  }
+  chain.solve(0, N);
+}
+
+template void ClusterMatches::Chain_Scores(const Anchor_t*, int, ClusterScratch_t<int>&);
+template void ClusterMatches::Chain_Scores(const Anchor_t*, long, ClusterScratch_t<long>&);
+
 
 void ClusterMatches::Print_Cluster(const cluster_type& cl, const char* label, std::ostream& os) {
   os << label << '\n'
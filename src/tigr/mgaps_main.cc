@@ -127,8 +127,8 @@ int  main(int argc, char * argv []) {
 
   Parse_Command_Line  (argc, argv);
 
-  std::vector<Match_t>          A(1);
-  UnionFind                     UF;
+  std::vector<Anchor_t>         A(1);
+  ClusterScratch                S;
 
   ClusterMatches clusterer(Fixed_Separation, Max_Separation, Min_Output_Score, Separation_Factor, Use_Extents);
 
@@ -143,10 +143,10 @@ int  main(int argc, char * argv []) {
     for(c = std::cin.peek(); c != '>' && c != EOF; c = std::cin.peek()) {
       std::getline(std::cin, line);
       if  (sscanf (line.c_str(), "%ld %ld %ld", & S1, & S2, & Len) == 3)
-        A.push_back(Match_t(S1, S2, Len));
+        A.push_back(Anchor_t(S1, S2, Len));
     }
     const char* label = header.c_str();
-    clusterer.Cluster_each(A.data(), UF, A.size() - 1, [&](const cluster_type&& cl) {
+    clusterer.Cluster_each(A.data(), S, A.size() - 1, [&](const cluster_type&& cl) {
         clusterer.Print_Cluster(cl, label, std::cout);
         label = "#";
       });
@@ -3,6 +3,8 @@
 #include <functional>
 #include <unordered_map>
 #include <stdexcept>
+#include <atomic>
+#include <limits>
 #include <mummer/nucmer.hpp>
 #include <mummer/sparseSA.hpp>
 #include <mummer/mgaps.hh>
@@ -65,12 +67,12 @@ void replace_n_random_letter(std::string& s) {
 
 
 void SequenceAligner::align(const char* query, size_t query_len, std::vector<postnuc::Alignment>& alignments) {
-  std::vector<mgaps::Match_t>        fwd_matches(1), bwd_matches(1);
+  std::vector<mgaps::Anchor_t>       fwd_matches(1), bwd_matches(1);
   FastaRecordSeq                     Query(query, query_len);
   std::vector<synteny_type>          syntenys;
   syntenys.push_back(&Ref);
   synteny_type&               synteny = syntenys.front();
-  mgaps::UnionFind                   UF;
+  mgaps::ClusterScratch              scratch;
   char                               cluster_dir;
 
   auto append_cluster = [&](const mgaps::cluster_type& cluster) {
@@ -84,26 +86,30 @@ void SequenceAligner::align(const char* query, size_t query_len, std::vector<pos
   };
   if(options.orientation & FORWARD) {
     auto append_matches = [&](const mummer::match_t& m) { fwd_matches.push_back({ m.ref + 1, m.query + 1, m.len }); };
+    auto append_anchors = [&](long ref, long query, long len) { fwd_matches.push_back({ ref + 1, query + 1, len }); };
     switch(options.match) {
     case MUM: sa.findMUM_each(query, query_len, options.min_len, false, append_matches); break;
     case MUMREFERENCE: sa.findMAM_each(query, query_len, options.min_len, false, append_matches); break;
-    case MAXMATCH: sa.findMEM_each(query, query_len, options.min_len, false, append_matches); break;
+    case MAXMATCH: sa.findMEM_each(query, query_len, options.min_len, false, append_matches, options.max_occ); break;
+    case SPACED: seeds.find_anchors(query, query_len, options.min_len, seeds.span(), append_anchors, options.max_occ); break;
     }
     cluster_dir = postnuc::FORWARD_CHAR;
-    clusterer.Cluster_each(fwd_matches.data(), UF, fwd_matches.size() - 1, append_cluster);
+    clusterer.Cluster_each(fwd_matches.data(), scratch, fwd_matches.size() - 1, append_cluster);
   }
 
   if(options.orientation & REVERSE) {
     std::string rquery(query, query_len);
     reverse_complement(rquery);
     auto append_matches = [&](const mummer::match_t& m) { bwd_matches.push_back({ m.ref + 1, m.query + 1, m.len }); };
+    auto append_anchors = [&](long ref, long query, long len) { bwd_matches.push_back({ ref + 1, query + 1, len }); };
     switch(options.match) {
     case MUM: sa.findMUM_each(rquery.c_str(), query_len, options.min_len, false, append_matches); break;
     case MUMREFERENCE: sa.findMAM_each(rquery.c_str(), query_len, options.min_len, false, append_matches); break;
-    case MAXMATCH: sa.findMEM_each(rquery.c_str(), query_len, options.min_len, false, append_matches); break;
+    case MAXMATCH: sa.findMEM_each(rquery.c_str(), query_len, options.min_len, false, append_matches, options.max_occ); break;
+    case SPACED: seeds.find_anchors(rquery.c_str(), query_len, options.min_len, seeds.span(), append_anchors, options.max_occ); break;
     }
     cluster_dir = postnuc::REVERSE_CHAR;
-    clusterer.Cluster_each(bwd_matches.data(), UF, bwd_matches.size() - 1, append_cluster);
+    clusterer.Cluster_each(bwd_matches.data(), scratch, bwd_matches.size() - 1, append_cluster);
   }
 
   merger.processSyntenys_each(syntenys, Query,
@@ -118,8 +124,20 @@ std::unique_ptr<std::ifstream> sequence_info::open_path(const char* path) {
   return data;
 }
 
+// Header of a sequence: the first word of its '>' line
+static std::string fasta_header(const std::string& line) {
+  size_t start = line.find_first_not_of(" \t", 1);
+  if(start == std::string::npos)
+    start = 0;
+  const size_t end = line.find_first_of(" \t", start);
+  return end == std::string::npos ? line.substr(start) : line.substr(start, end - start);
+}
+
 sequence_info::sequence_info(std::istream& data, size_t chunk_size)  {
-  std::string meta, line;
+  std::string         meta, line;
+  std::vector<record> records;
+  std::string         sequence;
+  std::string         headers;
 
   int c = data.peek();
   if(c != '>')
@@ -130,14 +148,7 @@ sequence_info::sequence_info(std::istream& data, size_t chunk_size)  {
 
     // Read metadata
     const size_t header_offset = headers.size();
-    size_t start = line.find_first_not_of(" \t", 1);
-    if(start == std::string::npos)
-      start = 0;
-    const size_t end = line.find_first_of(" \t", start);
-    if(end == std::string::npos)
-      headers += line.substr(start);
-    else
-      headers += line.substr(start, end - start);
+    headers += fasta_header(line);
     headers += '\0';
 
     // Read sequence
@@ -160,6 +171,122 @@ sequence_info::sequence_info(std::istream& data, size_t chunk_size)  {
   sequence += '`';
   replace_n_random_letter(sequence);
   records.push_back({ sequence.size(), headers.size() });
+
+  this->records  = std::move(records);
+  this->sequence = std::move(sequence);
+  this->headers  = std::move(headers);
+}
+
+sequence_info::sequence_info(const mummer::index_reader& index) {
+  if(!index.good() || !index.text() || !index.section(mummer::RECORDS_SECTION, records) ||
+     !index.section(mummer::HEADERS_SECTION, headers))
+    throw std::runtime_error("Index does not contain the reference sequence information");
+  if(mummer::index_checksum(index.text(), index.text_length()) != index.header().text_checksum)
+    throw std::runtime_error("Checksum of the reference sequence in the index does not match, index is corrupted");
+  sequence = decltype(sequence)(index.map(), index.text(), index.text_length());
+}
+
+bool sequence_info::same_headers(std::istream& data) const {
+  std::string line;
+  size_t      i = 0;
+  while(std::getline(data, line)) {
+    if(line.empty() || line[0] != '>') continue;
+    if(i >= size() || fasta_header(line) != header(i)) return false;
+    ++i;
+  }
+  return i == size();
+}
+
+void sequence_info::save(mummer::index_writer& writer) const {
+  writer.write(mummer::HEADERS_SECTION, headers);
+  writer.write(mummer::RECORDS_SECTION, records);
+}
+
+bool FileAligner::save_external(const sequence_info& reference_info, const std::string& prefix, size_t mem,
+                                const Options& opts) {
+  mummer::index_writer writer(mummer::sparseSA::index_path(prefix));
+  mummer::sparseSA::create_auto_external(writer, mem, reference_info.sequence.data(), reference_info.sequence.size(),
+                                         opts.min_len, true, opts.sparse_k, false, opts.nb_threads, opts.lcp_direct);
+  reference_info.save(writer);
+  return writer.close();
+}
+
+minimizer_index FileAligner::prefilter_index(const sequence_info& reference_info, const Options& opts) {
+  if(opts.prefilter_hits == 0) return minimizer_index();
+  const int k = std::min((int)prefilter_k, opts.min_len);
+  return minimizer_index(reference_info.sequence.data(), reference_info.sequence.size(), k, opts.min_len - k + 1);
+}
+
+reference_index::reference_index(const sequence_info& info, const Options& opts)
+  : m_length(0)
+  , m_skipped(0)
+{
+  if(opts.match == SPACED) {
+    m_seeds = spaced_seed_index(info.sequence.data(), info.sequence.size(), opts.seed_pattern);
+    return;
+  }
+
+  if(opts.both_strands && opts.match == MAXMATCH && opts.orientation == BOTH) {
+    // The reverse complement, where all the characters other than
+    // acgt become separators. A query character matches a character
+    // of the reverse complement if and only if its complement matches
+    // the reference, as with the reverse complemented query.
+    const size_t L = info.sequence.size();
+    m_text.reserve(2 * L);
+    m_text.assign(info.sequence.data(), L);
+    for(size_t i = L; i > 0; --i) {
+      switch(info.sequence[i - 1]) {
+      case 'a': m_text += 't'; break;
+      case 'c': m_text += 'g'; break;
+      case 'g': m_text += 'c'; break;
+      case 't': m_text += 'a'; break;
+      default: m_text += '`'; break;
+      }
+    }
+    m_length = L;
+    m_shards.emplace_back(new shard{ 0, mummer::sparseSA::create_auto(m_text.data(), m_text.size(), opts.min_len, true,
+                                                                        opts.sparse_k, false, opts.nb_threads, opts.lcp_direct) });
+    return;
+  }
+
+  // Split the reference at sequence boundaries. A shard starts and
+  // ends with the separator around its sequences, and is at most
+  // shard_size long unless it has a single sequence.
+  std::vector<std::pair<size_t, size_t>> ranges;
+  const size_t                           max_size = opts.shard_size ? opts.shard_size : std::numeric_limits<size_t>::max();
+  for(size_t b = 0; b < info.size(); ) {
+    size_t e = b + 1;
+    while(e < info.size() && info.records[e + 1].seq - info.records[b].seq + 1 <= max_size)
+      ++e;
+    ranges.push_back({ info.records[b].seq - 1, info.records[e].seq });
+    b = e;
+  }
+  if(ranges.size() <= 1) {
+    m_shards.emplace_back(new shard{ 0, mummer::sparseSA::create_auto(info.sequence.data(), info.sequence.size(), opts.min_len, true,
+                                                                        opts.sparse_k, false, opts.nb_threads, opts.lcp_direct) });
+    return;
+  }
+
+  // Build the shards in parallel, sharing the threads among them
+  m_shards.resize(ranges.size());
+  thread_pool         pool(std::min((size_t)opts.nb_threads, ranges.size()));
+  const unsigned int  threads = std::max(1u, opts.nb_threads / pool.size());
+  std::atomic<size_t> next(0);
+  pool.run([&](unsigned int id) {
+      for(size_t i = next++; i < ranges.size(); i = next++) {
+        const auto& r = ranges[i];
+        m_shards[i].reset(new shard{ r.first, mummer::sparseSA::create_auto(info.sequence.data() + r.first, r.second - r.first,
+                                                                             opts.min_len, true, opts.sparse_k, false, threads,
+                                                                             opts.lcp_direct) });
+      }
+    });
+}
+
+reference_index::reference_index(mummer::sparseSA&& sa)
+  : m_length(0)
+  , m_skipped(0)
+{
+  m_shards.emplace_back(new shard{ 0, std::move(sa) });
 }
 
 FastaRecordPtr sequence_info::find(size_t pos) const {
@@ -25,7 +25,8 @@ typedef jellyfish::stream_manager<path_iterator>         stream_manager;
 typedef jellyfish::whole_sequence_parser<stream_manager> sequence_parser;
 
 void query_thread(mummer::nucmer::FileAligner* aligner, sequence_parser* parser,
-                  thread_pipe::ostream_buffered* printer, const nucmer_cmdline* args) {
+                  thread_pipe::ostream_buffered* printer, const nucmer_cmdline* args,
+                  unsigned int query_threads) {
   auto output_it = printer->begin();
   const bool sam = args->sam_short_given || args->sam_long_given;
 
@@ -40,7 +41,7 @@ void query_thread(mummer::nucmer::FileAligner* aligner, sequence_parser* parser,
     if(output_it->tellp() > 1024)
       ++output_it;
   };
-  aligner->thread_align_file(*parser, print_function);
+  aligner->thread_align_file(*parser, print_function, query_threads);
   output_it.done();
 }
 
@@ -88,6 +89,33 @@ int main(int argc, char *argv[]) {
   if(args.reverse_flag) opts.reverse();
   if(args.mum_flag) opts.mum();
   if(args.maxmatch_flag) opts.maxmatch();
+  if(args.spaced_seed_given) {
+    if(!mummer::spaced_seed_index::valid_pattern(args.spaced_seed_arg))
+      nucmer_cmdline::error() << "Invalid spaced seed '" << args.spaced_seed_arg << "': expected 0s and 1s, starting and ending with 1, with at most "
+                              << mummer::spaced_seed_index::max_weight << " 1s";
+    opts.spaced(args.spaced_seed_arg);
+  }
+  if(args.sparse_arg < 1)
+    nucmer_cmdline::error() << "Sparse step must be at least 1";
+  if(args.sparse_arg > 1 && !args.maxmatch_flag)
+    nucmer_cmdline::error() << "Sparse suffix array (--sparse) is only valid with --maxmatch";
+  opts.sparse(args.sparse_arg);
+  if(args.direct_lcp_flag) opts.direct_lcp();
+  if(args.prefilter_given) opts.prefilter(args.prefilter_arg);
+  if(args.max_occ_given) {
+    if(!args.maxmatch_flag && !args.spaced_seed_given)
+      nucmer_cmdline::error() << "Occurrence limit (--max-occ) is only valid with --maxmatch or --spaced-seed";
+    opts.max_occurrences(args.max_occ_arg);
+  }
+  if(args.both_strand_index_flag) {
+    if(!args.maxmatch_flag)
+      nucmer_cmdline::error() << "Both strands index (--both-strand-index) is only valid with --maxmatch";
+    opts.both_strand_index();
+  }
+  if(args.shard_size_given)
+    opts.shard(args.shard_size_arg ? args.shard_size_arg : mummer::nucmer::reference_index::small_shard_size);
+  const unsigned int nb_threads = args.threads_given ? args.threads_arg : 2;
+  opts.threads(nb_threads);
 
   const std::string output_file =
     args.delta_given ? args.delta_arg
@@ -115,10 +143,49 @@ int main(int argc, char *argv[]) {
   std::unique_ptr<mummer::nucmer::FileAligner> aligner;
   std::ifstream reference;
 
-  if(args.load_given) {
-    mummer::nucmer::sequence_info reference_info(args.ref_arg);
-    mummer::mummer::sparseSA SA(reference_info.sequence, args.load_arg);
-    aligner.reset(new mummer::nucmer::FileAligner(std::move(reference_info), std::move(SA), opts));
+  // With --index-mem, the index is built on disk and then loaded like
+  // with --load.
+  const bool         prebuilt  = args.load_given || args.index_mem_given;
+  const std::string& load_path = args.load_given ? args.load_arg : args.save_arg;
+  if(args.index_mem_given) {
+    if(!args.save_given)
+      nucmer_cmdline::error() << "Building the index on disk (--index-mem) requires --save";
+    try {
+      const mummer::nucmer::sequence_info reference_info(args.ref_arg);
+      if(!mummer::nucmer::FileAligner::save_external(reference_info, args.save_arg, args.index_mem_arg, opts))
+        nucmer_cmdline::error() << "Can't save the index to '" << args.save_arg << "'";
+    } catch(std::runtime_error& e) {
+      nucmer_cmdline::error() << "Failed to build the index '" << args.save_arg << "': " << e.what();
+    }
+  }
+
+  if(prebuilt) {
+    // A self contained index holds the reference sequences: no need to
+    // parse the fasta file. Otherwise, the reference must be the one
+    // used to build the index.
+    try {
+      const mummer::mummer::index_reader index(mummer::mummer::sparseSA::index_path(load_path));
+      if(index.good() && index.has(mummer::mummer::HEADERS_SECTION)) {
+        aligner.reset(new mummer::nucmer::FileAligner(index, opts));
+        if(args.load_given) {
+          std::ifstream ref(args.ref_arg);
+          if(!ref.good())
+            nucmer_cmdline::error() << "Failed to open reference file '" << args.ref_arg << "'";
+          if(!aligner->reference_info().same_headers(ref))
+            nucmer_cmdline::error() << "Reference '" << args.ref_arg << "' does not have the sequences of index '"
+                                    << load_path << "'";
+        }
+      } else {
+        mummer::nucmer::sequence_info reference_info(args.ref_arg);
+        mummer::mummer::sparseSA SA(reference_info.sequence.data(), reference_info.sequence.size(), load_path);
+        aligner.reset(new mummer::nucmer::FileAligner(std::move(reference_info), std::move(SA), opts));
+      }
+    } catch(std::runtime_error& e) {
+      nucmer_cmdline::error() << "Failed to load index '" << load_path << "' for reference '"
+                              << args.ref_arg << "': " << e.what();
+    }
+    if(aligner->sa().K > 1 && !args.maxmatch_flag)
+      nucmer_cmdline::error() << "Loaded sparse suffix array (K=" << aligner->sa().K << ") is only valid with --maxmatch";
   } else {
     reference.open(args.ref_arg);
     if(!reference.good())
@@ -126,8 +193,9 @@ int main(int argc, char *argv[]) {
   }
 
   const size_t batch_size = args.batch_given ? args.batch_arg : std::numeric_limits<size_t>::max();
+  size_t       skipped_seeds = 0;
   do {
-    if(!args.load_given)
+    if(!prebuilt)
       aligner.reset(new mummer::nucmer::FileAligner(reference, batch_size,  opts));
 
     if(args.sam_long_given || args.sam_short_given) { // Finish SAM header: ref sequence + program
@@ -142,11 +210,10 @@ int main(int argc, char *argv[]) {
     }
 
 
-    if(args.save_given && !aligner->sa().save(args.save_arg))
-      nucmer_cmdline::error() << "Can't save the suffix array to '" << args.save_arg << "'";
+    if(args.save_given && !prebuilt && !aligner->save(args.save_arg))
+      nucmer_cmdline::error() << "Can't save the index to '" << args.save_arg << "'";
 
     stream_manager     streams(args.qry_arg.cbegin(), args.qry_arg.cend());
-    const unsigned int nb_threads = args.threads_given ? args.threads_arg : 2;
 #ifdef _OPENMP
     if(args.threads_given) omp_set_num_threads(nb_threads);
 #endif // _OPENMP
@@ -157,12 +224,12 @@ int main(int argc, char *argv[]) {
 #ifdef _OPENMP
 #pragma omp parallel
       {
-        query_thread(aligner.get(), &parser, &output, &args);
+        query_thread(aligner.get(), &parser, &output, &args, omp_get_num_threads());
       }
 #else // _OPENMP
       std::vector<std::thread> threads;
       for(unsigned int i = 0; i < nb_threads; ++i)
-        threads.push_back(std::thread(query_thread, aligner.get(), &parser, &output, &args));
+        threads.push_back(std::thread(query_thread, aligner.get(), &parser, &output, &args, nb_threads));
 
       for(auto& th : threads)
         th.join();
@@ -172,9 +239,13 @@ int main(int argc, char *argv[]) {
       sequence_parser    parser(4, 1, 1, streams);
       query_long(aligner.get(), &parser, &output, &args);
     }
-  } while(!args.load_given && reference.peek() != EOF);
+    skipped_seeds += aligner->index().skipped_seeds();
+  } while(!prebuilt && reference.peek() != EOF);
   output.close();
   os.close();
+  if(args.max_occ_given)
+    std::cerr << "Skipped " << skipped_seeds << " seeds with more than " << args.max_occ_arg
+              << " occurrences in the reference (--max-occ)\n";
 
   return 0;
 }
@@ -60,11 +60,27 @@ struct Options {
   mummer::nucmer::Options& reverse();
   mummer::nucmer::Options& simplify();
   mummer::nucmer::Options& nosimplify();
+  mummer::nucmer::Options& threads(unsigned int t);
+  mummer::nucmer::Options& sparse(int k);
+  mummer::nucmer::Options& direct_lcp();
+  mummer::nucmer::Options& shard(size_t bases);
+  mummer::nucmer::Options& both_strand_index();
+  mummer::nucmer::Options& max_occurrences(long n);
+  mummer::nucmer::Options& prefilter(size_t hits);
+  mummer::nucmer::Options& spaced(const std::string& pattern = "111010010100110111");
 
   // Options for mummer
   //  match_type match;
-  int        min_len;
+  int          min_len;
   //  ori_type   orientation;
+  unsigned int nb_threads;
+  int          sparse_k;
+  bool         lcp_direct;
+  size_t       shard_size;
+  bool         both_strands;
+  long         max_occ;
+  size_t       prefilter_hits;
+  std::string  seed_pattern;
 
   // Options for mgaps
   long   fixed_separation;
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <mummer/sparseSA.hpp>
+#include <mummer/nucmer.hpp>
+
+#include "bench_lcp_cmdline.hpp"
+
+typedef std::chrono::steady_clock clock_type;
+
+static double since(const clock_type::time_point& start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// Time a loop calling LCP[i] on each index of idxs. The sum is printed
+// so the loop is not optimized away.
+static void time_lookups(const char* name, const mummer::mummer::sparseSA& sa, const std::vector<size_t>& idxs) {
+  const auto start = clock_type::now();
+  size_t     sum   = 0;
+  for(const auto i : idxs)
+    sum += sa.LCP[i];
+  const double t = since(start);
+  std::cout << '\t' << name << '\t' << idxs.size() << '\t' << t << '\t' << (1e9 * t / std::max((size_t)1, idxs.size()))
+            << '\t' << sum << '\n';
+}
+
+int main(int argc, char *argv[]) {
+  bench_lcp_cmdline args(argc, argv);
+
+  const mummer::nucmer::sequence_info reference(args.ref_arg);
+  std::cout << "layout\tbuild_s\tlcp_bytes\tlarge_values\n"
+            << "\tlookups\tcount\ttime_s\tns_per_lookup\tchecksum\n";
+
+  for(const bool direct : { false, true }) {
+    const auto start = clock_type::now();
+    const auto sa    = mummer::mummer::sparseSA::create_auto(reference.sequence.data(), reference.sequence.size(), args.minmatch_arg,
+                                                             true, 1, false, args.threads_arg, direct);
+    const double build = since(start);
+    const size_t n     = sa.SA.size();
+    size_t       nb_large = 0;
+    for(size_t i = 0; i < n; ++i)
+      nb_large += sa.LCP.vec[i] == mummer::mummer::vec_uchar::max;
+    std::cout << (direct ? "direct" : "sorted") << '\t' << build << '\t' << sa.LCP.index_size_in_bytes() << '\t' << nb_large << '\n';
+
+    // Same pseudo-random indices for both layouts
+    std::mt19937_64                       rng(args.lookups_arg);
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    std::vector<size_t>                   idxs(args.lookups_arg);
+    for(auto& i : idxs) i = dist(rng);
+    time_lookups("random", sa, idxs);
+
+    std::vector<size_t> large_idxs;
+    for(const auto i : idxs)
+      if(sa.LCP.vec[i] == mummer::mummer::vec_uchar::max)
+        large_idxs.push_back(i);
+    time_lookups("random_large", sa, large_idxs);
+
+    std::vector<size_t> scan(n);
+    for(size_t i = 0; i < n; ++i) scan[i] = i;
+    time_lookups("scan", sa, scan);
+  }
+
+  return 0;
+}
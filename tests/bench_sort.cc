@@ -0,0 +1,80 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <parallel/algorithm>
+#endif
+
+#include <mummer/parallel_sort.hpp>
+#include <mummer/mgaps.hh>
+
+#include "bench_sort_cmdline.hpp"
+
+typedef std::chrono::steady_clock clock_type;
+using mummer::mgaps::Anchor_t;
+
+static double since(const clock_type::time_point& start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static bool by_start2(const Anchor_t& a, const Anchor_t& b) {
+  return a.Start2 < b.Start2 || (a.Start2 == b.Start2 && a.Start1 < b.Start1);
+}
+
+// Time sort on a copy of input and check that the result is sorted
+template<typename T, typename Sort, typename Sorted>
+static void time_sort(const char* name, const std::vector<T>& input, Sort sort, Sorted sorted) {
+  std::vector<T> data(input);
+  const auto     start = clock_type::now();
+  sort(data);
+  const double t = since(start);
+  std::cout << name << '\t' << data.size() << '\t' << t << '\t' << (1e9 * t / std::max((size_t)1, data.size()))
+            << '\t' << (sorted(data) ? "ok" : "UNSORTED") << '\n';
+}
+
+int main(int argc, char *argv[]) {
+  bench_sort_cmdline args(argc, argv);
+
+  mummer::thread_pool                   pool(args.threads_arg);
+  std::mt19937_64                       rng(args.seed_arg);
+  std::uniform_int_distribution<long>   start1(1, 1L << 34);
+  std::uniform_int_distribution<int>    start2(1, 1 << 30), len(20, 1000);
+  std::uniform_int_distribution<uint64_t> key;
+
+  std::vector<Anchor_t> anchors(args.size_arg);
+  for(auto& a : anchors)
+    a = Anchor_t(start1(rng), start2(rng), len(rng));
+  std::vector<std::pair<uint64_t, uint64_t>> pairs(args.size_arg);
+  for(size_t i = 0; i < pairs.size(); ++i)
+    pairs[i] = std::make_pair(key(rng), (uint64_t)i);
+
+  std::cout << "sort\tsize\ttime_s\tns_per_element\tcheck\n";
+  auto anchors_sorted = [](const std::vector<Anchor_t>& v) { return std::is_sorted(v.cbegin(), v.cend(), by_start2); };
+  time_sort("std::sort", anchors, [](std::vector<Anchor_t>& v) { std::sort(v.begin(), v.end(), by_start2); }, anchors_sorted);
+#ifdef _OPENMP
+  time_sort("__gnu_parallel::sort", anchors,
+            [&](std::vector<Anchor_t>& v) { __gnu_parallel::sort(v.begin(), v.end(), by_start2); }, anchors_sorted);
+#endif
+  time_sort("sample_sort", anchors,
+            [&](std::vector<Anchor_t>& v) { mummer::sample_sort(v.begin(), v.end(), by_start2, pool); }, anchors_sorted);
+
+  typedef std::pair<uint64_t, uint64_t> pair_type;
+  auto first  = [](const pair_type& p) { return p.first; };
+  auto pairs_sorted = [](const std::vector<pair_type>& v) {
+    return std::is_sorted(v.cbegin(), v.cend(), [](const pair_type& a, const pair_type& b) { return a.first < b.first; });
+  };
+  std::vector<pair_type> tmp(pairs.size());
+  time_sort("std::stable_sort", pairs, [](std::vector<pair_type>& v) {
+      std::stable_sort(v.begin(), v.end(), [](const pair_type& a, const pair_type& b) { return a.first < b.first; });
+    }, pairs_sorted);
+  time_sort("radix_sort", pairs, [&](std::vector<pair_type>& v) {
+      mummer::radix_sort(v.data(), v.data() + v.size(), tmp.data(), 64, first);
+    }, pairs_sorted);
+  time_sort("parallel_radix_sort", pairs, [&](std::vector<pair_type>& v) {
+      mummer::parallel_radix_sort(v.data(), v.data() + v.size(), tmp.data(), 64, first, pool);
+    }, pairs_sorted);
+
+  return 0;
+}
@@ -52,7 +52,7 @@ int main(int argc, char *argv[]) {
   lcp_type      LCP(SA);
   lcp_type      LCP_load(SA);
   sequence_type sequence(args.sequence_arg.c_str());
-  bounded_type  bounded(sequence.sequence, 1);
+  bounded_type  bounded(sequence.sequence.data(), sequence.sequence.size(), 1);
 
   if(aux_info.N <= 0)
     check_LCP_cmdline::error() << "Got invalid N" << aux_info.N;
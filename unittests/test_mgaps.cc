@@ -0,0 +1,337 @@
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+
+#include <mummer/mgaps.hh>
+
+namespace {
+using mummer::mgaps::Anchor_t;
+using mummer::mgaps::ClusterMatches;
+using mummer::mgaps::ClusterScratch;
+using mummer::mgaps::clusters_type;
+using mummer::mgaps::UnionFind;
+using mummer::mgaps::UnionFind_t;
+using mummer::mgaps::ClusterScratch_t;
+
+ClusterMatches default_clusterer() {
+  return ClusterMatches(5, 90, 65, 0.12, false);
+}
+
+struct TestClusterMatches : public ClusterMatches {
+  using ClusterMatches::ClusterMatches;
+  using ClusterMatches::Process_Cluster;
+  using ClusterMatches::Union_Matches;
+  using ClusterMatches::Cluster_each_long_;
+};
+
+// Chain the cluster A by trying all the pairs, recomputing all the
+// scores after extracting a chain.
+clusters_type quadratic_chains(std::vector<Anchor_t> A, long min_score, bool use_extents) {
+  clusters_type     res;
+  std::vector<long> Score, Adj;
+  std::vector<int>  From;
+  while(!A.empty()) {
+    const int N = A.size();
+    Score.assign(N, 0);
+    Adj.assign(N, 0);
+    From.assign(N, -1);
+    for(int i = 0; i < N; ++i) {
+      Score[i] = A[i].Len;
+      for(int j = 0; j < i; ++j) {
+        const long Olap = std::max(std::max(0L, A[j].Start1 + A[j].Len - A[i].Start1), (long)A[j].Start2 + A[j].Len - A[i].Start2);
+        const long Pen  = Olap + std::abs(((long)A[i].Start2 - A[i].Start1) - ((long)A[j].Start2 - A[j].Start1));
+        if(Score[j] + A[i].Len - Pen > Score[i]) {
+          Score[i] = Score[j] + A[i].Len - Pen;
+          From[i]  = j;
+          Adj[i]   = Olap;
+        }
+      }
+    }
+    const int         best = std::max_element(Score.cbegin(), Score.cend()) - Score.cbegin();
+    std::vector<char> good(N, false);
+    long              total = 0, hi = LONG_MIN, lo = LONG_MAX;
+    for(int i = best; i >= 0; i = From[i]) {
+      good[i] = true;
+      total += A[i].Len;
+      hi = std::max(hi, A[i].Start1 + A[i].Len);
+      lo = std::min(lo, A[i].Start1);
+    }
+    if((use_extents ? hi - lo : total) >= min_score) {
+      res.push_back(mummer::mgaps::cluster_type());
+      for(int i = 0; i < N; ++i) {
+        if(!good[i]) continue;
+        res.back().push_back(mummer::mgaps::Match_t(A[i].Start1, A[i].Start2, A[i].Len));
+        res.back().back().Simple_Score = Score[i];
+        res.back().back().Simple_From  = From[i];
+        res.back().back().Simple_Adj   = Adj[i];
+      }
+    }
+    std::vector<Anchor_t> rest;
+    for(int i = 0; i < N; ++i)
+      if(!good[i]) rest.push_back(A[i]);
+    A.swap(rest);
+  }
+  return res;
+}
+
+TEST(MGaps, ColinearMatches) {
+  const auto     clusterer = default_clusterer();
+  ClusterScratch scratch;
+  clusters_type  clusters;
+
+  // Two chains of matches, far apart on the reference. The second
+  // chain has an overlap of 5 bases in the query between its matches,
+  // on diagonals 5 apart.
+  std::vector<Anchor_t> A(1);
+  A.push_back(Anchor_t(100040, 85, 40));
+  A.push_back(Anchor_t(1000, 1, 30));
+  A.push_back(Anchor_t(100000, 50, 40));
+  A.push_back(Anchor_t(1040, 41, 30));
+  A.push_back(Anchor_t(1080, 81, 30));
+
+  EXPECT_EQ(2, clusterer.Process_Matches(A.data(), scratch, A.size() - 1, clusters));
+  ASSERT_EQ((size_t)2, clusters.size());
+  ASSERT_EQ((size_t)3, clusters[0].size());
+  EXPECT_EQ(1000, clusters[0][0].Start1);
+  EXPECT_EQ(1040, clusters[0][1].Start1);
+  EXPECT_EQ(1080, clusters[0][2].Start1);
+  for(const auto& m : clusters[0])
+    EXPECT_EQ(0, m.Simple_Adj);
+  ASSERT_EQ((size_t)2, clusters[1].size());
+  EXPECT_EQ(100000, clusters[1][0].Start1);
+  EXPECT_EQ(100040, clusters[1][1].Start1);
+  EXPECT_EQ(5, clusters[1][1].Simple_Adj);
+
+  // Too short to make a cluster
+  clusters.clear();
+  A.resize(1);
+  A.push_back(Anchor_t(1000, 1, 20));
+  EXPECT_EQ(0, clusterer.Process_Matches(A.data(), scratch, A.size() - 1, clusters));
+  EXPECT_TRUE(clusters.empty());
+} // MGaps.ColinearMatches
+
+TEST(MGaps, LongMatchesSame) {
+  const auto     clusterer = default_clusterer();
+  ClusterScratch scratch;
+  std::uniform_int_distribution<int> diag(0, 20), step(1, 60), len(10, 40), ref(0, 5);
+
+  // Random matches around a few diagonals. Cluster_each and
+  // Cluster_each_long give the same clusters, maybe in a different
+  // order.
+  for(int t = 0; t < 20; ++t) {
+    SCOPED_TRACE(::testing::Message() << "t:" << t);
+    std::vector<Anchor_t> A(1);
+    for(int s2 = 1; s2 < 20000; s2 += step(rand_gen))
+      A.push_back(Anchor_t(ref(rand_gen) * 100000 + s2 + diag(rand_gen) + 1, s2, len(rand_gen)));
+    std::shuffle(A.begin() + 1, A.end(), rand_gen);
+    auto B = A;
+
+    clusters_type clusters, clusters_long;
+    const int nb = clusterer.Process_Matches(A.data(), scratch, A.size() - 1, clusters);
+    const int nb_long = clusterer.Cluster_each_long(B.data(), B.size() - 1,
+                                                    [&](mummer::mgaps::cluster_type&& cl) { clusters_long.push_back(std::move(cl)); });
+    auto by_start = [](const mummer::mgaps::cluster_type& a, const mummer::mgaps::cluster_type& b) {
+      return a[0].Start2 < b[0].Start2 || (a[0].Start2 == b[0].Start2 && a[0].Start1 < b[0].Start1);
+    };
+    std::sort(clusters.begin(), clusters.end(), by_start);
+    std::sort(clusters_long.begin(), clusters_long.end(), by_start);
+    EXPECT_LT(0, nb);
+    EXPECT_EQ(nb, nb_long);
+    ASSERT_EQ(clusters.size(), clusters_long.size());
+    for(size_t i = 0; i < clusters.size(); ++i) {
+      ASSERT_EQ(clusters[i].size(), clusters_long[i].size());
+      for(size_t j = 0; j < clusters[i].size(); ++j) {
+        EXPECT_EQ(clusters[i][j].Start1, clusters_long[i][j].Start1);
+        EXPECT_EQ(clusters[i][j].Start2, clusters_long[i][j].Start2);
+        EXPECT_EQ(clusters[i][j].Len, clusters_long[i][j].Len);
+        EXPECT_EQ(clusters[i][j].Simple_Adj, clusters_long[i][j].Simple_Adj);
+      }
+    }
+  }
+} // MGaps.LongMatchesSame
+
+TEST(MGaps, ParallelLong) {
+  const auto                         clusterer = default_clusterer();
+  mummer::thread_pool                pool(4);
+  std::uniform_int_distribution<int> diag(0, 20), step(1, 30), len(10, 40), ref(0, 50);
+
+  // With a thread pool, Cluster_each_long gives the same clusters in
+  // the same order.
+  std::vector<Anchor_t> A(1);
+  for(int s2 = 1; s2 < 200000; s2 += step(rand_gen))
+    A.push_back(Anchor_t(ref(rand_gen) * 1000000 + s2 + diag(rand_gen) + 1, s2, len(rand_gen)));
+  std::shuffle(A.begin() + 1, A.end(), rand_gen);
+  auto B = A;
+
+  clusters_type clusters, clusters_pool;
+  const int nb = clusterer.Cluster_each_long(A.data(), A.size() - 1,
+                                             [&](mummer::mgaps::cluster_type&& cl) { clusters.push_back(std::move(cl)); });
+  const int nb_pool = clusterer.Cluster_each_long(B.data(), B.size() - 1,
+                                                  [&](mummer::mgaps::cluster_type&& cl) { clusters_pool.push_back(std::move(cl)); },
+                                                  &pool);
+  EXPECT_LT(100, nb);
+  EXPECT_EQ(nb, nb_pool);
+  ASSERT_EQ(clusters.size(), clusters_pool.size());
+  for(size_t i = 0; i < clusters.size(); ++i) {
+    ASSERT_EQ(clusters[i].size(), clusters_pool[i].size());
+    for(size_t j = 0; j < clusters[i].size(); ++j) {
+      EXPECT_EQ(clusters[i][j].Start1, clusters_pool[i][j].Start1);
+      EXPECT_EQ(clusters[i][j].Start2, clusters_pool[i][j].Start2);
+      EXPECT_EQ(clusters[i][j].Len, clusters_pool[i][j].Len);
+      EXPECT_EQ(clusters[i][j].Simple_Adj, clusters_pool[i][j].Simple_Adj);
+    }
+  }
+} // MGaps.ParallelLong
+
+TEST(MGaps, LargeClusterChains) {
+  std::uniform_int_distribution<int> diag(-300, 300), step(0, 10), len(5, 60), noise(0, 3);
+
+  // Large clusters, with overlapping matches on many diagonals and
+  // many chains, are chained as by trying all the pairs.
+  for(int t = 0; t < 6; ++t) {
+    SCOPED_TRACE(::testing::Message() << "t:" << t);
+    const bool         use_extents = t % 2;
+    TestClusterMatches clusterer(5, 90, t < 2 ? 0 : 65, 0.12, use_extents);
+    ClusterScratch     scratch;
+    std::vector<Anchor_t> A;
+    const int base = diag(rand_gen);
+    for(int s2 = 1, nb = 200 + 250 * t; nb > 0; --nb, s2 += step(rand_gen))
+      A.push_back(Anchor_t(10000 + s2 + (nb % 3 ? base + noise(rand_gen) : diag(rand_gen)), s2, len(rand_gen)));
+    std::sort(A.begin(), A.end(), [](const Anchor_t& a, const Anchor_t& b) {
+        return a.Start2 < b.Start2 || (a.Start2 == b.Start2 && a.Start1 < b.Start1); });
+
+    const auto    expected = quadratic_chains(A, clusterer.Min_Output_Score, use_extents);
+    clusters_type clusters;
+    const int     nb = clusterer.Process_Cluster(A.data(), A.size(), scratch,
+                                                 [&](mummer::mgaps::cluster_type&& cl) { clusters.push_back(std::move(cl)); });
+    EXPECT_EQ((int)clusters.size(), nb);
+    EXPECT_LT((size_t)1, expected.size());
+    ASSERT_EQ(expected.size(), clusters.size());
+    for(size_t i = 0; i < clusters.size(); ++i) {
+      ASSERT_EQ(expected[i].size(), clusters[i].size());
+      for(size_t j = 0; j < clusters[i].size(); ++j) {
+        EXPECT_EQ(expected[i][j].Start1, clusters[i][j].Start1);
+        EXPECT_EQ(expected[i][j].Start2, clusters[i][j].Start2);
+        EXPECT_EQ(expected[i][j].Len, clusters[i][j].Len);
+        EXPECT_EQ(expected[i][j].Simple_Score, clusters[i][j].Simple_Score);
+        EXPECT_EQ(expected[i][j].Simple_From, clusters[i][j].Simple_From);
+        EXPECT_EQ(expected[i][j].Simple_Adj, clusters[i][j].Simple_Adj);
+      }
+    }
+  }
+} // MGaps.LargeClusterChains
+
+TEST(MGaps, BucketedUnion) {
+  std::uniform_int_distribution<int> diag(-500, 500), step(0, 8), len(5, 40), noise(0, 12);
+
+  // Dense matches, on a few diagonals at a time. Union_Matches, which
+  // tests only the matches in neighbouring diagonal buckets, gives the
+  // same union-find as testing all the pairs in range.
+  for(int t = 0; t < 8; ++t) {
+    SCOPED_TRACE(::testing::Message() << "t:" << t);
+    TestClusterMatches    clusterer(t % 2 ? 0 : 5, 90 + 100 * (t % 3), 65, t < 4 ? 0.12 : 0.5, false);
+    std::vector<Anchor_t> A(1);
+    long                  d = 0;
+    for(int s2 = 1, nb = 0; s2 < 20000; s2 += step(rand_gen), ++nb) {
+      if(nb % 7 == 0) d = diag(rand_gen);
+      A.push_back(Anchor_t(100000 + s2 - d - noise(rand_gen), s2, len(rand_gen)));
+    }
+    std::sort(A.begin() + 1, A.end(), [](const Anchor_t& a, const Anchor_t& b) {
+        return a.Start2 < b.Start2 || (a.Start2 == b.Start2 && a.Start1 < b.Start1); });
+    const int N = A.size() - 1;
+
+    UnionFind expected;
+    expected.reset(N);
+    for(int i = 1; i < N; ++i) {
+      const long i_end  = A[i].Start2 + A[i].Len;
+      const long i_diag = A[i].Start2 - A[i].Start1;
+      for(int j = i + 1; j <= N; ++j) {
+        const long sep = A[j].Start2 - i_end;
+        if(sep > clusterer.Max_Separation) break;
+        const long diag_diff = std::abs((A[j].Start2 - A[j].Start1) - i_diag);
+        if(diag_diff <= std::max(clusterer.Fixed_Separation, (int)(clusterer.Separation_Factor * sep)))
+          expected.union_sets(expected.find(i), expected.find(j));
+      }
+    }
+
+    ClusterScratch scratch;
+    scratch.UF.reset(N);
+    clusterer.Union_Matches(A.data(), N, scratch.UF, scratch);
+    int nb_sets = 0;
+    for(int i = 1; i <= N; ++i) {
+      EXPECT_EQ(expected.find(i), scratch.UF.find(i));
+      nb_sets += expected.find(i) == i;
+    }
+    EXPECT_LT(1, nb_sets);
+    EXPECT_GT(N, nb_sets);
+  }
+} // MGaps.BucketedUnion
+
+TEST(MGaps, WideIndices) {
+  const TestClusterMatches           clusterer(5, 90, 65, 0.12, false);
+  mummer::thread_pool                pool(3);
+  std::uniform_int_distribution<int> diag(0, 20), step(1, 30), len(10, 40), ref(0, 50);
+
+  // Indexing the matches with longs, as for more than 2^31 matches,
+  // gives the same clusters as with ints.
+  std::vector<Anchor_t> A(1);
+  for(int s2 = 1; s2 < 100000; s2 += step(rand_gen))
+    A.push_back(Anchor_t(ref(rand_gen) * 1000000 + s2 + diag(rand_gen) + 1, s2, len(rand_gen)));
+  std::shuffle(A.begin() + 1, A.end(), rand_gen);
+  auto B = A, C = A, D = A;
+
+  std::vector<clusters_type> clusters(4);
+  auto out = [&](int i) { return [&, i](mummer::mgaps::cluster_type&& cl) { clusters[i].push_back(std::move(cl)); }; };
+  ClusterScratch         S;
+  ClusterScratch_t<long> S_long;
+  const int  nb      = clusterer.Cluster_each(A.data(), S, A.size() - 1, out(0));
+  const long nb_long = clusterer.Cluster_each(B.data(), S_long, B.size() - 1, out(1));
+  EXPECT_EQ(nb, nb_long);
+  EXPECT_EQ(nb, clusterer.Cluster_each_long_<int>(C.data(), (int)C.size() - 1, out(2), &pool));
+  EXPECT_EQ(nb, clusterer.Cluster_each_long_<long>(D.data(), (long)D.size() - 1, out(3), &pool));
+  EXPECT_LT(50, nb);
+
+  // Cluster_each and Cluster_each_long may output the clusters in a
+  // different order
+  for(auto& cls : clusters) {
+    ASSERT_EQ((size_t)nb, cls.size());
+    std::sort(cls.begin(), cls.end(), [](const mummer::mgaps::cluster_type& x, const mummer::mgaps::cluster_type& y) {
+        return std::make_pair(x[0].Start2, x[0].Start1) < std::make_pair(y[0].Start2, y[0].Start1); });
+  }
+  for(int k = 1; k < 4; ++k) {
+    SCOPED_TRACE(::testing::Message() << "k:" << k);
+    for(size_t i = 0; i < clusters[0].size(); ++i) {
+      ASSERT_EQ(clusters[0][i].size(), clusters[k][i].size());
+      for(size_t j = 0; j < clusters[0][i].size(); ++j) {
+        EXPECT_EQ(clusters[0][i][j].Start1, clusters[k][i][j].Start1);
+        EXPECT_EQ(clusters[0][i][j].Start2, clusters[k][i][j].Start2);
+        EXPECT_EQ(clusters[0][i][j].Len, clusters[k][i][j].Len);
+        EXPECT_EQ(clusters[0][i][j].Simple_Score, clusters[k][i][j].Simple_Score);
+        EXPECT_EQ(clusters[0][i][j].Simple_Adj, clusters[k][i][j].Simple_Adj);
+      }
+    }
+  }
+} // MGaps.WideIndices
+
+TEST(MGaps, WideDisjointSets) {
+  // The 64 bit disjoint sets give the same partition as the union
+  // find, and keep their rank apart from the ids above 2^32.
+  static const long                   N = 5000;
+  std::uniform_int_distribution<long> elt(1, N);
+  basic_disjoint_sets<uint64_t>       dset(N + 1);
+  UnionFind_t<long>                   expected;
+  expected.reset(N);
+  for(int i = 0; i < 3000; ++i) {
+    const long a = elt(rand_gen), b = elt(rand_gen);
+    dset.unite(a, b);
+    expected.union_sets(expected.find(a), expected.find(b));
+  }
+  for(long a = 1; a <= N; ++a)
+    for(long b = a + 1; b <= std::min(N, a + 50); ++b)
+      EXPECT_EQ(expected.find(a) == expected.find(b), dset.same(a, b));
+
+  const uint64_t big = ((uint64_t)1 << 32) + 17;
+  dset.mData[1] = ((uint64_t)5 << basic_disjoint_sets<uint64_t>::id_bits) | big;
+  EXPECT_EQ(big, dset.parent(1));
+  EXPECT_EQ((uint32_t)5, dset.rank(1));
+} // MGaps.WideDisjointSets
+} // empty namespace
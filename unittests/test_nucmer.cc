@@ -100,4 +100,286 @@ TEST(Nucmer, LongSequences) {
 
 } // Nucmer.LongSequences
 
+TEST(Nucmer, SaveLoadIndex) {
+  const std::string s1 = sequence(1000), s2 = sequence(500);
+  const std::string s3 = s1.substr(900) + sequence(900);
+
+  prefix_unlink prefix("test_nucmer_index");
+  std::istringstream refstream(std::string(">ref1 first\n") + s1 + "\n>ref2\n" + s2 + "\n");
+  mummer::nucmer::Options opts;
+  mummer::nucmer::FileAligner falign(refstream, opts);
+  ASSERT_TRUE(falign.save(prefix.path));
+
+  const mummer::mummer::index_reader index(mummer::mummer::sparseSA::index_path(prefix.path));
+  ASSERT_TRUE(index.good());
+  mummer::nucmer::FileAligner falign2(index, opts);
+  const auto& info = falign.reference_info();
+  const auto& info2 = falign2.reference_info();
+  EXPECT_TRUE(info2.sequence.is_mapped());
+  ASSERT_EQ((size_t)2, info2.size());
+  EXPECT_EQ(std::string(info.sequence.data(), info.sequence.size()),
+            std::string(info2.sequence.data(), info2.sequence.size()));
+  for(size_t i = 0; i < info.size(); ++i) {
+    EXPECT_STREQ(info.header(i), info2.header(i));
+    EXPECT_EQ(info.seq_size(i), info2.seq_size(i));
+  }
+  EXPECT_STREQ("ref1", info2.header(0));
+
+  const mummer::nucmer::FastaRecordSeq query_record(s3, "query");
+  std::vector<mummer::postnuc::Alignment> als, als2;
+  falign.align_long_sequences(query_record, [&](std::vector<mummer::postnuc::Alignment>&& al,
+                                                const mummer::nucmer::FastaRecordPtr& ref,
+                                                const mummer::nucmer::FastaRecordSeq& query) {
+                                als.insert(als.end(), al.begin(), al.end()); });
+  falign2.align_long_sequences(query_record, [&](std::vector<mummer::postnuc::Alignment>&& al,
+                                                 const mummer::nucmer::FastaRecordPtr& ref,
+                                                 const mummer::nucmer::FastaRecordSeq& query) {
+                                 als2.insert(als2.end(), al.begin(), al.end()); });
+  ASSERT_GT(als.size(), (size_t)0);
+  ASSERT_EQ(als.size(), als2.size());
+  for(size_t i = 0; i < als.size(); ++i) {
+    EXPECT_EQ(als[i].sA, als2[i].sA);
+    EXPECT_EQ(als[i].eA, als2[i].eA);
+    EXPECT_EQ(als[i].sB, als2[i].sB);
+    EXPECT_EQ(als[i].eB, als2[i].eB);
+  }
+
+  // The headers of the reference file are checked, not its sequences
+  std::istringstream same(std::string(">ref1 other\nacgt\n>ref2\n"));
+  EXPECT_TRUE(info2.same_headers(same));
+  std::istringstream renamed(std::string(">ref1\n") + s1 + "\n>ref3\n" + s2 + "\n");
+  EXPECT_FALSE(info2.same_headers(renamed));
+  std::istringstream fewer(std::string(">ref1\n") + s1 + "\n");
+  EXPECT_FALSE(info2.same_headers(fewer));
+
+  // A corrupted reference sequence is detected
+  {
+    std::fstream file(mummer::mummer::sparseSA::index_path(prefix.path), std::ios::in | std::ios::out | std::ios::binary);
+    const auto offset = index.header().sections[mummer::mummer::TEXT_SECTION].offset + 10;
+    file.seekg(offset);
+    const char c = file.get();
+    file.seekp(offset);
+    file.put(c == 'a' ? 'c' : 'a');
+  }
+  const mummer::mummer::index_reader corrupted(mummer::mummer::sparseSA::index_path(prefix.path));
+  EXPECT_THROW(mummer::nucmer::sequence_info info3(corrupted), std::runtime_error);
+} // Nucmer.SaveLoadIndex
+
+TEST(Nucmer, ShardedIndex) {
+  // Repeats within and across reference sequences, so uniqueness
+  // depends on the other shards
+  const std::string r1 = sequence(200), r2 = sequence(150);
+  std::string       ref;
+  std::string       qry = r2 + sequence(50);
+  for(int i = 0; i < 8; ++i) {
+    const std::string s = sequence(300 + 50 * i) + (i % 3 == 0 ? r1 : r2.substr(0, 40 * i)) + sequence(200);
+    ref += ">ref" + std::to_string(i) + "\n" + s + "\n";
+    qry += s.substr(100, 250) + sequence(30) + r1.substr(i * 10, 100);
+  }
+
+  auto match_less = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref < b.ref || (a.ref == b.ref && (a.query < b.query || (a.query == b.query && a.len < b.len)));
+  };
+  auto match_equal = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+
+  std::istringstream                  refstream(ref);
+  const mummer::nucmer::sequence_info info(refstream);
+  for(int type = 0; type < 3; ++type) {
+    SCOPED_TRACE(::testing::Message() << "type:" << type);
+    mummer::nucmer::Options opts;
+    opts.minmatch(20).threads(3);
+    switch(type) {
+    case 0: opts.mum(); break;
+    case 1: opts.mumreference(); break;
+    case 2: opts.maxmatch(); break;
+    }
+    const mummer::nucmer::reference_index index(info, opts);
+    ASSERT_EQ((size_t)1, index.size());
+    std::vector<mummer::mummer::match_t> expected;
+    index.find_matches(qry.c_str(), qry.size(), opts, [&](const mummer::mummer::match_t& m) { expected.push_back(m); });
+    std::sort(expected.begin(), expected.end(), match_less);
+    EXPECT_LT((size_t)5, expected.size());
+
+    opts.shard(1500);
+    const mummer::nucmer::reference_index sharded(info, opts);
+    EXPECT_LT((size_t)2, sharded.size());
+    for(size_t s = 0; s < sharded.size(); ++s) {
+      EXPECT_EQ('`', info.sequence[sharded[s].offset]);
+      EXPECT_EQ('`', info.sequence[sharded[s].offset + sharded[s].sa.S.al_ - 1]);
+    }
+    mummer::thread_pool pool(3);
+    for(auto p : { (mummer::thread_pool*)nullptr, &pool }) {
+      std::vector<mummer::mummer::match_t> matches;
+      sharded.find_matches(qry.c_str(), qry.size(), opts, [&](const mummer::mummer::match_t& m) { matches.push_back(m); }, p);
+      std::sort(matches.begin(), matches.end(), match_less);
+      ASSERT_EQ(expected.size(), matches.size());
+      EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), matches.cbegin(), match_equal));
+    }
+  }
+} // Nucmer.ShardedIndex
+
+TEST(Nucmer, BothStrandIndex) {
+  const std::string r1 = sequence(200);
+  std::string       ref, qry = sequence(50);
+  for(int i = 0; i < 5; ++i) {
+    const std::string s = sequence(300 + 50 * i) + r1 + std::string(i, 'n') + sequence(200);
+    ref += ">ref" + std::to_string(i) + "\n" + s + "\n";
+    std::string rc = s.substr(150, 200);
+    mummer::nucmer::reverse_complement(rc);
+    qry += s.substr(100, 250) + sequence(30) + rc + "nnn" + r1.substr(i * 10, 100);
+  }
+
+  auto match_less = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref < b.ref || (a.ref == b.ref && (a.query < b.query || (a.query == b.query && a.len < b.len)));
+  };
+  auto match_equal = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+
+  std::istringstream                  refstream(ref);
+  const mummer::nucmer::sequence_info info(refstream);
+  for(int K : { 1, 3 }) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    mummer::nucmer::Options opts;
+    opts.minmatch(20).maxmatch().sparse(K);
+    const mummer::nucmer::reference_index index(info, opts);
+    ASSERT_FALSE(index.both_strands());
+    opts.both_strand_index();
+    const mummer::nucmer::reference_index both(info, opts);
+    ASSERT_TRUE(both.both_strands());
+
+    std::vector<mummer::mummer::match_t> expected[2], matches[2], forward;
+    index.find_matches_both(qry.c_str(), qry.size(), opts, [&](const mummer::mummer::match_t& m, bool reverse) {
+        expected[reverse].push_back(m); });
+    both.find_matches_both(qry.c_str(), qry.size(), opts, [&](const mummer::mummer::match_t& m, bool reverse) {
+        matches[reverse].push_back(m); });
+    both.find_matches(qry.c_str(), qry.size(), opts, [&](const mummer::mummer::match_t& m) { forward.push_back(m); });
+    std::sort(forward.begin(), forward.end(), match_less);
+    for(int r = 0; r < 2; ++r) {
+      SCOPED_TRACE(::testing::Message() << "reverse:" << r);
+      std::sort(expected[r].begin(), expected[r].end(), match_less);
+      std::sort(matches[r].begin(), matches[r].end(), match_less);
+      EXPECT_LT((size_t)5, expected[r].size());
+      ASSERT_EQ(expected[r].size(), matches[r].size());
+      EXPECT_TRUE(std::equal(expected[r].cbegin(), expected[r].cend(), matches[r].cbegin(), match_equal));
+    }
+    ASSERT_EQ(expected[0].size(), forward.size());
+    EXPECT_TRUE(std::equal(expected[0].cbegin(), expected[0].cend(), forward.cbegin(), match_equal));
+
+    // The batched search of thread_align_file, given a pool
+    mummer::thread_pool                  pool(3);
+    std::vector<mummer::mummer::match_t> pooled;
+    const char*                          P    = qry.c_str();
+    const size_t                         Plen = qry.size();
+    index.find_matches_batch(&P, &Plen, 1, opts, [&](size_t q, const mummer::mummer::match_t& m) {
+        pooled.push_back(m); }, &pool);
+    std::sort(pooled.begin(), pooled.end(), match_less);
+    ASSERT_EQ(expected[0].size(), pooled.size());
+    EXPECT_TRUE(std::equal(expected[0].cbegin(), expected[0].cend(), pooled.cbegin(), match_equal));
+  }
+} // Nucmer.BothStrandIndex
+
+TEST(Nucmer, Prefilter) {
+  std::string ref;
+  for(int i = 0; i < 3; ++i)
+    ref += ">ref" + std::to_string(i) + "\n" + sequence(5000) + "nnnn" + sequence(3000) + "\n";
+  mummer::nucmer::Options opts;
+  opts.minmatch(20);
+  std::istringstream          refstream(ref);
+  mummer::nucmer::FileAligner falign(refstream, opts);
+  opts.prefilter(1);
+  refstream.str(ref);
+  refstream.clear();
+  mummer::nucmer::FileAligner screen(refstream, opts);
+  const auto& info = screen.reference_info();
+
+  int nb_screened = 0;
+  for(int i = 0; i < 200; ++i) {
+    SCOPED_TRACE(::testing::Message() << "i:" << i);
+    std::string qry = sequence(100);
+    if(i % 2 == 0) { // Anchor of minmatch bases, on either strand
+      std::string piece(info.sequence.data() + 1 + (i * 97) % (info.sequence.size() - 100), 20 + i % 7);
+      if(piece.find('`') != std::string::npos) continue;
+      if(i % 4 == 0) mummer::nucmer::reverse_complement(piece);
+      qry.insert(i % 80, piece);
+    }
+    EXPECT_TRUE(falign.prefilter(qry.c_str(), qry.size()));
+    const bool pass = screen.prefilter(qry.c_str(), qry.size());
+    if(i % 2 == 0) {
+      EXPECT_TRUE(pass);
+    }
+    if(pass) continue;
+    ++nb_screened;
+    size_t nb_matches = 0;
+    screen.index().find_matches_both(qry.c_str(), qry.size(), opts,
+                                     [&](const mummer::mummer::match_t& m, bool reverse) { ++nb_matches; });
+    EXPECT_EQ((size_t)0, nb_matches);
+  }
+  EXPECT_LT(50, nb_screened);
+} // Nucmer.Prefilter
+
+TEST(Nucmer, SpacedSeeds) {
+  const std::string s1 = sequence(20000);
+  std::string       s2 = s1.substr(5000, 2000);
+  std::uniform_int_distribution<int> percent(0, 99), base(0, 3);
+  for(char& c : s2) // 85% identity
+    if(percent(rand_gen) < 15)
+      c = "acgt"[(std::string("acgt").find(c) + 1 + base(rand_gen) % 3) % 4];
+
+  mummer::nucmer::Options opts;
+  opts.spaced().minmatch(8);
+  std::istringstream          refstream(std::string(">ref\n") + s1);
+  mummer::nucmer::FileAligner falign(refstream, opts);
+  EXPECT_EQ((size_t)0, falign.index().size());
+
+  // The anchors are exact matches
+  const auto& info       = falign.reference_info();
+  size_t      nb_anchors = 0;
+  falign.index().find_matches(s2.c_str(), s2.size(), opts, [&](const mummer::mummer::match_t& m) {
+      ++nb_anchors;
+      EXPECT_LE(8, m.len);
+      EXPECT_EQ(std::string(info.sequence.data() + m.ref, m.len), s2.substr(m.query, m.len));
+    });
+  EXPECT_LT((size_t)20, nb_anchors);
+
+  // And make one alignment over most of the query
+  const mummer::nucmer::FastaRecordSeq query_record(s2, "query");
+  bool found = false;
+  falign.align_long_sequences(query_record, [&](std::vector<mummer::postnuc::Alignment>&& als,
+                                                const mummer::nucmer::FastaRecordPtr& ref,
+                                                const mummer::nucmer::FastaRecordSeq& query) {
+                                for(const auto& al : als)
+                                  found = found || (al.dirB == 1 && al.sA <= 5200 && al.eA >= 6800);
+                              });
+  EXPECT_TRUE(found);
+
+  // Same with a SequenceAligner, which builds no suffix array
+  found = false;
+  for(const auto& al : mummer::nucmer::align_sequences(s1, s2, opts))
+    found = found || (al.dirB == 1 && al.sA <= 5200 && al.eA >= 6800);
+  EXPECT_TRUE(found);
+} // Nucmer.SpacedSeeds
+
+TEST(Nucmer, SpacedSeedBuckets) {
+  // A text longer than the 4^4 buckets uses the direct table, a
+  // shorter one the sorted array. Both give the windows of a key in
+  // increasing position.
+  const std::string s = sequence(2000);
+  for(size_t len : { (size_t)2000, (size_t)200 }) {
+    SCOPED_TRACE(::testing::Message() << "len:" << len);
+    const mummer::spaced_seed_index index(s.c_str(), len, "110101");
+    std::vector<std::vector<long>> expected(256);
+    index.each(s.c_str(), len, [&](long i, uint32_t key) { expected[key].push_back(i); });
+    EXPECT_EQ(len - 5, index.size());
+    for(uint32_t key = 0; key < expected.size(); ++key) {
+      const auto range = index.bucket(key);
+      ASSERT_EQ(expected[key].size(), range.second - range.first);
+      for(size_t j = range.first; j < range.second; ++j)
+        EXPECT_EQ(expected[key][j - range.first], index.pos(j));
+    }
+  }
+} // Nucmer.SpacedSeedBuckets
+
 } // empty namespace
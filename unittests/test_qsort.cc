@@ -1,14 +1,10 @@
 #include <gtest/gtest.h>
 #include <gtest/test.hpp>
-
-#ifdef _OPENMP
 #include <mummer/openmp_qsort.hpp>
-
-// #ifndef _OPENMP
-// #error OPENMP is required
-// #endif
+#include <mummer/parallel_sort.hpp>
 
 namespace {
+#ifdef _OPENMP
 TEST(Qsort, Integers) {
   static size_t size = 100000;
   std::uniform_int_distribution<int> randnb(-1000000, 1000000);
@@ -21,6 +17,43 @@ TEST(Qsort, Integers) {
   openmp_qsort(numbers.begin(), numbers.end());
   EXPECT_TRUE(std::is_sorted(numbers.cbegin(), numbers.cend()));
 }
-} // empty namespace
+#endif // _OPENMP
+
+TEST(Qsort, ThreadPool) {
+  std::uniform_int_distribution<int> randnb(-1000000, 1000000);
 
-#endif
+  for(unsigned int threads : { 1, 3, 4 }) {
+    SCOPED_TRACE(::testing::Message() << "threads:" << threads);
+    mummer::thread_pool pool(threads);
+    std::vector<int>    numbers;
+    for(size_t i = 0; i < 100000; ++i)
+      numbers.push_back(randnb(rand_gen));
+    auto expected = numbers;
+    std::sort(expected.begin(), expected.end());
+    openmp_qsort(numbers.begin(), numbers.end(), std::less<int>(), pool);
+    EXPECT_TRUE(expected == numbers);
+  }
+}
+
+TEST(ParallelSort, SampleSort) {
+  std::uniform_int_distribution<int> randnb(-1000000, 1000000);
+
+  // Random, sorted, reversed and with few distinct values
+  for(unsigned int threads : { 1, 2, 5 }) {
+    SCOPED_TRACE(::testing::Message() << "threads:" << threads);
+    mummer::thread_pool pool(threads);
+    for(int order = 0; order < 4; ++order) {
+      SCOPED_TRACE(::testing::Message() << "order:" << order);
+      std::vector<int> numbers;
+      for(size_t i = 0; i < 200000; ++i)
+        numbers.push_back(order == 3 ? randnb(rand_gen) % 3 : randnb(rand_gen));
+      if(order == 1) std::sort(numbers.begin(), numbers.end());
+      if(order == 2) std::sort(numbers.begin(), numbers.end(), std::greater<int>());
+      auto expected = numbers;
+      std::sort(expected.begin(), expected.end());
+      mummer::sample_sort(numbers.begin(), numbers.end(), std::less<int>(), pool);
+      EXPECT_TRUE(expected == numbers);
+    }
+  }
+}
+} // empty namespace
@@ -0,0 +1,40 @@
+#include <vector>
+#include <algorithm>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <mummer/radix_sort.hpp>
+#include <mummer/parallel_sort.hpp>
+
+namespace {
+// Parameter is the number of threads: radix_sort with 1,
+// parallel_radix_sort otherwise.
+class RadixSortTest : public ::testing::TestWithParam<unsigned int> { };
+
+TEST_P(RadixSortTest, StablePairs) {
+  static size_t size = 100000;
+  std::uniform_int_distribution<uint64_t> randnb;
+
+  mummer::thread_pool pool(GetParam());
+  for(uint64_t max : { (uint64_t)1, (uint64_t)1000, (uint64_t)1 << 30, (uint64_t)1 << 40 }) {
+    SCOPED_TRACE(::testing::Message() << "threads:" << GetParam() << " max:" << max);
+    std::vector<std::pair<uint64_t, uint32_t>> numbers, tmp(size);
+    for(size_t i = 0; i < size; ++i)
+      numbers.push_back(std::make_pair(randnb(rand_gen) % max, (uint32_t)i));
+    auto expected = numbers;
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+                       return a.first < b.first; });
+
+    auto key = [](const std::pair<uint64_t, uint32_t>& x) { return x.first; };
+    if(GetParam() == 1)
+      mummer::radix_sort(numbers.data(), numbers.data() + numbers.size(), tmp.data(), mummer::radix_bits(max), key);
+    else
+      mummer::parallel_radix_sort(numbers.data(), numbers.data() + numbers.size(), tmp.data(), mummer::radix_bits(max),
+                                  key, pool);
+    EXPECT_TRUE(expected == numbers);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(RadixSort, RadixSortTest, ::testing::Values(1u, 4u));
+} // empty namespace
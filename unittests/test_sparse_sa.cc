@@ -24,6 +24,28 @@ TEST(SparseSA, ComputeLCP) {
   }
 }
 
+TEST(SparseSA, BoundedStringMatch) {
+  const std::string seq = sequence(200) + sequence(30) + "acgtacgtacgtacgtacgtacgtacgtacgtacgtacgtac";
+  const mummer::mummer::bounded_string S(seq.c_str(), seq.size(), 3);
+  const long end = S.length();
+
+  for(long i = 0; i < end + 5; i += 7) {
+    for(long j = 0; j < end; j += 3) {
+      long h = 0;
+      while(i + h < end && j + h < end && S[i + h] == S[j + h]) ++h;
+      EXPECT_EQ(h, S.lcp(i, j, 0, end)) << i << ' ' << j;
+      EXPECT_EQ(h, S.lcp(i, j, h / 2, end)) << i << ' ' << j;
+
+      const std::string P = seq.substr(std::min((size_t)j, seq.size())) + "$$$$";
+      for(long len : { 0L, 5L, 17L, (long)P.size() }) {
+        long m = 0;
+        while(m < len && S[i + m] == P[m]) ++m;
+        EXPECT_EQ(m, S.match(i, P.c_str(), len)) << i << ' ' << j << ' ' << len;
+      }
+    }
+  }
+}
+
 void compareSA(const mummer::mummer::sparseSA& sa, const mummer::mummer::sparseSA& sa2) {
   EXPECT_EQ(sa._4column, sa2._4column);
   EXPECT_EQ(sa.K, sa2.K);
@@ -39,17 +61,26 @@ void compareSA(const mummer::mummer::sparseSA& sa, const mummer::mummer::sparseS
     EXPECT_TRUE(std::equal(sa.SA.small.cbegin(), sa.SA.small.cend(), sa2.SA.small.cbegin()));
   else
     EXPECT_TRUE(std::equal(sa.SA.large.cbegin(), sa.SA.large.cend(), sa2.SA.large.cbegin()));
-  EXPECT_EQ(sa.ISA.is_small, sa2.SA.is_small);
-  EXPECT_EQ(sa.ISA.size(), sa2.SA.size());
-  if(sa.ISA.is_small)
-    EXPECT_TRUE(std::equal(sa.ISA.small.cbegin(), sa.ISA.small.cend(), sa2.ISA.small.cbegin()));
-  else
-    EXPECT_TRUE(std::equal(sa.ISA.large.cbegin(), sa.ISA.large.cend(), sa2.ISA.large.cbegin()));
+  if(sa.hasSufLink || sa2.ISA.size() > 0) { // ISA is saved only for suffix links
+    EXPECT_EQ(sa.ISA.is_small, sa2.ISA.is_small);
+    EXPECT_EQ(sa.ISA.size(), sa2.ISA.size());
+    if(sa.ISA.is_small)
+      EXPECT_TRUE(std::equal(sa.ISA.small.cbegin(), sa.ISA.small.cend(), sa2.ISA.small.cbegin()));
+    else
+      EXPECT_TRUE(std::equal(sa.ISA.large.cbegin(), sa.ISA.large.cend(), sa2.ISA.large.cbegin()));
+  }
   EXPECT_TRUE(std::equal(sa.LCP.vec.cbegin(), sa.LCP.vec.cend(), sa2.LCP.vec.cbegin()));
-  EXPECT_TRUE(std::equal(sa.LCP.M.cbegin(), sa.LCP.M.cend(), sa2.LCP.M.cend()));
+  EXPECT_EQ(sa.LCP.M.size(), sa2.LCP.M.size());
+  EXPECT_TRUE(std::equal(sa.LCP.M.cbegin(), sa.LCP.M.cend(), sa2.LCP.M.cbegin()));
   EXPECT_EQ(&sa2.SA, sa2.LCP.sa);
   EXPECT_TRUE(std::equal(sa.CHILD.cbegin(), sa.CHILD.cend(), sa2.CHILD.cbegin()));
-  EXPECT_TRUE(std::equal(sa.KMR.cbegin(), sa.KMR.cend(), sa2.KMR.cbegin()));
+  EXPECT_EQ(sa.KMR.size(), sa2.KMR.size());
+  EXPECT_TRUE(std::equal(sa.KMR.entries.cbegin(), sa.KMR.entries.cend(), sa2.KMR.entries.cbegin()));
+  EXPECT_EQ(sa.KMR.directory.size(), sa2.KMR.directory.size());
+  EXPECT_TRUE(std::equal(sa.KMR.directory.cbegin(), sa.KMR.directory.cend(), sa2.KMR.directory.cbegin()));
+  EXPECT_EQ(sa.SAMPLE.size(), sa2.SAMPLE.size());
+  EXPECT_EQ(0, memcmp(sa.SAMPLE.entries.data(), sa2.SAMPLE.entries.data(),
+                      sa.SAMPLE.size() * sizeof(mummer::mummer::sa_sample::entry)));
   EXPECT_EQ(sa.hasChild, sa2.hasChild);
   EXPECT_EQ(sa.hasSufLink, sa2.hasSufLink);
   EXPECT_EQ(sa.hasKmer, sa2.hasKmer);
@@ -71,6 +102,7 @@ TEST_P(SparseSATest, SaveLoad) {
   ASSERT_TRUE(sa.save(prefix.path));
   mummer::mummer::sparseSA sa2(seq.c_str(), seq.size(), prefix.path);
   { SCOPED_TRACE(::testing::Message() << "Loaded SA");
+    EXPECT_TRUE(sa2.LCP.vec.is_mapped());
     compareSA(sa, sa2);
   }
 
@@ -79,5 +111,523 @@ TEST_P(SparseSATest, SaveLoad) {
     compareSA(sa, sa3);
   }
 } // SparseSA.SaveLoad
+
+TEST_P(SparseSATest, SaveLoadSelfContained) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string seq = sequence(10000);
+
+  prefix_unlink prefix("test_save_self");
+
+  const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam());
+  ASSERT_TRUE(sa.save(prefix.path));
+
+  // Text read from the index
+  const mummer::mummer::index_reader index(mummer::mummer::sparseSA::index_path(prefix.path));
+  ASSERT_TRUE(index.good());
+  ASSERT_EQ(seq.size(), index.text_length());
+  EXPECT_EQ(seq, std::string(index.text()));
+  const mummer::mummer::sparseSA sa2(index);
+  EXPECT_EQ(index.text(), sa2.S.s_);
+  compareSA(sa, sa2);
+
+  // Index built from another sequence
+  std::string other(seq);
+  other[seq.size() / 2] = other[seq.size() / 2] == 'a' ? 'c' : 'a';
+  EXPECT_THROW(mummer::mummer::sparseSA(other.c_str(), other.size(), prefix.path), std::runtime_error);
+  EXPECT_THROW(mummer::mummer::sparseSA(other.c_str(), other.size() - 1, prefix.path), std::runtime_error);
+} // SparseSA.SaveLoadSelfContained
+
+TEST_P(SparseSATest, DirectLCP) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  // Long repeats give many LCP values >= 255
+  const std::string repeat = sequence(700);
+  std::string seq = sequence(1000);
+  for(int i = 0; i < 20; ++i)
+    seq += repeat + sequence(i * 7);
+
+  const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam());
+  EXPECT_TRUE(sa.LCP.ranks.empty());
+  for(unsigned int threads : { 1, 3 }) {
+    SCOPED_TRACE(::testing::Message() << "threads:" << threads);
+    const auto sa2 = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam(), threads, true);
+    ASSERT_FALSE(sa2.LCP.ranks.empty());
+    ASSERT_GT(sa2.LCP.large.size(), (size_t)1000);
+    EXPECT_TRUE(sa2.LCP.M.empty());
+    size_t nb_large = 0;
+    for(size_t i = 0; i < sa.SA.size(); ++i) {
+      ASSERT_EQ(sa.LCP[i], sa2.LCP[i]) << i;
+      if(sa.LCP.vec[i] == mummer::mummer::vec_uchar::max) {
+        ASSERT_EQ(nb_large, sa2.LCP.rank(i)) << i;
+        ++nb_large;
+      }
+    }
+    EXPECT_EQ(nb_large, sa2.LCP.large.size());
+  }
+
+  prefix_unlink prefix("test_direct_lcp");
+  const auto sa2 = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam(), 2, true);
+  ASSERT_TRUE(sa2.save(prefix.path));
+  mummer::mummer::sparseSA sa3(seq.c_str(), seq.size(), prefix.path);
+  EXPECT_TRUE(sa3.LCP.large.is_mapped());
+  EXPECT_TRUE(std::equal(sa2.LCP.ranks.cbegin(), sa2.LCP.ranks.cend(), sa3.LCP.ranks.cbegin()));
+  EXPECT_TRUE(std::equal(sa2.LCP.large.cbegin(), sa2.LCP.large.cend(), sa3.LCP.large.cbegin()));
+  compareSA(sa2, sa3);
+  EXPECT_FALSE(sa2.save_legacy(prefix.path)); // The legacy format has no direct layout
+} // SparseSA.DirectLCP
+
+TEST_P(SparseSATest, SaveLoadLegacy) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string seq = sequence(10000);
+
+  prefix_unlink prefix("test_save_legacy");
+
+  const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam());
+  ASSERT_TRUE(sa.save_legacy(prefix.path));
+  mummer::mummer::sparseSA sa2(seq.c_str(), seq.size(), prefix.path);
+  EXPECT_FALSE(sa2.LCP.vec.is_mapped());
+  compareSA(sa, sa2);
+} // SparseSA.SaveLoadLegacy
+
+TEST_P(SparseSATest, SaveLoadSparse) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string seq = sequence(10000);
+
+  prefix_unlink prefix("test_save_sparse");
+
+  // K = 4 uses the child table
+  const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, 4, GetParam());
+  ASSERT_TRUE(sa.hasChild);
+  ASSERT_TRUE(sa.save(prefix.path));
+  mummer::mummer::sparseSA sa2(seq.c_str(), seq.size(), prefix.path);
+  compareSA(sa, sa2);
+} // SparseSA.SaveLoadSparse
+
+TEST_P(SparseSATest, MultiThreaded) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(2000);
+  const std::string seq    = sequence(50000) + repeat + sequence(10000) + repeat + std::string(500, 'N') + repeat;
+
+  const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam());
+  for(unsigned int threads : { 2, 5 }) {
+    SCOPED_TRACE(::testing::Message() << "threads:" << threads);
+    const auto sa2 = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 10, true, 1, GetParam(), threads);
+    compareSA(sa, sa2);
+  }
+} // SparseSA.MultiThreaded
+
+TEST_P(SparseSATest, SparseConstruction) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(300);
+  const std::string seq    = sequence(2000) + repeat + sequence(1001) + repeat + std::string(100, 'N') + repeat + "ACACACACACACACACAC";
+
+  for(long K = 2; K <= 4; ++K) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam(), K - 1);
+    const long n  = sa.N / K;
+    ASSERT_EQ((size_t)n, sa.SA.size());
+    ASSERT_EQ((size_t)n, sa.ISA.size());
+
+    // Compare to the sampled suffixes sorted by brute force
+    std::vector<long> pos;
+    for(long i = 0; i < sa.N; i += K) pos.push_back(i);
+    auto suffix_less = [&](long a, long b) {
+      for( ; a < sa.N && b < sa.N; ++a, ++b)
+        if(sa.S[a] != sa.S[b]) return sa.S[a] < sa.S[b];
+      return a == sa.N && b < sa.N;
+    };
+    std::sort(pos.begin(), pos.end(), suffix_less);
+    for(long i = 0; i < n; ++i) {
+      SCOPED_TRACE(::testing::Message() << "i:" << i);
+      ASSERT_EQ(pos[i], sa.SA[i]);
+      ASSERT_EQ(i, sa.ISA[sa.SA[i] / K]);
+      if(i > 0) {
+        long l = 0;
+        while(pos[i - 1] + l < sa.N && pos[i] + l < sa.N && sa.S[pos[i - 1] + l] == sa.S[pos[i] + l]) ++l;
+        ASSERT_EQ((unsigned int)l, sa.LCP[i]);
+      }
+    }
+  }
+} // SparseSA.SparseConstruction
+
+TEST_P(SparseSATest, SparseMEM) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(500);
+  const std::string seq    = sequence(5000) + repeat + sequence(3000) + repeat + std::string(100, 'N') + sequence(1000) + repeat;
+  std::string       qry    = seq.substr(4000, 3000) + sequence(100) + seq.substr(100, 500) + repeat;
+  for(size_t i = 50; i < qry.size(); i += 97)
+    qry[i] = qry[i] == 'A' ? 'C' : 'A';
+
+  auto mem_less = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref < b.ref || (a.ref == b.ref && (a.query < b.query || (a.query == b.query && a.len < b.len)));
+  };
+  auto mem_equal = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+
+  std::vector<mummer::mummer::match_t> expected;
+  const auto sa1 = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, 1, GetParam());
+  sa1.MEM(qry, 20, false, expected);
+  std::sort(expected.begin(), expected.end(), mem_less);
+  EXPECT_LT((size_t)10, expected.size());
+
+  for(long K = 2; K <= 4; ++K) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    std::vector<mummer::mummer::match_t> mems;
+    const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    sa.MEM(qry, 20, false, mems);
+    std::sort(mems.begin(), mems.end(), mem_less);
+    ASSERT_EQ(expected.size(), mems.size());
+    EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), mems.cbegin(), mem_equal));
+  }
+} // SparseSA.SparseMEM
+
+TEST_P(SparseSATest, KmerTable) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(400);
+  std::string       upper  = sequence(300);
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  const std::string seq    = sequence(4000) + repeat + upper + sequence(1000) + repeat + std::string(50, 'N') + repeat + upper;
+  std::string       qry    = seq.substr(3000, 2000) + sequence(100) + upper + repeat;
+  for(size_t i = 50; i < qry.size(); i += 89)
+    qry[i] = qry[i] == 'a' ? 'c' : 'a';
+
+  auto mem_less = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref < b.ref || (a.ref == b.ref && (a.query < b.query || (a.query == b.query && a.len < b.len)));
+  };
+  auto mem_equal = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+
+  for(long K : { 1, 4 }) {
+    mummer::mummer::sparseSA sa0(seq, true, K, K < 4, K >= 4, false, 1, 0, true);
+    sa0.construct(GetParam());
+    std::vector<mummer::mummer::match_t> expected;
+    sa0.MEM(qry, 20, false, expected);
+    std::sort(expected.begin(), expected.end(), mem_less);
+    EXPECT_LT((size_t)10, expected.size());
+
+    for(int k : { 8, 12, 16 }) {
+      for(unsigned int threads : { 1, 3 }) {
+        SCOPED_TRACE(::testing::Message() << "K:" << K << " k:" << k << " threads:" << threads);
+        mummer::mummer::sparseSA sa(seq, true, K, K < 4, K >= 4, true, 1, k, true);
+        sa.construct(GetParam(), threads);
+        ASSERT_EQ(k, sa.KMR.k);
+
+        // Every lower case k-mer at a sampled position is in the table
+        size_t nb = 0;
+        for(long p = 0; p + k <= (long)seq.size(); p += K) {
+          const std::string kmer = seq.substr(p, k);
+          long              s, e;
+          if(kmer.find_first_not_of("acgt") != std::string::npos) continue;
+          uint64_t code = 0;
+          for(char c : kmer) code = (code << 2) | mummer::mummer::BITADD[(int)c];
+          ASSERT_TRUE(sa.KMR.find(code, s, e)) << p;
+          long s2, e2;
+          ASSERT_TRUE(sa.search(kmer.c_str(), k, s2, e2));
+          ASSERT_EQ(s2, s);
+          ASSERT_EQ(e2, e);
+          ++nb;
+        }
+        EXPECT_LT((size_t)0, nb);
+        for(const auto& entry : sa.KMR.entries)
+          EXPECT_LE(entry.start(), entry.end());
+
+        std::vector<mummer::mummer::match_t> mems;
+        sa.MEM(qry, 20, false, mems);
+        std::sort(mems.begin(), mems.end(), mem_less);
+        ASSERT_EQ(expected.size(), mems.size());
+        EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), mems.cbegin(), mem_equal));
+      }
+    }
+  }
+
+  prefix_unlink prefix("test_kmer_table");
+  mummer::mummer::sparseSA sa(seq, true, 1, true, false, true, 1, 16, true);
+  sa.construct(GetParam(), 2);
+  ASSERT_TRUE(sa.save(prefix.path));
+  mummer::mummer::sparseSA sa2(seq, prefix.path);
+  EXPECT_TRUE(sa2.KMR.entries.is_mapped());
+  compareSA(sa, sa2);
+  EXPECT_FALSE(sa.save_legacy(prefix.path)); // Dense legacy table is limited to k <= 12
+} // SparseSA.KmerTable
+
+TEST_P(SparseSATest, ExternalConstruction) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(700);
+  std::string seq = sequence(5000);
+  for(int i = 0; i < 20; ++i)
+    seq += repeat + sequence(i * 13);
+  // Prefix shared by more suffixes than fit in the budget
+  seq += std::string(9000, 'a') + sequence(100);
+
+  prefix_unlink prefix("test_external");
+  for(int K : { 1, 3, 4 }) {
+    for(unsigned int threads : { 1, 3 }) {
+      const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam(), threads);
+      // Budget smaller than the text: blocks and partitions of the
+      // minimum size. Then partitions of a few thousand suffixes.
+      for(size_t mem : { seq.size() / 2, seq.size() + 200000 }) {
+        SCOPED_TRACE(::testing::Message() << "K:" << K << " threads:" << threads << " mem:" << mem);
+        mummer::mummer::index_writer writer(mummer::mummer::sparseSA::index_path(prefix.path));
+        const auto sa2 = mummer::mummer::sparseSA::create_auto_external(writer, mem, seq.c_str(), seq.size(), 20,
+                                                                        true, K, GetParam(), threads);
+        ASSERT_TRUE(writer.close());
+        EXPECT_TRUE(sa2.LCP.vec.is_mapped());
+        compareSA(sa, sa2);
+        mummer::mummer::sparseSA sa3(seq.c_str(), seq.size(), prefix.path);
+        compareSA(sa, sa3);
+      }
+    }
+  }
+} // SparseSA.ExternalConstruction
+
+TEST_P(SparseSATest, BatchMAM) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(300);
+  std::string seq = sequence(5000);
+  for(int i = 0; i < 5; ++i)
+    seq += repeat + sequence(1000);
+
+  // More queries than the batch width, made of pieces of the
+  // reference and random sequence
+  std::vector<std::string> queries;
+  for(size_t i = 0; i < 2 * mummer::mummer::sparseSA::batch_width + 3; ++i)
+    queries.push_back(sequence(i * 7) + seq.substr((i * 1013) % (seq.size() - 500), 100 + i * 11) + sequence(50) +
+                      repeat.substr(i * 3));
+  queries.push_back("");
+  std::vector<const char*> P;
+  std::vector<size_t>      Plen;
+  for(const auto& q : queries) {
+    P.push_back(q.c_str());
+    Plen.push_back(q.size());
+  }
+
+  auto same = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+  for(bool child : { false, true }) {
+    SCOPED_TRACE(::testing::Message() << "child:" << child);
+    mummer::mummer::sparseSA sa(seq, true, 1, true, child, true, 1, 8, true);
+    sa.construct(GetParam());
+    std::vector<std::vector<mummer::mummer::match_t>> mams(P.size()), mums(P.size());
+    sa.findMAM_batch(P.data(), Plen.data(), P.size(), 20, false,
+                     [&](size_t q, const mummer::mummer::match_t& m) { mams[q].push_back(m); });
+    sa.findMUM_batch(P.data(), Plen.data(), P.size(), 20, false,
+                     [&](size_t q, const mummer::mummer::match_t& m) { mums[q].push_back(m); });
+    size_t nb_mams = 0;
+    for(size_t q = 0; q < P.size(); ++q) {
+      SCOPED_TRACE(::testing::Message() << "query:" << q);
+      std::vector<mummer::mummer::match_t> expected;
+      sa.findMAM(queries[q], 20, false, expected);
+      ASSERT_EQ(expected.size(), mams[q].size());
+      EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), mams[q].cbegin(), same));
+      nb_mams += expected.size();
+      expected.clear();
+      sa.findMUM_each(queries[q], 20, false, [&](const mummer::mummer::match_t& m) { expected.push_back(m); });
+      ASSERT_EQ(expected.size(), mums[q].size());
+      EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), mums[q].cbegin(), same));
+    }
+    EXPECT_GT(nb_mams, queries.size() / 2);
+  }
+} // SparseSA.BatchMAM
+
+TEST_P(SparseSATest, SampleSearch) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(100);
+  std::string seq = sequence(20000);
+  for(int i = 0; i < 30; ++i)
+    seq += repeat + sequence(i);
+
+  for(long K : { 1, 3 }) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    const auto sa  = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    auto       sa2 = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    ASSERT_FALSE(sa.hasChild);
+    ASSERT_EQ((sa.N / K + mummer::mummer::sa_sample::step - 1) / mummer::mummer::sa_sample::step, (long)sa.SAMPLE.size());
+    sa2.SAMPLE.entries.clear(); // Plain binary searches
+
+    for(int p = 0; p < 300; ++p) {
+      std::string P = p % 3 ? seq.substr((p * 7919) % (seq.size() - 30), 30) : sequence(30);
+      if(p % 5 == 0) P[p % 20] = 'n';
+      SCOPED_TRACE(::testing::Message() << "P:" << P);
+      long start, end, start2, end2;
+      EXPECT_EQ(sa2.search(P.c_str(), P.size(), start2, end2), sa.search(P.c_str(), P.size(), start, end));
+      EXPECT_EQ(start2, start);
+      EXPECT_EQ(end2, end);
+
+    }
+
+    // The traversals of the MEM search use the other binary search
+    const std::string Q = sequence(500) + seq.substr(10000, 3000) + repeat + sequence(200) + seq.substr(20000);
+    std::vector<mummer::mummer::match_t> mems, mems2;
+    sa.MEM(Q, 20, false, mems);
+    sa2.MEM(Q, 20, false, mems2);
+    ASSERT_GT(mems.size(), (size_t)30);
+    ASSERT_EQ(mems2.size(), mems.size());
+    for(size_t i = 0; i < mems.size(); ++i) {
+      EXPECT_EQ(mems2[i].ref, mems[i].ref);
+      EXPECT_EQ(mems2[i].query, mems[i].query);
+      EXPECT_EQ(mems2[i].len, mems[i].len);
+    }
+  }
+} // SparseSA.SampleSearch
+
+TEST_P(SparseSATest, WindowedMatches) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(300);
+  std::string       seq    = sequence(10000);
+  for(int i = 0; i < 5; ++i)
+    seq += repeat + sequence(2000);
+  // Long enough to be split in windows
+  std::string qry;
+  for(long i = 0; (long)qry.size() < 3 * mummer::mummer::sparseSA::min_window; ++i)
+    qry += seq.substr((i * 4999) % (seq.size() - 400), 50 + i % 300) + sequence(i % 40);
+
+  auto match_less = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref < b.ref || (a.ref == b.ref && (a.query < b.query || (a.query == b.query && a.len < b.len)));
+  };
+  auto match_equal = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+  auto check = [&](std::vector<mummer::mummer::match_t> expected, std::vector<mummer::mummer::match_t> matches) {
+    std::sort(expected.begin(), expected.end(), match_less);
+    std::sort(matches.begin(), matches.end(), match_less);
+    ASSERT_EQ(expected.size(), matches.size());
+    EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), matches.cbegin(), match_equal));
+  };
+
+  mummer::thread_pool pool(4);
+  for(long K : { 1, 3 }) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    std::vector<mummer::mummer::match_t> expected, matches;
+    sa.MEM(qry, 20, false, expected);
+    EXPECT_LT((size_t)100, expected.size());
+
+    // Small windows, to have many matches across window boundaries
+    for(long from = 0, to; from < (long)qry.size(); from = to) {
+      to = std::min((long)qry.size(), from + 37 + from % 53);
+      for(long k = 0; k < K; ++k)
+        sa.findMEM_k_window(qry.c_str(), qry.size(), k, from, to, 20, false,
+                            [&](const mummer::mummer::match_t& m) { matches.push_back(m); });
+    }
+    check(expected, matches);
+    matches.clear();
+    sa.findMEM_each(qry.c_str(), qry.size(), 20, false,
+                    [&](const mummer::mummer::match_t& m) { matches.push_back(m); }, pool);
+    check(expected, matches);
+    if(K != 1) continue;
+
+    expected.clear();
+    matches.clear();
+    sa.findMAM(qry, 20, false, expected);
+    EXPECT_LT((size_t)100, expected.size());
+    for(long from = 0, to; from < (long)qry.size(); from = to) {
+      to = std::min((long)qry.size(), from + 37 + from % 53);
+      sa.findMAM_window(qry.c_str(), qry.size(), from, to, 20, false,
+                        [&](const mummer::mummer::match_t& m) { matches.push_back(m); });
+    }
+    check(expected, matches);
+    matches.clear();
+    sa.findMAM_each(qry.c_str(), qry.size(), 20, false,
+                    [&](const mummer::mummer::match_t& m) { matches.push_back(m); }, pool);
+    check(expected, matches);
+
+    expected.clear();
+    matches.clear();
+    sa.MUM(qry, 20, false, expected);
+    sa.findMUM_each(qry.c_str(), qry.size(), 20, false,
+                    [&](const mummer::mummer::match_t& m) { matches.push_back(m); }, pool);
+    check(expected, matches);
+  }
+} // SparseSA.WindowedMatches
+
+TEST_P(SparseSATest, ParallelOffsets) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  const std::string repeat = sequence(300);
+  std::string       seq    = sequence(10000);
+  for(int i = 0; i < 5; ++i)
+    seq += repeat + sequence(2000);
+  // Short query (one window) and long query (many windows)
+  std::string short_qry, long_qry;
+  for(long i = 0; (long)short_qry.size() < 5000; ++i)
+    short_qry += seq.substr((i * 4999) % (seq.size() - 400), 50 + i % 300) + sequence(i % 40);
+  while((long)long_qry.size() < 3 * mummer::mummer::sparseSA::min_window)
+    long_qry += short_qry;
+
+  // The K passes run in parallel give the same matches in the same
+  // order as the sequential passes
+  mummer::thread_pool pool(4);
+  for(long K : { 2, 3, 5 }) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    for(const std::string* qry : { &short_qry, &long_qry }) {
+      SCOPED_TRACE(::testing::Message() << "len:" << qry->size());
+      std::vector<mummer::mummer::match_t> expected, matches;
+      sa.MEM(*qry, 20, false, expected);
+      EXPECT_LT((size_t)50, expected.size());
+      sa.MEM(qry->c_str(), qry->size(), 20, false, matches, pool);
+      ASSERT_EQ(expected.size(), matches.size());
+      for(size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i].ref, matches[i].ref);
+        EXPECT_EQ(expected[i].query, matches[i].query);
+        EXPECT_EQ(expected[i].len, matches[i].len);
+      }
+    }
+  }
+} // SparseSA.ParallelOffsets
+
+TEST_P(SparseSATest, MaxOccurrences) {
+  SCOPED_TRACE(::testing::Message() << (GetParam() ? "Large" : "Small") << " SA");
+  // A repeat with 3 and 30 copies of its two halves
+  const std::string repeat = sequence(200);
+  std::string       seq    = sequence(2000);
+  for(int i = 0; i < 30; ++i)
+    seq += (i % 10 ? repeat.substr(0, 100) + sequence(100) : repeat) + sequence(300);
+  const std::string qry = seq.substr(1000, 3000) + sequence(100) + repeat + sequence(100) + seq.substr(7000, 500);
+
+  auto occurrences = [&](const std::string& s) {
+    long res = 0;
+    for(size_t pos = seq.find(s); pos != std::string::npos; pos = seq.find(s, pos + 1))
+      ++res;
+    return res;
+  };
+  auto same = [](const mummer::mummer::match_t& a, const mummer::mummer::match_t& b) {
+    return a.ref == b.ref && a.query == b.query && a.len == b.len;
+  };
+
+  for(long K : { 1, 3 }) {
+    SCOPED_TRACE(::testing::Message() << "K:" << K);
+    const auto sa = mummer::mummer::sparseSA::create_auto(seq.c_str(), seq.size(), 20, true, K, GetParam());
+    std::vector<mummer::mummer::match_t> expected, matches;
+    sa.MEM(qry, 20, false, expected);
+
+    // A large limit changes nothing
+    size_t skipped = 0;
+    sa.findMEM_each(qry.c_str(), qry.size(), 20, false, [&](const mummer::mummer::match_t& m) { matches.push_back(m); },
+                    1000, &skipped);
+    EXPECT_EQ((size_t)0, skipped);
+    ASSERT_EQ(expected.size(), matches.size());
+    EXPECT_TRUE(std::equal(expected.cbegin(), expected.cend(), matches.cbegin(), same));
+
+    matches.clear();
+    sa.findMEM_each(qry.c_str(), qry.size(), 20, false, [&](const mummer::mummer::match_t& m) { matches.push_back(m); },
+                    5, &skipped);
+    EXPECT_LT((size_t)0, skipped);
+    EXPECT_GT(expected.size(), matches.size());
+    for(const auto& m : matches)
+      EXPECT_TRUE(std::any_of(expected.cbegin(), expected.cend(),
+                              [&](const mummer::mummer::match_t& e) { return same(e, m); }));
+    if(K != 1) continue; // The sparse suffix array holds only some of the occurrences
+    // With a full suffix array, exactly the MEMs occurring at most 5 times
+    for(const auto& m : matches)
+      EXPECT_GE(5, occurrences(seq.substr(m.ref, m.len)));
+    long nb = 0;
+    for(const auto& m : expected)
+      nb += occurrences(seq.substr(m.ref, m.len)) <= 5;
+    EXPECT_EQ(nb, (long)matches.size());
+  }
+} // SparseSA.MaxOccurrences
+
 INSTANTIATE_TEST_CASE_P(SparseSA, SparseSATest, ::testing::Bool());
 } // empty namespace
@@ -0,0 +1,39 @@
+#include <vector>
+#include <atomic>
+#include <gtest/gtest.h>
+
+#include <mummer/thread_pool.hpp>
+
+namespace {
+TEST(ThreadPool, Run) {
+  for(unsigned int threads : { 1, 2, 5 }) {
+    mummer::thread_pool pool(threads);
+    EXPECT_EQ(threads, pool.size());
+    for(int i = 0; i < 10; ++i) {
+      std::vector<int> seen(threads, 0);
+      pool.run([&](unsigned int id) { ++seen[id]; });
+      for(unsigned int j = 0; j < threads; ++j)
+        EXPECT_EQ(1, seen[j]);
+    }
+  }
+} // ThreadPool.Run
+
+TEST(ThreadPool, ParallelFor) {
+  mummer::thread_pool pool(4);
+  for(long n : { 0, 1, 3, 4, 1000, 1001 }) {
+    SCOPED_TRACE(::testing::Message() << "n:" << n);
+    std::vector<int>  count(n, 0);
+    std::atomic<long> sum(0);
+    pool.parallel_for(0, n, [&](long begin, long end, unsigned int id) {
+        EXPECT_LT(id, pool.size());
+        for(long i = begin; i < end; ++i) {
+          ++count[i];
+          sum += i;
+        }
+      });
+    for(long i = 0; i < n; ++i)
+      EXPECT_EQ(1, count[i]);
+    EXPECT_EQ(n * (n - 1) / 2, sum);
+  }
+} // ThreadPool.ParallelFor
+} // empty namespace